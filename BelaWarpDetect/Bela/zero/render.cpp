@@ -9,10 +9,21 @@
 #include <Bela.h>
 #include <WriteFile.h>
 
+#include <vector>
+
 #include "MatchSyllables.hpp"
+#include "MultiChannelShortTimeFourierTransform.hpp"
+
+// one matcher per input channel (microphone)
+unsigned int gChannels = 0;
+std::vector<MatchSyllables *> gMatchers;
+unsigned int gMatchChannel = 0; // channel being matched (for on_match)
 
-// matcher
-MatchSyllables *gMatcher;
+// spectrogram of all channels
+MultiChannelShortTermFourierTransform *gSTFT = NULL;
+const unsigned int gBufferLength = 2097152;
+const unsigned int gBatchColumns = 32;
+std::vector<float> gPower;
 
 // output status
 unsigned int gTTL = 0;
@@ -32,24 +43,37 @@ bool setup(BelaContext *context, void *userData)
 {
     rt_printf("Setup.\n");
     
-    // create marcher
-    gMatcher = new MatchSyllables(context->audioSampleRate);
+    gChannels = context->audioInChannels;
+    for (unsigned int c = 0; c < gChannels; ++c) {
+        // create marcher (audio arrives as band power, so it needs no audio buffer of its own)
+        MatchSyllables *matcher = new MatchSyllables(context->audioSampleRate, 0, 4096);
+        gMatchers.push_back(matcher);
     
-    // load syllable
-    // gMatcher->AddSpectrogram("syllable04.bin", 0.392858, 0.2)
-    if (-1 == gMatcher->AddSpectrogram("syllable01.bin", 0.372151, 0.2)) {
-        rt_printf("Unable to load syllable file.\n");
-        return false;
+        // load syllable
+        // matcher->AddSpectrogram("syllable04.bin", 0.392858, 0.2)
+        if (-1 == matcher->AddSpectrogram("syllable01.bin", 0.372151, 0.2)) {
+            rt_printf("Unable to load syllable file.\n");
+            return false;
+        }
+        
+        // set callback
+        matcher->SetCallbackMatch(on_match);
+        
+        // only matches are used, so skip rows that can not reach the threshold
+        matcher->SetPruning(true);
+        
+        // initialize matcher
+        if (!matcher->Initialize()) {
+            rt_printf("Unable to initialize matcher.\n");
+            return false;
+        }
     }
     
-    // set callback
-    gMatcher->SetCallbackMatch(on_match);
-    
-    // initialize matcher
-    if (!gMatcher->Initialize()) {
-        rt_printf("Unable to initialize matcher.\n");
-        return false;
-    }
+    // create spectrogram (same parameters as the matchers)
+    MatchSyllables *first = gMatchers[0];
+    gSTFT = new MultiChannelShortTermFourierTransform(gChannels, first->GetWindowLength(), first->GetWindowStride(), gBufferLength);
+    gSTFT->SetWindowHanning();
+    gPower.resize(gBatchColumns * gChannels * (first->GetIndexHigh() - first->GetIndexLow()));
     
     // initialize auxiliary task
     gMatchTask = Bela_createAuxiliaryTask(&process_match_background, 90, "match");
@@ -60,7 +84,7 @@ bool setup(BelaContext *context, void *userData)
     
     // create log file
     gLogFile.init("log.txt");
-    gLogFile.setFormat("%.4f\n");
+    gLogFile.setFormat("%.0f %.4f\n");
     gLogFile.setFileType(kText);
     gLogFile.setEchoInterval(1);
     
@@ -69,14 +93,26 @@ bool setup(BelaContext *context, void *userData)
 
 void process_match_background(void *)
 {
-    gMatcher->PerformMatching();
+    unsigned int idx_lo = gMatchers[0]->GetIndexLow(), idx_hi = gMatchers[0]->GetIndexHigh();
+    unsigned int band = idx_hi - idx_lo;
+    
+    // read columns for all channels at once, then hand each channel to its matcher
+    unsigned int columns;
+    while ((columns = gSTFT->ReadPowerBatch(&gPower[0], gBatchColumns, idx_lo, idx_hi)) > 0) {
+        for (unsigned int i = 0; i < columns; ++i) {
+            for (gMatchChannel = 0; gMatchChannel < gChannels; ++gMatchChannel) {
+                gMatchers[gMatchChannel]->MatchPower(&gPower[(i * gChannels + gMatchChannel) * band]);
+            }
+        }
+    }
 }
 
 void on_match(size_t index, float score, int last_len)
 {
     if (0 == index) {
-        // output score
-        gLogFile.log(score);
+        // output channel and score
+        float entry[2] = {static_cast<float>(gMatchChannel), score};
+        gLogFile.log(entry, 2);
         
         // ttl pulse
         gTTL = 1;
@@ -94,14 +130,12 @@ void render(BelaContext *context, void *userData)
     unsigned int numAudioInChannels = context->audioInChannels;
     unsigned int numAudioOutChannels = context->audioOutChannels;
     
-    // input
+    // input (all channels, split into one buffer each)
     if (isInterleaved) {
-        // interleaved input, use stride
-        gMatcher->IngestAudio(context->audioIn, numAudioFrames, numAudioInChannels);
+        gSTFT->WriteValues(context->audioIn, numAudioFrames, numAudioInChannels, 1);
     }
     else {
-        // use first channel (not interleaved)
-        gMatcher->IngestAudio(context->audioIn, numAudioFrames);
+        gSTFT->WriteValues(context->audioIn, numAudioFrames, 1, numAudioFrames);
     }
     
     // zero outputs
@@ -170,7 +204,16 @@ void render(BelaContext *context, void *userData)
 
 void cleanup(BelaContext *context, void *userData)
 {
-    // release matcher
-    delete gMatcher;
-    gMatcher = NULL;
+    // report dropped audio
+    if (gSTFT) {
+        rt_printf("Overruns: %u\n", gSTFT->GetOverruns());
+    }
+    
+    // release spectrogram and matchers
+    delete gSTFT;
+    gSTFT = NULL;
+    for (unsigned int c = 0; c < gMatchers.size(); ++c) {
+        delete gMatchers[c];
+    }
+    gMatchers.clear();
 }
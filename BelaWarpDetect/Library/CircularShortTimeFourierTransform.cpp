@@ -7,9 +7,155 @@
 //
 
 #include "CircularShortTimeFourierTransform.hpp"
+#include "Simd.hpp"
 
 #include <iostream>
 #include <cmath>
+#include <cstring> // memcpy
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+
+// process-wide cache for the parts of a transform that only depend on its length, so constructing
+// transforms over and over (as the MEX functions do) skips plan and window setup; windows are
+// immutable and shared, while plans carry scratch space and are lent to one instance at a time
+enum window_type {
+    window_hanning,
+    window_hamming
+};
+
+static std::shared_ptr<const std::vector<fft_value_t>> make_window(window_type type, fft_length_t length) {
+    std::vector<fft_value_t> *window = new std::vector<fft_value_t>(length);
+    for (fft_length_t i = 0, j = length - 1; i <= j; ++i, --j) {
+        float v;
+        if (type == window_hanning) {
+            v = 0.5 * (1.0 - cos(2.0 * M_PI * static_cast<float>(i + 1) / (static_cast<float>(length + 1))));
+        }
+        else {
+            v = 0.54 - 0.46 * cos(2.0 * M_PI * static_cast<float>(i) / static_cast<float>(length - 1));
+        }
+        (*window)[i] = v;
+        (*window)[j] = v;
+    }
+    return std::shared_ptr<const std::vector<fft_value_t>>(window);
+}
+
+static fft_config_t make_plan(fft_length_t length) {
+#if defined(FFT_BACKEND_ACCELERATE)
+    return vDSP_DFT_zrop_CreateSetup(NULL, length, vDSP_DFT_FORWARD);
+#elif defined(FFT_BACKEND_NE10)
+    return ne10_fft_alloc_r2c_float32(length);
+#else
+    return new FastFourierTransform(length);
+#endif
+}
+
+static void destroy_plan(fft_config_t plan) {
+#if defined(FFT_BACKEND_ACCELERATE)
+    vDSP_DFT_DestroySetup(plan);
+#elif defined(FFT_BACKEND_NE10)
+    NE10_FREE(plan);
+#else
+    delete plan;
+#endif
+}
+
+class TransformCache
+{
+public:
+    ~TransformCache() {
+        for (auto it = _plans.begin(); it != _plans.end(); ++it) {
+            destroy_plan(it->second);
+        }
+    }
+    
+    std::shared_ptr<const std::vector<fft_value_t>> GetWindow(window_type type, fft_length_t length) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::shared_ptr<const std::vector<fft_value_t>> &window = _windows[std::make_pair(type, length)];
+        if (!window) {
+            window = make_window(type, length);
+        }
+        return window;
+    }
+    
+    // take an idle plan from the pool, or make a new one
+    fft_config_t AcquirePlan(fft_length_t length) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto it = _plans.find(length);
+            if (it != _plans.end()) {
+                fft_config_t plan = it->second;
+                _plans.erase(it);
+                return plan;
+            }
+        }
+        
+        return make_plan(length);
+    }
+    
+    // return a plan to the pool
+    void ReleasePlan(fft_length_t length, fft_config_t plan) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _plans.insert(std::make_pair(length, plan));
+    }
+
+private:
+    std::mutex _mutex;
+    std::map<std::pair<window_type, fft_length_t>, std::shared_ptr<const std::vector<fft_value_t>>> _windows;
+    std::multimap<fft_length_t, fft_config_t> _plans;
+};
+
+// constructed on first use, so it is available to transforms with static storage duration
+static TransformCache &transform_cache() {
+    static TransformCache cache;
+    return cache;
+}
+
+// copy (and convert) samples into or out of the circular buffer; Q15 values are scaled so that
+// 32768 is 1.0 and saturate at the ends of the range
+static inline int16_t float_to_q15(float v) {
+    float s = floorf(v * 32768.f + 0.5f);
+    return static_cast<int16_t>(s > 32767.f ? 32767.f : (s < -32768.f ? -32768.f : s));
+}
+
+static inline void copy_samples(float *dest, const float *src, unsigned int len, unsigned int stride) {
+    if (stride == 1) {
+        memcpy(dest, src, sizeof(float) * len);
+    }
+    else {
+        for (unsigned int i = 0; i < len; ++i) {
+            dest[i] = src[i * stride];
+        }
+    }
+}
+
+static inline void copy_samples(int16_t *dest, const int16_t *src, unsigned int len, unsigned int stride) {
+    if (stride == 1) {
+        memcpy(dest, src, sizeof(int16_t) * len);
+    }
+    else {
+        for (unsigned int i = 0; i < len; ++i) {
+            dest[i] = src[i * stride];
+        }
+    }
+}
+
+static inline void copy_samples(int16_t *dest, const float *src, unsigned int len, unsigned int stride) {
+    for (unsigned int i = 0; i < len; ++i) {
+        dest[i] = float_to_q15(src[i * stride]);
+    }
+}
+
+static inline void copy_samples(float *dest, const int16_t *src, unsigned int len, unsigned int stride) {
+    for (unsigned int i = 0; i < len; ++i) {
+        dest[i] = static_cast<float>(src[i * stride]) * (1.f / 32768.f);
+    }
+}
+
+// vector load from the circular buffer
+static inline simd_float simd_load_sample(const float *p) { return simd_load(p); }
+static inline simd_float simd_load_sample(const int16_t *p) { return simd_load_int16(p); }
 
 CircularShortTermFourierTransform::CircularShortTermFourierTransform(unsigned int window_length, unsigned int window_stride, unsigned int buffer_size) :
 _buffer_size(buffer_size),
@@ -19,52 +165,77 @@ _fft_size(static_cast<fft_length_t>(ceil(log2(window_length)))),
 _fft_length(1 << _fft_size),
 _fft_length_half(_fft_length / 2),
 _window(_window_length),
-#if defined(BELA_MAJOR_VERSION)
+#if defined(STFT_Q15_BUFFER)
+_window_scaled(_window_length),
+#endif
+#if defined(STFT_Q15_FFT)
+_window_fixed(_window_length),
+#endif
+#if !defined(STFT_TPCIRCULARBUFFER)
 _buffer(buffer_size),
 #endif
+#if defined(FFT_BACKEND_BUILTIN)
+_samples_batch(SIMD_WIDTH * _fft_length),
+_batch_output_real(SIMD_WIDTH * (_fft_length_half + 1)),
+_batch_output_imag(SIMD_WIDTH * (_fft_length_half + 1)),
+#endif
+#if defined(STFT_Q15_FFT)
+_fft_fixed(_fft_length),
+_samples_fixed(_fft_length),
+_fixed_output_real(_fft_length_half + 1),
+_fixed_output_imag(_fft_length_half + 1),
+#endif
 _samples_windowed(_fft_length) {
-#if !defined(BELA_MAJOR_VERSION)
+#if defined(STFT_TPCIRCULARBUFFER)
     // initialize buffer
-    TPCircularBufferInit(&_buffer, buffer_size * sizeof(fft_value_t));
+    TPCircularBufferInit(&_buffer, buffer_size * sizeof(stft_sample_t));
+#elif defined(STFT_MIRRORED_BUFFER)
+    // mirrored memory is rounded up to whole pages
+    _buffer_size = static_cast<unsigned int>(_buffer.size());
 #endif
     
     // initialize window to 1s
     for (unsigned int i = 0; i < _window_length; ++i) {
         _window[i] = 1.;
     }
+    _UpdateWindow();
     
     // platform specific memory
-#if defined(__APPLE__)
+#if defined(FFT_BACKEND_ACCELERATE)
     _fft_input.realp = new fft_value_t[_fft_length_half];
     _fft_input.imagp = new fft_value_t[_fft_length_half];
     _fft_output.realp = new fft_value_t[_fft_length_half];
     _fft_output.imagp = new fft_value_t[_fft_length_half];
-    
-    _fft_config = vDSP_DFT_zrop_CreateSetup(NULL, _fft_length, vDSP_DFT_FORWARD);
-#else
+#elif defined(FFT_BACKEND_NE10)
     _fft_output = (ne10_fft_cpx_float32_t *)NE10_MALLOC(sizeof(ne10_fft_cpx_float32_t) * _fft_length);
-    
-    _fft_config = ne10_fft_alloc_r2c_float32(_fft_length);
+#else
+    _fft_output_real = new fft_value_t[_fft_length_half + 1];
+    _fft_output_imag = new fft_value_t[_fft_length_half + 1];
 #endif
+    
+    // shared setup
+    _fft_config = transform_cache().AcquirePlan(_fft_length);
 }
 
 CircularShortTermFourierTransform::~CircularShortTermFourierTransform() {
     // platform specific resources
-#if !defined(BELA_MAJOR_VERSION)
+#if defined(STFT_TPCIRCULARBUFFER)
     TPCircularBufferCleanup(&_buffer);
 #endif
     
-#if defined(__APPLE__)
-    vDSP_DFT_DestroySetup(_fft_config);
+    // plan goes back to the pool
+    transform_cache().ReleasePlan(_fft_length, _fft_config);
     
+#if defined(FFT_BACKEND_ACCELERATE)
     delete[] _fft_input.realp;
     delete[] _fft_input.imagp;
     delete[] _fft_output.realp;
     delete[] _fft_output.imagp;
-#else
-    NE10_FREE(_fft_config);
-    
+#elif defined(FFT_BACKEND_NE10)
     NE10_FREE(_fft_output);
+#else
+    delete[] _fft_output_real;
+    delete[] _fft_output_imag;
 #endif
 }
 
@@ -85,37 +256,39 @@ bool CircularShortTermFourierTransform::SetWindow(const std::vector<fft_value_t>
         _window[i] = window[i];
     }
     
+    _UpdateWindow();
+    
     return true;
 }
 
 void CircularShortTermFourierTransform::SetWindowHanning() {
-    for (fft_length_t i = 0, j = _window_length - 1; i <= j; ++i, --j) {
-        float v = 0.5 * (1.0 - cos(2.0 * M_PI * static_cast<float>(i + 1) / (static_cast<float>(_window_length + 1))));
-        _window[i] = v;
-        _window[j] = v;
-    }
+    std::shared_ptr<const std::vector<fft_value_t>> window = transform_cache().GetWindow(window_hanning, _window_length);
+    memcpy(_window.ptr(), &(*window)[0], sizeof(fft_value_t) * _window_length);
+    
+    _UpdateWindow();
 }
 
 void CircularShortTermFourierTransform::SetWindowHamming() {
-    for (fft_length_t i = 0, j = _window_length - 1; i <= j; ++i, --j) {
-        float v = 0.54 - 0.46 * cos(2.0 * M_PI * static_cast<float>(i) / static_cast<float>(_window_length - 1));
-        _window[i] = v;
-        _window[j] = v;
-    }
+    std::shared_ptr<const std::vector<fft_value_t>> window = transform_cache().GetWindow(window_hamming, _window_length);
+    memcpy(_window.ptr(), &(*window)[0], sizeof(fft_value_t) * _window_length);
+    
+    _UpdateWindow();
 }
 
-// get length
+// get length (consumer side: acquire the write pointer, so the values behind it are visible)
 unsigned int CircularShortTermFourierTransform::GetLengthValues() {
-#if defined(BELA_MAJOR_VERSION)
-    if (_ptr_write >= _ptr_read) {
-        return _ptr_write - _ptr_read;
+#if !defined(STFT_TPCIRCULARBUFFER)
+    unsigned int ptr_write = _ptr_write.load(std::memory_order_acquire);
+    unsigned int ptr_read = _ptr_read.load(std::memory_order_relaxed);
+    if (ptr_write >= ptr_read) {
+        return ptr_write - ptr_read;
     }
     
-    return _buffer_size + _ptr_write - _ptr_read;
+    return _buffer_size + ptr_write - ptr_read;
 #else
     uint32_t available_bytes = 0;
     TPCircularBufferTail(&_buffer, &available_bytes);
-    return available_bytes / sizeof(fft_value_t);
+    return available_bytes / sizeof(stft_sample_t);
 #endif
 }
 
@@ -124,21 +297,24 @@ unsigned int CircularShortTermFourierTransform::GetLengthColumns() {
     return ConvertSamplesToColumns(GetLengthValues());
 }
 
+// producer side: acquire the read pointer, so the consumer is done with the space being reused
 unsigned int CircularShortTermFourierTransform::GetLengthCapacity() {
-#if defined(BELA_MAJOR_VERSION)
+#if !defined(STFT_TPCIRCULARBUFFER)
     // ptr_read == ptr_write means empty, therefore can not be completely full
     // can store up to buffer_size - 1
+    unsigned int ptr_read = _ptr_read.load(std::memory_order_acquire);
+    unsigned int ptr_write = _ptr_write.load(std::memory_order_relaxed);
     
     // no loop around the end
-    if (_ptr_write >= _ptr_read) {
-        return _buffer_size - (1 + _ptr_write - _ptr_read);
+    if (ptr_write >= ptr_read) {
+        return _buffer_size - (1 + ptr_write - ptr_read);
     }
     
-    return _buffer_size - (1 + _buffer_size + _ptr_write - _ptr_read);
+    return _buffer_size - (1 + _buffer_size + ptr_write - ptr_read);
 #else
     uint32_t available_bytes = 0;
     TPCircularBufferHead(&_buffer, &available_bytes);
-    return available_bytes / sizeof(fft_value_t);
+    return available_bytes / sizeof(stft_sample_t);
 #endif
 }
 
@@ -147,12 +323,15 @@ unsigned int CircularShortTermFourierTransform::GetLengthPower() {
 }
 
 void CircularShortTermFourierTransform::Clear() {
-#if defined(BELA_MAJOR_VERSION)
-    _ptr_read = 0;
-    _ptr_write = 0;
+#if !defined(STFT_TPCIRCULARBUFFER)
+    _ptr_read.store(0, std::memory_order_release);
+    _ptr_write.store(0, std::memory_order_release);
 #else
     TPCircularBufferClear(&_buffer);
 #endif
+    
+    // sliding state no longer describes the buffer
+    _sliding_valid = false;
 }
 
 unsigned int CircularShortTermFourierTransform::ConvertSamplesToColumns(unsigned int samples) {
@@ -196,115 +375,368 @@ void CircularShortTermFourierTransform::ZeroPadToEdge() {
 
 // write to the circular buffer
 bool CircularShortTermFourierTransform::WriteValues(const std::vector<fft_value_t>& values) {
-#if defined(BELA_MAJOR_VERSION)
+    return WriteValues(values.empty() ? NULL : &values[0], static_cast<unsigned int>(values.size()));
+}
+
+// producer side (wait-free): copy values, then publish them with a release store of the write pointer
+bool CircularShortTermFourierTransform::WriteValues(const fft_value_t *values, const unsigned int len, const unsigned int stride) {
+    return _WriteValues(values, len, stride);
+}
+
+bool CircularShortTermFourierTransform::WriteValues(const int16_t *values, const unsigned int len, const unsigned int stride) {
+    return _WriteValues(values, len, stride);
+}
+
+template <typename T>
+bool CircularShortTermFourierTransform::_WriteValues(const T *values, const unsigned int len, const unsigned int stride) {
+#if !defined(STFT_TPCIRCULARBUFFER)
     // check for sufficient space
-    if (values.size() > GetLengthCapacity()) {
+    if (len > GetLengthCapacity()) {
+        _count_overruns.fetch_add(1, std::memory_order_relaxed);
         return false;
     }
     
-    // TODO: rewrite to use copy
-    for (std::vector<fft_value_t>::const_iterator it = values.begin(); it != values.end(); ++it) {
-        _buffer[_ptr_write] = *it;
-        _ptr_write = (_ptr_write + 1) % _buffer_size;
+    unsigned int ptr_write = _ptr_write.load(std::memory_order_relaxed);
+    
+#if defined(STFT_MIRRORED_BUFFER)
+    // single strided copy (mirror handles wrapping)
+    copy_samples(_buffer.ptr() + ptr_write, values, len, stride);
+#else
+    // copy up to the end of the buffer, then wrap around
+    unsigned int first = std::min(len, _buffer_size - ptr_write);
+    copy_samples(_buffer.ptr() + ptr_write, values, first, stride);
+    if (first < len) {
+        copy_samples(_buffer.ptr(), values + first * stride, len - first, stride);
     }
+#endif
+    ptr_write = (ptr_write + len) % _buffer_size;
+    
+    // publish
+    _ptr_write.store(ptr_write, std::memory_order_release);
     
     return true;
 #else
-    unsigned int bytes = static_cast<unsigned int>(values.size()) * sizeof(fft_value_t);
-    return TPCircularBufferProduceBytes(&_buffer, &values[0], bytes);
-#endif
-}
-
-bool CircularShortTermFourierTransform::WriteValues(const fft_value_t *values, const unsigned int len, const unsigned int stride) {
-#if defined(BELA_MAJOR_VERSION)
-    // check for sufficient space
-    if (len > GetLengthCapacity()) {
-        return false;
+    if (len == 0) {
+        return true;
     }
     
-    // TODO: rewrite to use copy
-    for (unsigned int i = 0, maxi = len * stride; i < maxi; i += stride) {
-        _buffer[_ptr_write] = values[i];
-        _ptr_write = (_ptr_write + 1) % _buffer_size;
+    // copy into the head (contiguous, since memory is mirrored), then publish
+    uint32_t available_bytes = 0;
+    stft_sample_t *head = static_cast<stft_sample_t *>(TPCircularBufferHead(&_buffer, &available_bytes));
+    if (!head || available_bytes < len * sizeof(stft_sample_t)) {
+        _count_overruns.fetch_add(1, std::memory_order_relaxed);
+        return false;
     }
+    copy_samples(head, values, len, stride);
+    TPCircularBufferProduce(&_buffer, static_cast<uint32_t>(len * sizeof(stft_sample_t)));
     
     return true;
-#else
-    return TPCircularBufferProduceBytes(&_buffer, values, len * sizeof(fft_value_t));
 #endif
 }
 
-// read power
-bool CircularShortTermFourierTransform::ReadPower(fft_value_t *power) {
-#if defined(BELA_MAJOR_VERSION)
-    // check for sufficient values
-    if (GetLengthValues() < _window_length) {
-        return false;
-    }
-    
-    // window samples
+// window the column that starts `offset` samples after the read pointer (caller must ensure that
+// sufficient values are available)
+void CircularShortTermFourierTransform::_WindowSamples(fft_value_t *dest, unsigned int offset) {
+#if defined(STFT_Q15_BUFFER)
+    const fft_value_t *window = _window_scaled.ptr(); // also converts from Q15
+#else
+    const fft_value_t *window = _window.ptr();
+#endif
+#if !defined(STFT_TPCIRCULARBUFFER) && !defined(STFT_MIRRORED_BUFFER)
+    const stft_sample_t *buffer = _buffer.ptr();
+    unsigned int start = (_ptr_read.load(std::memory_order_relaxed) + offset) % _buffer_size;
     for (unsigned int i = 0; i < _window_length; ++i) {
-        _samples_windowed[i] = _buffer[(_ptr_read + i) % _buffer_size] * _window[i];
+        dest[i] = buffer[(start + i) % _buffer_size] * window[i];
     }
-    
-    // advance read pointer
-    _ptr_read = (_ptr_read + _window_stride) % _buffer_size;
 #else
-    // get tail of circular buffer and available bytes
+    // get tail of circular buffer (contiguous, since memory is mirrored)
+#if defined(STFT_TPCIRCULARBUFFER)
     unsigned int available_bytes = 0;
-    fft_value_t *src = static_cast<fft_value_t *>(TPCircularBufferTail(&_buffer, &available_bytes));
-    
-    // convert to samples
-    unsigned int available_samples = available_bytes / sizeof(fft_value_t);
+    const stft_sample_t *src = static_cast<stft_sample_t *>(TPCircularBufferTail(&_buffer, &available_bytes)) + offset;
+#else
+    const stft_sample_t *src = _buffer.ptr() + (_ptr_read.load(std::memory_order_relaxed) + offset) % _buffer_size;
+#endif
     
-    // check for sufficient values
-    if (available_samples < _window_length) {
-        return false;
+#if defined(FFT_BACKEND_ACCELERATE)
+#if defined(STFT_Q15_BUFFER)
+    vDSP_vflt16(src, 1, dest, 1, _window_length);
+    vDSP_vmul(dest, 1, window, 1, dest, 1, _window_length);
+#else
+    vDSP_vmul(src, 1, window, 1, dest, 1, _window_length);
+#endif
+#else
+    unsigned int i = 0;
+    for (; i + SIMD_WIDTH <= _window_length; i += SIMD_WIDTH) {
+        simd_store(dest + i, simd_mul(simd_load_sample(src + i), simd_load(window + i)));
     }
-    
-    // window the samples
-#if defined(__APPLE__)
-    vDSP_vmul(src, 1, _window.ptr(), 1, _samples_windowed.ptr(), 1, _window_length);
+    for (; i < _window_length; ++i) {
+        dest[i] = src[i] * window[i];
+    }
+#endif
+#endif
+}
+
+#if defined(STFT_Q15_FFT)
+// same as above, but windowed values stay in Q15 (rounded product)
+void CircularShortTermFourierTransform::_WindowSamplesFixed(int16_t *dest, unsigned int offset) {
+    const int16_t *window = _window_fixed.ptr();
+#if !defined(STFT_TPCIRCULARBUFFER) && !defined(STFT_MIRRORED_BUFFER)
+    const int16_t *buffer = _buffer.ptr();
+    unsigned int start = (_ptr_read.load(std::memory_order_relaxed) + offset) % _buffer_size;
+    for (unsigned int i = 0; i < _window_length; ++i) {
+        dest[i] = static_cast<int16_t>((static_cast<int32_t>(buffer[(start + i) % _buffer_size]) * window[i] + (1 << 14)) >> 15);
+    }
+#else
+#if defined(STFT_TPCIRCULARBUFFER)
+    unsigned int available_bytes = 0;
+    const int16_t *src = static_cast<int16_t *>(TPCircularBufferTail(&_buffer, &available_bytes)) + offset;
 #else
+    const int16_t *src = _buffer.ptr() + (_ptr_read.load(std::memory_order_relaxed) + offset) % _buffer_size;
+#endif
     for (unsigned int i = 0; i < _window_length; ++i) {
-        _samples_windowed[i] = src[i] * _window[i];
+        dest[i] = static_cast<int16_t>((static_cast<int32_t>(src[i]) * window[i] + (1 << 14)) >> 15);
     }
 #endif
-    
-    // free bytes
-    TPCircularBufferConsume(&_buffer, static_cast<uint32_t>(_window_stride) * sizeof(fft_value_t));
+}
+#endif
+
+// keep derived copies of the window up to date
+void CircularShortTermFourierTransform::_UpdateWindow() {
+#if defined(STFT_Q15_BUFFER)
+    for (unsigned int i = 0; i < _window_length; ++i) {
+        _window_scaled[i] = _window[i] * (1.f / 32768.f);
+    }
+#endif
+#if defined(STFT_Q15_FFT)
+    for (unsigned int i = 0; i < _window_length; ++i) {
+        _window_fixed[i] = float_to_q15(_window[i]);
+    }
 #endif
     
-#if defined(__APPLE__)
+    _UpdateSlidingKernel();
+}
+
+// power of the column that starts `offset` samples after the read pointer
+void CircularShortTermFourierTransform::_PowerForColumn(fft_value_t *power, unsigned int offset, unsigned int idx_lo, unsigned int idx_hi) {
+#if defined(STFT_Q15_FFT)
+    // integer window and FFT, then back to float for the magnitude
+    _WindowSamplesFixed(_samples_fixed.ptr(), offset);
+    _fft_fixed.Forward(_samples_fixed.ptr(), _fixed_output_real.ptr(), _fixed_output_imag.ptr(), idx_lo, idx_hi);
+    for (unsigned int i = 0, n = idx_hi - idx_lo; i < n; ++i) {
+        _fft_output_real[i] = static_cast<fft_value_t>(_fixed_output_real[i]) * (1.f / 32768.f);
+        _fft_output_imag[i] = static_cast<fft_value_t>(_fixed_output_imag[i]) * (1.f / 32768.f);
+    }
+    _CalculateMagnitude(_fft_output_real, _fft_output_imag, power, idx_hi - idx_lo);
+#else
+    _WindowSamples(_samples_windowed.ptr(), offset);
+    _CalculatePower(_samples_windowed.ptr(), power, idx_lo, idx_hi);
+#endif
+}
+
+// advance the read pointer
+void CircularShortTermFourierTransform::_ConsumeSamples(unsigned int samples) {
+#if !defined(STFT_TPCIRCULARBUFFER)
+    // release, so the producer only reuses the space once the values have been read
+    _ptr_read.store((_ptr_read.load(std::memory_order_relaxed) + samples) % _buffer_size, std::memory_order_release);
+#else
+    TPCircularBufferConsume(&_buffer, static_cast<uint32_t>(samples) * sizeof(stft_sample_t));
+#endif
+}
+
+// calculate power from windowed samples
+void CircularShortTermFourierTransform::_CalculatePower(fft_value_t *windowed, fft_value_t *power, unsigned int idx_lo, unsigned int idx_hi) {
+#if defined(FFT_BACKEND_ACCELERATE)
     // pack samples
-    vDSP_ctoz(reinterpret_cast<DSPComplex *>(_samples_windowed.ptr()), 2, &_fft_input, 1, _fft_length_half);
+    vDSP_ctoz(reinterpret_cast<DSPComplex *>(windowed), 2, &_fft_input, 1, _fft_length_half);
     
     // calculate fft
     vDSP_DFT_Execute(_fft_config, _fft_input.realp, _fft_input.imagp, _fft_output.realp, _fft_output.imagp);
     
     // zero imaginary first term (term 0 and term _fft_length_half are both real, and so get
     // packed into the same term)
-    power[_fft_length_half] = abs(_fft_output.imagp[0]);
+    if (idx_hi > _fft_length_half) {
+        power[_fft_length_half - idx_lo] = abs(_fft_output.imagp[0]);
+    }
     _fft_output.imagp[0] = 0.;
     
-    // power
-    vDSP_zvabs(&_fft_output, 1, power, 1, _fft_length_half);
+    // power (only within band)
+    if (idx_lo < _fft_length_half) {
+        DSPSplitComplex band = {_fft_output.realp + idx_lo, _fft_output.imagp + idx_lo};
+        vDSP_zvabs(&band, 1, power, 1, (idx_hi > _fft_length_half ? _fft_length_half : idx_hi) - idx_lo);
+    }
     
     // normalize
     float c_two = 0.5;
-    vDSP_vsmul(power, 1, &c_two, power, 1, _fft_length_half + 1);
-#else
+    vDSP_vsmul(power, 1, &c_two, power, 1, idx_hi - idx_lo);
+    
+    // log compression
+    if (_log_power) {
+        int count = static_cast<int>(idx_hi - idx_lo);
+        vvlog1pf(power, power, &count);
+    }
+#elif defined(FFT_BACKEND_NE10)
     // claculate FFT
-    ne10_fft_r2c_1d_float32_neon(_fft_output, _samples_windowed.ptr(), _fft_config);
+    ne10_fft_r2c_1d_float32_neon(_fft_output, windowed, _fft_config);
     
-    for (unsigned int i = 0; i < _fft_length_half + 1; ++i) {
-        power[i] = sqrt(pow(_fft_output[i].r, 2.) + pow(_fft_output[i].i, 2.));
+    // power (single precision, vectorized)
+    _CalculateMagnitudeInterleaved(reinterpret_cast<const fft_value_t *>(_fft_output + idx_lo), power, idx_hi - idx_lo);
+#else
+    // calculate FFT (pruned to the band)
+    _fft_config->Forward(windowed, _fft_output_real, _fft_output_imag, idx_lo, idx_hi);
+    
+    // power
+    _CalculateMagnitude(_fft_output_real, _fft_output_imag, power, idx_hi - idx_lo);
+#endif
+}
+
+// magnitude of split complex values, optionally log compressed (fused, so each bin is only loaded
+// and stored once)
+static inline simd_float magnitude(simd_float r, simd_float m, bool log_power) {
+    simd_float v = simd_sqrt(simd_madd(r, r, simd_mul(m, m)));
+    return log_power ? simd_log1p(v) : v;
+}
+
+void CircularShortTermFourierTransform::_CalculateMagnitude(const fft_value_t *real, const fft_value_t *imag, fft_value_t *power, unsigned int n) {
+    unsigned int i = 0;
+    for (; i + SIMD_WIDTH <= n; i += SIMD_WIDTH) {
+        simd_store(power + i, magnitude(simd_load(real + i), simd_load(imag + i), _log_power));
     }
+    
+    // remaining bins (zero padded, so results do not depend on the position in the band)
+    if (i < n) {
+        fft_value_t r[SIMD_WIDTH] = {0}, m[SIMD_WIDTH] = {0}, out[SIMD_WIDTH];
+        memcpy(r, real + i, sizeof(fft_value_t) * (n - i));
+        memcpy(m, imag + i, sizeof(fft_value_t) * (n - i));
+        simd_store(out, magnitude(simd_load(r), simd_load(m), _log_power));
+        memcpy(power + i, out, sizeof(fft_value_t) * (n - i));
+    }
+}
+
+// same as above, for interleaved complex values (as produced by NE10)
+void CircularShortTermFourierTransform::_CalculateMagnitudeInterleaved(const fft_value_t *complex, fft_value_t *power, unsigned int n) {
+    unsigned int i = 0;
+    simd_float r, m;
+    for (; i + SIMD_WIDTH <= n; i += SIMD_WIDTH) {
+        simd_load_deinterleaved(complex + 2 * i, &r, &m);
+        simd_store(power + i, magnitude(r, m, _log_power));
+    }
+    
+    // remaining bins
+    if (i < n) {
+        fft_value_t c[2 * SIMD_WIDTH] = {0}, out[SIMD_WIDTH];
+        memcpy(c, complex + 2 * i, sizeof(fft_value_t) * 2 * (n - i));
+        simd_load_deinterleaved(c, &r, &m);
+        simd_store(out, magnitude(r, m, _log_power));
+        memcpy(power + i, out, sizeof(fft_value_t) * (n - i));
+    }
+}
+
+// copy raw samples starting `offset` samples after the read pointer
+void CircularShortTermFourierTransform::_CopySamples(fft_value_t *dest, unsigned int offset, unsigned int count) {
+#if defined(STFT_TPCIRCULARBUFFER)
+    unsigned int available_bytes = 0;
+    stft_sample_t *src = static_cast<stft_sample_t *>(TPCircularBufferTail(&_buffer, &available_bytes)) + offset;
+    copy_samples(dest, src, count, 1);
+#elif defined(STFT_MIRRORED_BUFFER)
+    copy_samples(dest, _buffer.ptr() + (_ptr_read.load(std::memory_order_relaxed) + offset) % _buffer_size, count, 1);
+#else
+    const stft_sample_t *buffer = _buffer.ptr();
+    unsigned int start = (_ptr_read.load(std::memory_order_relaxed) + offset) % _buffer_size;
+    unsigned int first = std::min(count, _buffer_size - start);
+    copy_samples(dest, buffer + start, first, 1);
+    copy_samples(dest + first, buffer, count - first, 1);
 #endif
+}
+
+// read power
+bool CircularShortTermFourierTransform::ReadPower(fft_value_t *power) {
+    return ReadPower(power, 0, _fft_length_half + 1);
+}
+
+// read power for frequency bins idx_lo through idx_hi - 1 only (written to power[0] onward)
+bool CircularShortTermFourierTransform::ReadPower(fft_value_t *power, unsigned int idx_lo, unsigned int idx_hi) {
+    // check band
+    if (idx_lo >= idx_hi || idx_hi > _fft_length_half + 1) {
+        return false;
+    }
+    
+    // check for sufficient values
+    if (GetLengthValues() < _window_length) {
+        return false;
+    }
+    
+    // sliding DFT
+    if (_sliding) {
+        _ReadPowerSliding(power, idx_lo, idx_hi);
+        return true;
+    }
+    
+    // calculate power
+    _PowerForColumn(power, 0, idx_lo, idx_hi);
+    
+    // advance read pointer
+    _ConsumeSamples(_window_stride);
     
     return true;
 }
 
+// read up to `columns` columns of power for frequency bins [idx_lo, idx_hi), stored column after
+// column (column-major, idx_hi - idx_lo values each); returns number of columns read
+unsigned int CircularShortTermFourierTransform::ReadPowerBatch(fft_value_t *power, unsigned int columns, unsigned int idx_lo, unsigned int idx_hi) {
+    // check band
+    if (idx_lo >= idx_hi || idx_hi > _fft_length_half + 1) {
+        return 0;
+    }
+    
+    // available columns
+    unsigned int available = GetLengthColumns();
+    if (available == 0) {
+        return 0;
+    }
+    if (columns > available) {
+        columns = available;
+    }
+    
+    unsigned int band = idx_hi - idx_lo;
+    
+    // sliding DFT (columns depend on each other)
+    if (_sliding) {
+        for (unsigned int c = 0; c < columns; ++c) {
+            _ReadPowerSliding(power + c * band, idx_lo, idx_hi);
+        }
+        return columns;
+    }
+    
+#if defined(FFT_BACKEND_BUILTIN) && !defined(STFT_Q15_FFT)
+    // several transforms at once (one per vector lane)
+    const fft_value_t *inputs[SIMD_WIDTH];
+    for (unsigned int c = 0; c < columns; c += SIMD_WIDTH) {
+        unsigned int count = (columns - c < SIMD_WIDTH ? columns - c : SIMD_WIDTH);
+        
+        // window samples
+        for (unsigned int j = 0; j < count; ++j) {
+            _WindowSamples(_samples_batch.ptr() + j * _fft_length, (c + j) * _window_stride);
+            inputs[j] = _samples_batch.ptr() + j * _fft_length;
+        }
+        
+        // calculate FFTs
+        _fft_config->ForwardBatch(inputs, count, _batch_output_real.ptr(), _batch_output_imag.ptr(), idx_lo, idx_hi);
+        
+        // power
+        _CalculateMagnitude(_batch_output_real.ptr(), _batch_output_imag.ptr(), power + c * band, count * band);
+    }
+#else
+    for (unsigned int c = 0; c < columns; ++c) {
+        _PowerForColumn(power + c * band, c * _window_stride, idx_lo, idx_hi);
+    }
+#endif
+    
+    // advance read pointer
+    _ConsumeSamples(columns * _window_stride);
+    
+    return columns;
+}
+
 bool CircularShortTermFourierTransform::ReadPower(std::vector<fft_value_t>& power) {
     // ensure sufficient space
     if (power.size() != GetLengthPower()) {
@@ -313,3 +745,241 @@ bool CircularShortTermFourierTransform::ReadPower(std::vector<fft_value_t>& powe
     
     return ReadPower(&power[0]);
 }
+
+bool CircularShortTermFourierTransform::ReadPower(std::vector<fft_value_t>& power, unsigned int idx_lo, unsigned int idx_hi) {
+    // check band (before sizing the vector)
+    if (idx_lo >= idx_hi || idx_hi > _fft_length_half + 1) {
+        return false;
+    }
+    
+    // ensure sufficient space
+    if (power.size() != idx_hi - idx_lo) {
+        power.resize(idx_hi - idx_lo);
+    }
+    
+    return ReadPower(power.data(), idx_lo, idx_hi);
+}
+
+// enable or disable sliding DFT mode
+bool CircularShortTermFourierTransform::SetSlidingDFT(bool enable, unsigned int anchor_interval) {
+    if (!enable) {
+        _sliding = false;
+        return true;
+    }
+    
+    // window must span the whole transform and columns must overlap
+    if (_window_length != _fft_length || _window_stride >= _window_length || anchor_interval == 0) {
+        return false;
+    }
+    
+    // allocate state (largest possible band)
+    unsigned int tracked = _fft_length_half + 1 + 2 * _sliding_max_taps;
+    _sliding_kernel_real.resize(2 * _sliding_max_taps + 1);
+    _sliding_kernel_imag.resize(2 * _sliding_max_taps + 1);
+    _sliding_real.resize(tracked);
+    _sliding_imag.resize(tracked);
+    _sliding_rot_real.resize(tracked);
+    _sliding_rot_imag.resize(tracked);
+    _sliding_out_real.resize(_fft_length_half + 1);
+    _sliding_out_imag.resize(_fft_length_half + 1);
+    _sliding_old.resize(_window_stride);
+    _sliding_new.resize(_window_stride);
+    
+    _sliding = true;
+    _sliding_anchor_interval = anchor_interval;
+    
+    // the window must fit in the kernel (otherwise stays off)
+    return _UpdateSlidingKernel();
+}
+
+// express the window as a short sum of complex exponentials, w[m] ~ sum_j c_j exp(2 pi i j m / N),
+// so windowed bin k is sum_j c_j X[k - j]; uses the fewest taps that reproduce the window to 0.1%
+// (a periodic hann window needs one, the symmetric windows above two). A window that needs more
+// than _sliding_max_taps turns the sliding DFT off (an FFT per column) and returns false.
+bool CircularShortTermFourierTransform::_UpdateSlidingKernel() {
+    if (!_sliding) {
+        return true;
+    }
+    
+    const int n = static_cast<int>(_fft_length);
+    std::vector<double> c_real(2 * _sliding_max_taps + 1), c_imag(2 * _sliding_max_taps + 1);
+    double peak = 0.;
+    for (int m = 0; m < n; ++m) {
+        peak = std::max(peak, fabs(static_cast<double>(_window[m])));
+    }
+    for (int j = -_sliding_max_taps; j <= _sliding_max_taps; ++j) {
+        double re = 0., im = 0.;
+        for (int m = 0; m < n; ++m) {
+            double theta = 2.0 * M_PI * static_cast<double>(j * m) / static_cast<double>(n);
+            re += _window[m] * cos(theta);
+            im -= _window[m] * sin(theta);
+        }
+        c_real[j + _sliding_max_taps] = re / n;
+        c_imag[j + _sliding_max_taps] = im / n;
+    }
+    
+    // find number of taps
+    int taps;
+    for (taps = 0; taps <= _sliding_max_taps; ++taps) {
+        double err = 0.;
+        for (int m = 0; m < n; ++m) {
+            double v = 0.;
+            for (int j = -taps; j <= taps; ++j) {
+                double theta = 2.0 * M_PI * static_cast<double>(j * m) / static_cast<double>(n);
+                v += c_real[j + _sliding_max_taps] * cos(theta) - c_imag[j + _sliding_max_taps] * sin(theta);
+            }
+            err = std::max(err, fabs(v - _window[m]));
+        }
+        if (err <= 1e-3 * peak) {
+            break;
+        }
+    }
+    if (taps > _sliding_max_taps) {
+        _sliding = false;
+        return false;
+    }
+    _sliding_taps = taps;
+    
+    // store taps -taps..taps
+    for (int j = -_sliding_taps; j <= _sliding_taps; ++j) {
+        _sliding_kernel_real[j + _sliding_taps] = static_cast<fft_value_t>(c_real[j + _sliding_max_taps]);
+        _sliding_kernel_imag[j + _sliding_taps] = static_cast<fft_value_t>(c_imag[j + _sliding_max_taps]);
+    }
+    
+    // re-anchor on next read
+    _sliding_valid = false;
+    
+    return true;
+}
+
+// recalculate the tracked (unwindowed) bins for the column at the read pointer with an FFT
+void CircularShortTermFourierTransform::_AnchorSliding(unsigned int idx_lo, unsigned int idx_hi) {
+    const int n = static_cast<int>(_fft_length), lo = static_cast<int>(idx_lo) - _sliding_taps;
+    const unsigned int tracked = idx_hi - idx_lo + 2 * _sliding_taps;
+    
+    // rotation per sample, exp(2 pi i k / N)
+    if (!_sliding_valid || idx_lo != _sliding_lo || idx_hi != _sliding_hi) {
+        for (unsigned int t = 0; t < tracked; ++t) {
+            double theta = 2.0 * M_PI * static_cast<double>(lo + static_cast<int>(t)) / static_cast<double>(n);
+            _sliding_rot_real[t] = static_cast<fft_value_t>(cos(theta));
+            _sliding_rot_imag[t] = static_cast<fft_value_t>(sin(theta));
+        }
+    }
+    
+    // transform unwindowed samples, spectrum (bins 0 through N / 2) goes to the output buffers
+    fft_value_t *spec_real = &_sliding_out_real[0], *spec_imag = &_sliding_out_imag[0];
+    _CopySamples(_samples_windowed.ptr(), 0, _fft_length);
+#if defined(FFT_BACKEND_ACCELERATE)
+    vDSP_ctoz(reinterpret_cast<DSPComplex *>(_samples_windowed.ptr()), 2, &_fft_input, 1, _fft_length_half);
+    vDSP_DFT_Execute(_fft_config, _fft_input.realp, _fft_input.imagp, _fft_output.realp, _fft_output.imagp);
+    
+    // packed output is scaled by two, nyquist term is stored in the first imaginary value
+    spec_real[0] = 0.5 * _fft_output.realp[0];
+    spec_imag[0] = 0.;
+    spec_real[_fft_length_half] = 0.5 * _fft_output.imagp[0];
+    spec_imag[_fft_length_half] = 0.;
+    for (unsigned int k = 1; k < _fft_length_half; ++k) {
+        spec_real[k] = 0.5 * _fft_output.realp[k];
+        spec_imag[k] = 0.5 * _fft_output.imagp[k];
+    }
+#elif defined(FFT_BACKEND_NE10)
+    ne10_fft_r2c_1d_float32_neon(_fft_output, _samples_windowed.ptr(), _fft_config);
+    for (unsigned int k = 0; k <= _fft_length_half; ++k) {
+        spec_real[k] = _fft_output[k].r;
+        spec_imag[k] = _fft_output[k].i;
+    }
+#else
+    _fft_config->Forward(_samples_windowed.ptr(), spec_real, spec_imag);
+#endif
+    
+    // tracked bins can fall outside 0 through N / 2, use conjugate symmetry
+    for (unsigned int t = 0; t < tracked; ++t) {
+        int k = ((lo + static_cast<int>(t)) % n + n) % n;
+        if (k <= static_cast<int>(_fft_length_half)) {
+            _sliding_real[t] = spec_real[k];
+            _sliding_imag[t] = spec_imag[k];
+        }
+        else {
+            _sliding_real[t] = spec_real[n - k];
+            _sliding_imag[t] = -spec_imag[n - k];
+        }
+    }
+    
+    _sliding_lo = idx_lo;
+    _sliding_hi = idx_hi;
+    _sliding_columns = 0;
+    _sliding_valid = true;
+}
+
+// move the tracked bins forward by one stride: X[k] <- (X[k] - x_old + x_new) exp(2 pi i k / N)
+void CircularShortTermFourierTransform::_AdvanceSliding() {
+    const unsigned int tracked = _sliding_hi - _sliding_lo + 2 * _sliding_taps;
+    fft_value_t *s_r = &_sliding_real[0], *s_i = &_sliding_imag[0];
+    const fft_value_t *w_r = &_sliding_rot_real[0], *w_i = &_sliding_rot_imag[0];
+    
+    // samples entering the frame are the last stride samples of the current column
+    _CopySamples(&_sliding_new[0], _window_length - _window_stride, _window_stride);
+    
+    for (unsigned int h = 0; h < _window_stride; ++h) {
+        const fft_value_t d = _sliding_new[h] - _sliding_old[h];
+        const simd_float dv = simd_set1(d);
+        
+        unsigned int t = 0;
+        for (; t + SIMD_WIDTH <= tracked; t += SIMD_WIDTH) {
+            simd_float a_r = simd_add(simd_load(s_r + t), dv), a_i = simd_load(s_i + t);
+            simd_float c = simd_load(w_r + t), s = simd_load(w_i + t);
+            simd_store(s_r + t, simd_sub(simd_mul(a_r, c), simd_mul(a_i, s)));
+            simd_store(s_i + t, simd_add(simd_mul(a_r, s), simd_mul(a_i, c)));
+        }
+        for (; t < tracked; ++t) {
+            fft_value_t a_r = s_r[t] + d, a_i = s_i[t];
+            s_r[t] = a_r * w_r[t] - a_i * w_i[t];
+            s_i[t] = a_r * w_i[t] + a_i * w_r[t];
+        }
+    }
+    
+    ++_sliding_columns;
+}
+
+// read power for the column at the read pointer using the sliding DFT (caller checks band and
+// available values)
+void CircularShortTermFourierTransform::_ReadPowerSliding(fft_value_t *power, unsigned int idx_lo, unsigned int idx_hi) {
+    // bring tracked bins to the current column
+    if (_sliding_valid && idx_lo == _sliding_lo && idx_hi == _sliding_hi && _sliding_columns + 1 < _sliding_anchor_interval) {
+        _AdvanceSliding();
+    }
+    else {
+        _AnchorSliding(idx_lo, idx_hi);
+    }
+    
+    // apply window: Y[k] = sum_j c_j X[k - j]
+    const unsigned int band = idx_hi - idx_lo;
+    fft_value_t *y_r = &_sliding_out_real[0], *y_i = &_sliding_out_imag[0];
+    for (unsigned int k = 0; k < band; ++k) {
+        y_r[k] = 0.;
+        y_i[k] = 0.;
+    }
+    for (int j = -_sliding_taps; j <= _sliding_taps; ++j) {
+        const fft_value_t c_r = _sliding_kernel_real[j + _sliding_taps], c_i = _sliding_kernel_imag[j + _sliding_taps];
+        const simd_float cv_r = simd_set1(c_r), cv_i = simd_set1(c_i);
+        const fft_value_t *x_r = &_sliding_real[_sliding_taps - j], *x_i = &_sliding_imag[_sliding_taps - j];
+        
+        unsigned int k = 0;
+        for (; k + SIMD_WIDTH <= band; k += SIMD_WIDTH) {
+            simd_float a_r = simd_load(x_r + k), a_i = simd_load(x_i + k);
+            simd_store(y_r + k, simd_add(simd_load(y_r + k), simd_sub(simd_mul(a_r, cv_r), simd_mul(a_i, cv_i))));
+            simd_store(y_i + k, simd_add(simd_load(y_i + k), simd_add(simd_mul(a_r, cv_i), simd_mul(a_i, cv_r))));
+        }
+        for (; k < band; ++k) {
+            y_r[k] += x_r[k] * c_r - x_i[k] * c_i;
+            y_i[k] += x_r[k] * c_i + x_i[k] * c_r;
+        }
+    }
+    
+    // power
+    _CalculateMagnitude(y_r, y_i, power, band);
+    
+    // remember samples that leave the frame, then advance read pointer
+    _CopySamples(&_sliding_old[0], 0, _window_stride);
+    _ConsumeSamples(_window_stride);
+}
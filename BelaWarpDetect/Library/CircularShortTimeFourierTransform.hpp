@@ -10,26 +10,73 @@
 #define CircularShortTimeFourierTransform_hpp
 
 #include <stdio.h>
+#include <stdint.h>
 #include <vector>
+#include <atomic>
 
 #include "ManagedMemory.hpp"
 
-#if !defined(BELA_MAJOR_VERSION)
+// TPCircularBuffer relies on mach virtual memory, Linux (including Bela) mirrors the ring buffer
+// pages with MirroredMemory and other platforms use a simple ring buffer
+#if defined(__APPLE__)
+#define STFT_TPCIRCULARBUFFER
 #include "TPCircularBuffer.h"
+#elif defined(__linux__)
+#define STFT_MIRRORED_BUFFER
+#include "MirroredMemory.hpp"
 #endif
 
+// FFT backend: Accelerate on macOS, NE10 on Bela and the built-in FFT everywhere else (define
+// FFT_BACKEND_ACCELERATE, FFT_BACKEND_NE10 or FFT_BACKEND_BUILTIN to override)
+#if !defined(FFT_BACKEND_ACCELERATE) && !defined(FFT_BACKEND_NE10) && !defined(FFT_BACKEND_BUILTIN)
 #if defined(__APPLE__)
+#define FFT_BACKEND_ACCELERATE
+#elif defined(BELA_MAJOR_VERSION)
+#define FFT_BACKEND_NE10
+#else
+#define FFT_BACKEND_BUILTIN
+#endif
+#endif
+
+#if defined(FFT_BACKEND_ACCELERATE)
 #include <Accelerate/Accelerate.h>
 
 typedef vDSP_Length fft_length_t;
 typedef vDSP_Stride fft_stride_t;
 typedef float fft_value_t;
-#else
+typedef vDSP_DFT_Setup fft_config_t;
+#elif defined(FFT_BACKEND_NE10)
 #include <ne10/NE10.h> // NEON FFT library
 
 typedef unsigned int fft_length_t;
 typedef int fft_stride_t;
 typedef ne10_float32_t fft_value_t;
+typedef ne10_fft_r2c_cfg_float32_t fft_config_t;
+#else
+#include "FastFourierTransform.hpp"
+
+typedef unsigned int fft_length_t;
+typedef int fft_stride_t;
+typedef float fft_value_t;
+typedef FastFourierTransform *fft_config_t;
+#endif
+
+// sample storage: STFT_Q15_BUFFER stores the circular buffer as Q15 values (int16, 1.0 = 32768),
+// halving its size and memory traffic (samples become floats in the window multiply); STFT_Q15_FFT
+// also keeps the window and FFT in integers, for cores without a fast floating point unit (built-in
+// backend only, the magnitude is still computed in float)
+#if defined(STFT_Q15_FFT)
+#if !defined(FFT_BACKEND_BUILTIN)
+#error "STFT_Q15_FFT requires the built-in FFT backend"
+#endif
+#define STFT_Q15_BUFFER
+#include "FixedPointFourierTransform.hpp"
+#endif
+
+#if defined(STFT_Q15_BUFFER)
+typedef int16_t stft_sample_t;
+#else
+typedef fft_value_t stft_sample_t;
 #endif
 
 /// A circular buffer that produces a spectrogram (calculating a short term fourier transform).
@@ -39,7 +86,7 @@ public:
     CircularShortTermFourierTransform(unsigned int window_length, unsigned int window_stride, unsigned int buffer_length = 4096);
     ~CircularShortTermFourierTransform();
     
-    // window
+    // window (hanning and hamming windows are computed once per length and shared by all instances)
     std::vector<fft_value_t> GetWindow();
     bool SetWindow(const std::vector<fft_value_t>& window);
     void SetWindowHanning();
@@ -51,9 +98,16 @@ public:
     unsigned int GetLengthCapacity();
     unsigned int GetLengthPower();
     
-    // clear all data in the circular buffer
+    // clear all data in the circular buffer (not safe while the producer or consumer is running)
     void Clear();
     
+    // single producer / single consumer: one thread may write values while another reads power,
+    // both sides are wait-free; overruns count rejected writes (buffer full, so audio was lost).
+    // A read that finds less than a full column just returns false (nothing is lost, it is how a
+    // consumer knows it has caught up).
+    unsigned int GetOverruns() { return _count_overruns.load(std::memory_order_relaxed); }
+    void ResetCounters() { _count_overruns.store(0, std::memory_order_relaxed); }
+    
     // conversion helper functions
     unsigned int ConvertSamplesToColumns(unsigned int samples);
     unsigned int ConvertColumnsToSamples(unsigned int columns);
@@ -66,26 +120,75 @@ public:
     // write to the circular buffer
     bool WriteValues(const std::vector<fft_value_t>& values);
     bool WriteValues(const fft_value_t *values, const unsigned int len, const unsigned int stride = 1);
+    bool WriteValues(const int16_t *values, const unsigned int len, const unsigned int stride = 1); // Q15 samples
     
     // read power
     bool ReadPower(fft_value_t *power);
     bool ReadPower(std::vector<fft_value_t>& power);
     
+    // read power for a band of frequency bins [idx_lo, idx_hi), skipping work outside the band
+    bool ReadPower(fft_value_t *power, unsigned int idx_lo, unsigned int idx_hi);
+    bool ReadPower(std::vector<fft_value_t>& power, unsigned int idx_lo, unsigned int idx_hi);
+
+    // read up to `columns` columns of band power in one call (column-major, contiguous); returns
+    // number of columns read
+    unsigned int ReadPowerBatch(fft_value_t *power, unsigned int columns, unsigned int idx_lo, unsigned int idx_hi);
+
+    // log compression: power values become log(1 + |X|), computed together with the magnitude
+    void SetLogPower(bool log_power) { _log_power = log_power; }
+    bool GetLogPower() { return _log_power; }
+    
+    // sliding DFT mode: rather than an FFT per column, the requested bins are updated sample by
+    // sample (cost scales with stride x bins) and re-anchored with an FFT every `anchor_interval`
+    // columns to limit drift; the window is applied as a short convolution in the frequency
+    // domain, so the window length must equal the FFT length, and the window must be reproduced to
+    // 0.1% of its peak by at most 8 taps on each side (hann and hamming need two). Otherwise it
+    // returns false, and a later SetWindow that does not fit turns it off (back to an FFT per column)
+    bool SetSlidingDFT(bool enable, unsigned int anchor_interval = 32);
+    bool GetSlidingDFT() { return _sliding; }
+
 private:
     // prevent copying
     CircularShortTermFourierTransform(const CircularShortTermFourierTransform &);
     const CircularShortTermFourierTransform &operator=(const CircularShortTermFourierTransform &);
     
+    // reads several channels through the helpers below
+    friend class MultiChannelShortTermFourierTransform;
+    
+    // write helper (converts to the buffer format)
+    template <typename T> bool _WriteValues(const T *values, const unsigned int len, const unsigned int stride);
+    
+    // read helpers
+    void _UpdateWindow();
+    void _PowerForColumn(fft_value_t *power, unsigned int offset, unsigned int idx_lo, unsigned int idx_hi);
+    void _WindowSamples(fft_value_t *dest, unsigned int offset);
+    void _ConsumeSamples(unsigned int samples);
+    void _CalculatePower(fft_value_t *windowed, fft_value_t *power, unsigned int idx_lo, unsigned int idx_hi);
+    void _CalculateMagnitude(const fft_value_t *real, const fft_value_t *imag, fft_value_t *power, unsigned int n);
+    void _CalculateMagnitudeInterleaved(const fft_value_t *complex, fft_value_t *power, unsigned int n);
+    void _CopySamples(fft_value_t *dest, unsigned int offset, unsigned int count);
+#if defined(STFT_Q15_FFT)
+    void _WindowSamplesFixed(int16_t *dest, unsigned int offset);
+#endif
+    
+    // sliding DFT helpers
+    bool _UpdateSlidingKernel();
+    void _AnchorSliding(unsigned int idx_lo, unsigned int idx_hi);
+    void _AdvanceSliding();
+    void _ReadPowerSliding(fft_value_t *power, unsigned int idx_lo, unsigned int idx_hi);
+    
     unsigned int _buffer_size;
     
     // platform specific variables
-#if defined(__APPLE__)
-    vDSP_DFT_Setup _fft_config;
+    fft_config_t _fft_config; // borrowed from the plan cache
+#if defined(FFT_BACKEND_ACCELERATE)
     DSPSplitComplex _fft_input;
     DSPSplitComplex _fft_output;
-#else
-    ne10_fft_r2c_cfg_float32_t _fft_config;
+#elif defined(FFT_BACKEND_NE10)
     ne10_fft_cpx_float32_t *_fft_output;
+#else
+    fft_value_t *_fft_output_real;
+    fft_value_t *_fft_output_imag;
 #endif
     
     fft_length_t _window_length;
@@ -96,15 +199,59 @@ private:
     fft_length_t _fft_length_half;
     
     ManagedMemory<fft_value_t> _window;
-#if defined(BELA_MAJOR_VERSION)
-    ManagedMemory<fft_value_t> _buffer; // circular buffer used to store values
-    unsigned int _ptr_write = 0; // point to write in sample vector
-    unsigned int _ptr_read = 0; // point to read in sample vector
+#if defined(STFT_Q15_BUFFER)
+    ManagedMemory<fft_value_t> _window_scaled; // window / 32768, converts Q15 samples while windowing
+#endif
+#if defined(STFT_Q15_FFT)
+    ManagedMemory<int16_t> _window_fixed; // Q15 window
+#endif
+#if !defined(STFT_TPCIRCULARBUFFER)
+#if defined(STFT_MIRRORED_BUFFER)
+    MirroredMemory<stft_sample_t> _buffer; // circular buffer used to store values (mirrored, so reads and writes are contiguous)
+#else
+    ManagedMemory<stft_sample_t> _buffer; // circular buffer used to store values
+#endif
+    std::atomic<unsigned int> _ptr_write{0}; // point to write in sample vector (only moved by the producer)
+    std::atomic<unsigned int> _ptr_read{0}; // point to read in sample vector (only moved by the consumer)
 #else
     TPCircularBuffer _buffer; // circular buffer
 #endif
+    bool _log_power = false;
     
+    std::atomic<unsigned int> _count_overruns{0};
+    
+#if defined(FFT_BACKEND_BUILTIN)
+    ManagedMemory<fft_value_t> _samples_batch; // windowed values for batched reads (one per lane)
+    ManagedMemory<fft_value_t> _batch_output_real;
+    ManagedMemory<fft_value_t> _batch_output_imag;
+#endif
+#if defined(STFT_Q15_FFT)
+    FixedPointFourierTransform _fft_fixed;
+    ManagedMemory<int16_t> _samples_fixed; // windowed Q15 values
+    ManagedMemory<int32_t> _fixed_output_real;
+    ManagedMemory<int32_t> _fixed_output_imag;
+#endif
     ManagedMemory<fft_value_t> _samples_windowed; // store windowed values
+    
+    // sliding DFT state
+    const int _sliding_max_taps = 8; // maximum window kernel half width
+    bool _sliding = false;
+    bool _sliding_valid = false; // state describes the column at the read pointer
+    unsigned int _sliding_anchor_interval = 32;
+    unsigned int _sliding_columns = 0; // columns since last anchor
+    unsigned int _sliding_lo = 0;
+    unsigned int _sliding_hi = 0;
+    int _sliding_taps = 0; // window kernel half width
+    std::vector<fft_value_t> _sliding_kernel_real; // DFT of the window / fft_length, bins -taps..taps
+    std::vector<fft_value_t> _sliding_kernel_imag;
+    std::vector<fft_value_t> _sliding_real; // unwindowed bins idx_lo - taps through idx_hi + taps - 1
+    std::vector<fft_value_t> _sliding_imag;
+    std::vector<fft_value_t> _sliding_rot_real; // per sample rotation for each tracked bin
+    std::vector<fft_value_t> _sliding_rot_imag;
+    std::vector<fft_value_t> _sliding_out_real; // windowed bins
+    std::vector<fft_value_t> _sliding_out_imag;
+    std::vector<fft_value_t> _sliding_old; // samples that leave the frame on the next advance
+    std::vector<fft_value_t> _sliding_new;
 };
 
 #endif /* CircularShortTimeFourierTransform_hpp */
@@ -8,25 +8,49 @@
 
 #include "DynamicTimeMatcher.hpp"
 
+#include <algorithm>
 #include <limits>
 #include <cmath>
-#include <cstring> // memcpy
 #include <stdexcept>
 #include <math.h> // isnan
 
-DynamicTimeMatcher::DynamicTimeMatcher(const std::vector<std::vector<float>> &templ) :
+// template rows per block when ingesting several columns
+#define DTM_BLOCK_ROWS 256
+
+// longest path length stored (lengths saturate there)
+#define DTM_MAX_LEN 65535
+
+// one column longer, without wrapping around
+static inline unsigned int next_len(unsigned int len) {
+    return len < DTM_MAX_LEN ? len + 1 : len;
+}
+
+DynamicTimeMatcher::DynamicTimeMatcher(const std::vector<std::vector<float>> &templ, TemplateStorage storage) :
 _features(templ[0].size()),
 _length(templ.size()),
-_tmpl(_features * _length),
-_alpha(_length),
+_tmpl(_features, storage),
+_costs(_length),
 _normalize(0),
-_dpp_score(2 * (_length + 1)),
-_dpp_len(2 * (_length + 1)) {
+_prune(false),
+_bound(std::numeric_limits<float>::max()),
+_live(0),
+_band(std::numeric_limits<int>::max()),
+_prefix(0),
+_state(nullptr),
+_state_own(_StateFloats(_length)),
+_count_columns(0),
+_count_pruned(0),
+_count_rows(0) {
     // require non-zero length and feature size
     if (templ.empty() || templ[0].empty()) {
         throw std::invalid_argument("requires non-empty template with non-empty feature vector");
     }
     
+    // path lengths are stored in 16 bits
+    if (_length >= DTM_MAX_LEN) {
+        throw std::invalid_argument("requires template shorter than 65535 feature vectors");
+    }
+    
     // allocate template space
     for (unsigned int i = 0; i < _length; ++i) {
         // confirm matching number of features
@@ -36,7 +60,7 @@ _dpp_len(2 * (_length + 1)) {
         }
         
         // copy template features
-        memcpy(_tmpl.ptr() + (i * _features), &templ[i][0], sizeof(float) * _features);
+        _tmpl.AddTemplate(&templ[i][0], 1);
     }
     
     // calculate normalization
@@ -49,16 +73,29 @@ _dpp_len(2 * (_length + 1)) {
     Reset();
 }
 
-DynamicTimeMatcher::DynamicTimeMatcher(const float *templ, size_t length, size_t features) :
+DynamicTimeMatcher::DynamicTimeMatcher(const float *templ, size_t length, size_t features, TemplateStorage storage) :
 _features(features),
 _length(length),
-_tmpl(_features * _length),
-_alpha(_length),
+_tmpl(_features, storage),
+_costs(_length),
 _normalize(0),
-_dpp_score(2 * (_length + 1)),
-_dpp_len(2 * (_length + 1)) {
+_prune(false),
+_bound(std::numeric_limits<float>::max()),
+_live(0),
+_band(std::numeric_limits<int>::max()),
+_prefix(0),
+_state(nullptr),
+_state_own(_StateFloats(_length)),
+_count_columns(0),
+_count_pruned(0),
+_count_rows(0) {
+    // path lengths are stored in 16 bits
+    if (_length >= DTM_MAX_LEN) {
+        throw std::invalid_argument("requires template shorter than 65535 feature vectors");
+    }
+    
     // copy template features
-    memcpy(_tmpl.ptr(), templ, sizeof(float) * length * features);
+    _tmpl.AddTemplate(templ, length);
     
     // calculate normalization
     _CalculateNormalize();
@@ -70,6 +107,94 @@ _dpp_len(2 * (_length + 1)) {
     Reset();
 }
 
+DynamicTimeMatcher::DynamicTimeMatcher(const float *templ, const float *weights, size_t length, size_t features, float weight_cutoff, TemplateStorage storage) :
+_features(features),
+_length(length),
+_tmpl(_features, storage),
+_costs(_length),
+_normalize(0),
+_prune(false),
+_bound(std::numeric_limits<float>::max()),
+_live(0),
+_band(std::numeric_limits<int>::max()),
+_prefix(0),
+_state(nullptr),
+_state_own(_StateFloats(_length)),
+_count_columns(0),
+_count_pruned(0),
+_count_rows(0) {
+    // path lengths are stored in 16 bits
+    if (_length >= DTM_MAX_LEN) {
+        throw std::invalid_argument("requires template shorter than 65535 feature vectors");
+    }
+    
+    // copy template features and weights
+    _tmpl.AddTemplate(templ, weights, length, weight_cutoff);
+    
+    // calculate normalization
+    _CalculateNormalize();
+    
+    // allocate alpha
+    SetAlpha(1.0);
+    
+    // reset dpp storage
+    Reset();
+}
+
+DynamicTimeMatcher::DynamicTimeMatcher(const DynamicTimeMatcher &other, size_t length) :
+_features(other._features),
+_length(length),
+_tmpl(_features, other._tmpl.GetStorage()),
+_costs(_length),
+_normalize(0),
+_prune(false),
+_bound(std::numeric_limits<float>::max()),
+_live(0),
+_band(std::numeric_limits<int>::max()),
+_prefix(0),
+_state(nullptr),
+_state_own(_StateFloats(_length)),
+_count_columns(0),
+_count_pruned(0),
+_count_rows(0) {
+    // require non-zero length, within the other template
+    if (_length == 0 || _length > other._length) {
+        throw std::invalid_argument("requires non-empty length within the other template");
+    }
+    
+    // copy template rows and alpha
+    _tmpl.AddTemplate(other._tmpl, 0, _length);
+    for (unsigned int i = 0; i < _length; ++i) {
+        _Alpha()[i] = other._Alpha()[i];
+    }
+    
+    // calculate normalization
+    _CalculateNormalize();
+    
+    // reset dpp storage
+    Reset();
+}
+
+DynamicTimeMatcher::DynamicTimeMatcher(const DynamicTimeMatcher &other) :
+_features(other._features),
+_length(other._length),
+_tmpl(other._tmpl),
+_costs(other._costs),
+_normalize(other._normalize),
+_prune(other._prune),
+_bound(other._bound),
+_live(other._live),
+_band(other._band),
+_prefix(other._prefix),
+_state(nullptr),
+_state_own(other._Alpha(), other._Alpha() + _StateFloats(_length)),
+_idx(other._idx),
+_count_columns(other._count_columns),
+_count_pruned(other._count_pruned),
+_count_rows(other._count_rows) {
+    
+}
+
 DynamicTimeMatcher::~DynamicTimeMatcher() {
     
 }
@@ -77,7 +202,7 @@ DynamicTimeMatcher::~DynamicTimeMatcher() {
 bool DynamicTimeMatcher::SetAlpha(float alpha) {
     // set alpha
     for (unsigned int i = 0; i < _length; ++i) {
-        _alpha[i] = alpha;
+        _Alpha()[i] = alpha;
     }
     
     return true;
@@ -91,7 +216,84 @@ bool DynamicTimeMatcher::SetAlpha(const std::vector<float>& alpha) {
     
     // set alpha
     for (unsigned int i = 0; i < _length; ++i) {
-        _alpha[i] = alpha[i];
+        _Alpha()[i] = alpha[i];
+    }
+    
+    return true;
+}
+
+bool DynamicTimeMatcher::SetThreshold(float threshold) {
+    if (threshold > 1.f) {
+        return false;
+    }
+    
+    // small margin, since rounding can leave costs slightly below zero
+    return SetBound(threshold > 0.f ? _normalize * (1.f - threshold + 1e-3f) : std::numeric_limits<float>::max());
+}
+
+bool DynamicTimeMatcher::SetBound(float bound) {
+    if (bound < 0.f) {
+        return false;
+    }
+    
+    _prune = bound < std::numeric_limits<float>::max();
+    _bound = bound;
+    
+    // start over, with every row live or only the first
+    Reset();
+    
+    return true;
+}
+
+bool DynamicTimeMatcher::SetLengthConstraint(float threshold_length) {
+    if (threshold_length < 0.f) {
+        return false;
+    }
+    
+    // for whole numbers, |d| < threshold_length is the same as |d| < ceil(threshold_length)
+    _band = threshold_length > 0.f ? static_cast<int>(ceil(threshold_length)) : std::numeric_limits<int>::max();
+    
+    // start over, since current paths may be outside the band
+    Reset();
+    
+    return true;
+}
+
+bool DynamicTimeMatcher::SetPrefix(size_t rows) {
+    // at least one row of its own
+    if (rows >= _length) {
+        return false;
+    }
+    
+    _prefix = rows;
+    
+    // start over, with rows above the prefix only reached through it
+    Reset();
+    
+    return true;
+}
+
+size_t DynamicTimeMatcher::CommonPrefix(const DynamicTimeMatcher &other) {
+    size_t i = 0;
+    while (i < _length && i < other._length && _Alpha()[i] == other._Alpha()[i] && _tmpl.SameRow(i, other._tmpl, i)) {
+        ++i;
+    }
+    return i;
+}
+
+bool DynamicTimeMatcher::SameState(const DynamicTimeMatcher &other) {
+    if (_length != other._length || _prefix != other._prefix || _live != other._live) {
+        return false;
+    }
+    
+    // rows read by the next column (up to the row after the last live one)
+    const size_t rows = std::min(static_cast<size_t>(_live) + 1, _length);
+    const float *score = _Score(_idx), *other_score = other._Score(other._idx);
+    const uint16_t *len = _Len(_idx), *other_len = other._Len(other._idx);
+    for (size_t i = _prefix; i <= rows; ++i) {
+        if (score[i] != other_score[i] || len[i] != other_len[i]) {
+            return false;
+        }
     }
     
     return true;
@@ -101,12 +303,50 @@ void DynamicTimeMatcher::Reset() {
     // set index to first column of DPP
     _idx = 0;
     
-    _dpp_score[0] = 0.0;
-    _dpp_len[0] = 0;
+    // only the first row (after the prefix) is below the bound (without pruning, every row is updated)
+    _live = _prune ? static_cast<unsigned int>(_prefix) : static_cast<unsigned int>(_length);
+    
+    float *dpp_score = _Score(0);
+    uint16_t *dpp_len = _Len(0);
+    dpp_score[0] = 0.0;
+    dpp_len[0] = 0;
     for (unsigned int i = 1; i < (_length + 1); ++i) {
-        _dpp_score[i] = std::numeric_limits<float>::max();
-        // dpp_len should not matter, since score is maxed out
+        dpp_score[i] = std::numeric_limits<float>::max();
+        dpp_len[i] = 0; // nan costs can carry a maxed out score (and its length) forward
+    }
+}
+
+size_t DynamicTimeMatcher::_StateFloats(size_t length) {
+    // alpha and two columns, in whole cache lines
+    const size_t line = DTM_STATE_ALIGN / sizeof(float);
+    return ((length + 2 * _ColumnFloats(length) + line - 1) / line) * line;
+}
+
+bool DynamicTimeMatcher::SetState(void *state) {
+    if (state == nullptr) {
+        // back to memory of its own
+        if (_state) {
+            _state_own.assign(_state, _state + _StateFloats(_length));
+            _state = nullptr;
+        }
+        return true;
+    }
+    
+    // must be aligned
+    if (reinterpret_cast<uintptr_t>(state) % DTM_STATE_ALIGN != 0) {
+        return false;
+    }
+    
+    // move the current state
+    float *to = static_cast<float *>(state);
+    if (to != _state) {
+        const float *from = _Alpha();
+        std::copy(from, from + _StateFloats(_length), to);
+        _state = to;
     }
+    std::vector<float>().swap(_state_own);
+    
+    return true;
 }
 
 void DynamicTimeMatcher::_CalculateNormalize() {
@@ -124,94 +364,118 @@ float DynamicTimeMatcher::_NormalizeScore(float score) {
     return normalized;
 }
 
-float DynamicTimeMatcher::_ScoreFeatures(const float *tmpl_feature, const float *signal_feature) {
-    float dot = 0;
-    float norm_t = 0;
-    float norm_s = 0;
-    
-    float tt, ss;
-    for (unsigned int i = 0; i < _features; ++i) {
-        // get current entries
-        tt = tmpl_feature[i];
-        ss = signal_feature[i];
-        
-        // update counts
-        dot += tt * ss;
-        norm_t += tt * tt;
-        norm_s += ss * ss;
-    }
+struct dtm_out DynamicTimeMatcher::IngestFeatureVector(const float *features) {
+    // cost for each potential spot in the template
+    _tmpl.CalculateCosts(features, _costs.ptr());
     
-    // check power?
-    if (norm_t < 0.5 && norm_s < 0.5) {
-        return 0.f;
-    }
+    return IngestCostVector(_costs.ptr() + _prefix);
+}
+
+struct dtm_out DynamicTimeMatcher::IngestCostVector(const float *costs) {
+    // no path through a prefix
+    struct dtm_out prefix = {std::numeric_limits<float>::max(), 0.f, 0};
     
-    float result = dot / (sqrt(norm_t) * sqrt(norm_s));
-    return 1.f - result;
+    return IngestCostVector(costs, prefix);
 }
 
-struct dtm_out DynamicTimeMatcher::IngestFeatureVector(const float *features) {
+struct dtm_out DynamicTimeMatcher::IngestCostVector(const float *costs, const struct dtm_out &prefix) {
     // error response
     struct dtm_out ret = {-1.0, -1.0, 0};
     
     // pointers to alternating DPP results
-    float *_lst_score;
-    unsigned int *_lst_len;
-    float *_cur_score;
-    unsigned int *_cur_len;
-    if (_idx == 0) {
-        _lst_score = _dpp_score.ptr();
-        _lst_len = _dpp_len.ptr();
-        _cur_score = _dpp_score.ptr() + (_length + 1);
-        _cur_len = _dpp_len.ptr() + (_length + 1);
-        _idx = 1;
-    }
-    else {
-        _lst_score = _dpp_score.ptr() + (_length + 1);
-        _lst_len = _dpp_len.ptr() + (_length + 1);
-        _cur_score = _dpp_score.ptr();
-        _cur_len = _dpp_len.ptr();
-        _idx = 0;
-    }
-    
-    // for each potential spot in the template
+    float *_lst_score = _Score(_idx);
+    uint16_t *_lst_len = _Len(_idx);
+    float *_cur_score = _Score(1 - _idx);
+    uint16_t *_cur_len = _Len(1 - _idx);
+    _idx = 1 - _idx;
+    const float *_alpha = _Alpha();
+    
+    // last row of the prefix
+    if (_prefix > 0) {
+        const int prefix_len = prefix.len_diff + static_cast<int>(_prefix);
+        _cur_score[_prefix] = prefix.score;
+        _cur_len[_prefix] = static_cast<uint16_t>(std::min(std::max(prefix_len, 0), DTM_MAX_LEN));
+    }
+    
+    // for each potential spot in the template, up to the row after the last live one
     float cost, alpha, score, t_score;
     unsigned int len;
-    for (unsigned int i = 0; i < _length; ++i) {
+    unsigned int i = static_cast<unsigned int>(_prefix);
+    for (unsigned int rows = (_live < _length ? _live + 1 : static_cast<unsigned int>(_length)); i < rows; ++i) {
         // current alpha
         alpha = _alpha[i];
         
         // current cost
-        cost = _ScoreFeatures(_tmpl.ptr() + (i * _features), features);
+        cost = costs[i - _prefix];
         
         // is nan? (special case)
         if (isnan(cost)) {
             // assume diagonal
             score = _lst_score[i];
-            len = _lst_len[i] + 1;
+            len = next_len(_lst_len[i]);
         }
         else {
             // diagonal (move in both template and signal space)
             score = _lst_score[i] + cost;
-            len = _lst_len[i] + 1;
+            len = next_len(_lst_len[i]);
             
-            // up (move in template space, but not in signal space)
+            // up (move in template space, but not in signal space), if it stays in the band
             t_score = _cur_score[i] + cost * alpha;
-            if (t_score < score) {
+            if (t_score < score && static_cast<int>(_cur_len[i]) - static_cast<int>(i + 1) > -_band) {
                 score = t_score;
                 len = _cur_len[i];
             }
             
-            // left (move in signal space, not in template space)
+            // left (move in signal space, not in template space), if it stays in the band
             t_score = _lst_score[i + 1] + cost * alpha;
-            if (t_score < score) {
+            if (t_score < score && static_cast<int>(_lst_len[i + 1]) - static_cast<int>(i) < _band) {
                 score = t_score;
-                len = _lst_len[i + 1] + 1;
+                len = next_len(_lst_len[i + 1]);
             }
         }
         
         _cur_score[i + 1] = score;
-        _cur_len[i + 1] = len;
+        _cur_len[i + 1] = static_cast<uint16_t>(len);
+    }
+    
+    // above that, the last column is pruned, so rows can only be reached by moving up
+    for (; i < _length && _cur_score[i] <= _bound; ++i) {
+        cost = costs[i - _prefix];
+        
+        // only the (pruned) diagonal, or moving up leaves the band
+        if (isnan(cost) || static_cast<int>(_cur_len[i]) - static_cast<int>(i + 1) <= -_band) {
+            break;
+        }
+        
+        _cur_score[i + 1] = _cur_score[i] + cost * _alpha[i];
+        _cur_len[i + 1] = _cur_len[i];
+    }
+    
+    // counters
+    ++_count_columns;
+    _count_rows += i - _prefix;
+    
+    // highest row still below the bound (row i is the last one written)
+    if (_prune) {
+        while (i > _prefix && _cur_score[i] > _bound) {
+            --i;
+        }
+        _live = i;
+        if (i < _length) {
+            _cur_score[i + 1] = std::numeric_limits<float>::max();
+            _cur_len[i + 1] = 0;
+        }
+    }
+    
+    // last row pruned, can not reach the threshold
+    if (i < _length) {
+        ++_count_pruned;
+        
+        ret.score = std::numeric_limits<float>::max();
+        ret.normalized_score = 0.f;
+        ret.len_diff = -static_cast<int>(_length);
+        
+        return ret;
     }
     
     ret.score = _cur_score[_length];
@@ -224,3 +488,126 @@ struct dtm_out DynamicTimeMatcher::IngestFeatureVector(const float *features) {
 struct dtm_out DynamicTimeMatcher::IngestFeatureVector(const std::vector<float>& features) {
     return IngestFeatureVector(&features[0]);
 }
+
+void DynamicTimeMatcher::IngestFeatureMatrix(const float *features, size_t columns, struct dtm_out *out) {
+    // costs for every column, a tile of template rows at a time
+    if (_costs_matrix.size() < columns * _length) {
+        _costs_matrix.resize(columns * _length);
+    }
+    _tmpl.CalculateCosts(features, columns, &_costs_matrix[0]);
+    
+    IngestCostMatrix(&_costs_matrix[0], columns, out);
+}
+
+void DynamicTimeMatcher::IngestCostMatrix(const float *costs, size_t columns, struct dtm_out *out) {
+    // pruning tracks live rows column by column (as does a prefix, though none is passed here)
+    if (_prune || _prefix > 0) {
+        for (size_t c = 0; c < columns; ++c) {
+            out[c] = IngestCostVector(costs + c * _length + _prefix);
+        }
+        return;
+    }
+    
+    if (columns == 0) {
+        return;
+    }
+    
+    // updated in place: the last column, becoming the newest column one block at a time
+    float *dpp_score = _Score(_idx);
+    uint16_t *dpp_len = _Len(_idx);
+    const float *alphas = _Alpha();
+    
+    // row below the current block for each column (entry 0 is the column before this call), and the
+    // top row of the current block for the next block; the first row is always 0
+    for (size_t k = 0; k < 2; ++k) {
+        if (_edge_score[k].size() < columns + 1) {
+            _edge_score[k].resize(columns + 1);
+            _edge_len[k].resize(columns + 1);
+        }
+    }
+    float *edge_score = &_edge_score[0][0], *next_score = &_edge_score[1][0];
+    uint16_t *edge_len = &_edge_len[0][0], *top_len = &_edge_len[1][0];
+    std::fill(edge_score, edge_score + columns + 1, 0.f);
+    std::fill(edge_len, edge_len + columns + 1, 0);
+    
+    float cost, alpha, score, t_score, diag_score, up_score, left_score;
+    unsigned int len, diag_len, up_len, left_len;
+    for (unsigned int r0 = 0; r0 < _length; r0 += DTM_BLOCK_ROWS) {
+        const unsigned int r1 = std::min(r0 + DTM_BLOCK_ROWS, static_cast<unsigned int>(_length));
+        
+        // top row before any column of this call
+        next_score[0] = dpp_score[r1];
+        top_len[0] = dpp_len[r1];
+        
+        for (size_t c = 0; c < columns; ++c) {
+            const float *col_costs = costs + c * _length;
+            
+            // row below the block, in the last and current column
+            diag_score = edge_score[c];
+            diag_len = edge_len[c];
+            up_score = edge_score[c + 1];
+            up_len = edge_len[c + 1];
+            
+            // same recurrence as IngestCostVector
+            for (unsigned int i = r0; i < r1; ++i) {
+                alpha = alphas[i];
+                cost = col_costs[i];
+                left_score = dpp_score[i + 1];
+                left_len = dpp_len[i + 1];
+                
+                // is nan? (special case)
+                if (isnan(cost)) {
+                    // assume diagonal
+                    score = diag_score;
+                    len = next_len(diag_len);
+                }
+                else {
+                    // diagonal (move in both template and signal space)
+                    score = diag_score + cost;
+                    len = next_len(diag_len);
+                    
+                    // up (move in template space, but not in signal space), if it stays in the band
+                    t_score = up_score + cost * alpha;
+                    if (t_score < score && static_cast<int>(up_len) - static_cast<int>(i + 1) > -_band) {
+                        score = t_score;
+                        len = up_len;
+                    }
+                    
+                    // left (move in signal space, not in template space), if it stays in the band
+                    t_score = left_score + cost * alpha;
+                    if (t_score < score && static_cast<int>(left_len) - static_cast<int>(i) < _band) {
+                        score = t_score;
+                        len = next_len(left_len);
+                    }
+                }
+                
+                dpp_score[i + 1] = score;
+                dpp_len[i + 1] = static_cast<uint16_t>(len);
+                
+                // move up a row
+                diag_score = left_score;
+                diag_len = left_len;
+                up_score = score;
+                up_len = len;
+            }
+            
+            // top row, for the next block
+            next_score[c + 1] = up_score;
+            top_len[c + 1] = static_cast<uint16_t>(up_len);
+        }
+        
+        std::swap(edge_score, next_score);
+        std::swap(edge_len, top_len);
+    }
+    
+    // the last block ends with the last row of every column
+    for (size_t c = 0; c < columns; ++c) {
+        out[c].score = edge_score[c + 1];
+        out[c].normalized_score = _NormalizeScore(edge_score[c + 1]);
+        out[c].len_diff = static_cast<int>(edge_len[c + 1]) - static_cast<int>(_length);
+    }
+    
+    // counters
+    _count_columns += columns;
+    _count_rows += columns * _length;
+}
@@ -10,9 +10,14 @@
 #define DynamicTimeMatcher_hpp
 
 #include <stdio.h>
+#include <stdint.h>
 #include <vector>
 
 #include "ManagedMemory.hpp"
+#include "TemplateBank.hpp"
+
+// alignment (and size granularity) of DPP state, so state shared in one arena stays on its own lines
+#define DTM_STATE_ALIGN 64
 
 struct dtm_out {
     float score;
@@ -23,40 +28,131 @@ struct dtm_out {
 class DynamicTimeMatcher
 {
 public:
-    DynamicTimeMatcher(const std::vector<std::vector<float>> &templ);
-    DynamicTimeMatcher(const float *templ, size_t length, size_t features);
+    DynamicTimeMatcher(const std::vector<std::vector<float>> &templ, TemplateStorage storage = kTemplateFloat32);
+    DynamicTimeMatcher(const float *templ, size_t length, size_t features, TemplateStorage storage = kTemplateFloat32);
+    DynamicTimeMatcher(const float *templ, const float *weights, size_t length, size_t features, float weight_cutoff = 0.f, TemplateStorage storage = kTemplateFloat32); // weighted similarity, bins below the cutoff are skipped
+    DynamicTimeMatcher(const DynamicTimeMatcher &other, size_t length); // first `length` template rows (and alpha) of another matcher
+    DynamicTimeMatcher(const DynamicTimeMatcher &other); // with its own copy of the state
     ~DynamicTimeMatcher();
     
     bool SetAlpha(float alpha);
     bool SetAlpha(const std::vector<float>& alpha);
     
+    // only results with a normalized score of at least `threshold` are needed (0 disables pruning).
+    // Costs only add up along a path, so rows whose score is already too high are dropped from the
+    // update (early abandoning); results that can not reach the threshold come back with the maximum
+    // score, while those that can are unchanged. Assumes non-negative costs and alpha.
+    bool SetThreshold(float threshold);
+    bool SetBound(float bound); // prune scores above `bound` instead (the maximum disables pruning)
+    float GetBound() { return _bound; }
+    
+    // only paths whose length stays within `threshold_length` of the template position are followed
+    // (a Sakoe-Chiba style band on the warp), so every path that reaches the end of the template
+    // satisfies |len_diff| < threshold_length, and paths that could not are cut from the recurrence
+    // instead of being rejected afterwards (0 disables the band). With a threshold set, cut cells
+    // are pruned as well.
+    bool SetLengthConstraint(float threshold_length);
+    
+    // the first `rows` template rows are shared with another matcher (same template rows and alpha,
+    // see CommonPrefix, and the same length constraint), which ingests each column first and passes
+    // its result to IngestCostVector; those rows are not stored in the DPP. The prefix matcher's
+    // bound must be at least this one's, and it must be reset along with this one (otherwise it
+    // passes on paths that started before the reset).
+    bool SetPrefix(size_t rows);
+    size_t GetPrefix() { return _prefix; }
+    
+    // number of leading template rows stored exactly the same, with the same alpha
+    size_t CommonPrefix(const DynamicTimeMatcher &other);
+    
+    // same live rows and last DPP column (after the prefix) as another matcher of the same
+    // template, so both return the same results from here on (given the same costs and prefix)
+    bool SameState(const DynamicTimeMatcher &other);
+    
     void Reset();
     
+    // state read for every column (alpha and the last two DPP columns, with path lengths packed to
+    // 16 bits, saturating past 65535 columns), in one block of GetStateSize() bytes. SetState moves
+    // it to `state` (aligned to DTM_STATE_ALIGN, and used until the matcher is destroyed or moved
+    // again), so many matchers can be carved from one arena and updated in order; NULL moves it back
+    // to memory of its own.
+    size_t GetStateSize() { return _StateFloats(_length) * sizeof(float); }
+    bool SetState(void *state);
+    
     float GetNormalize() { return _normalize; }
     
     size_t GetFeatures() { return _features; }
     size_t GetLength() { return _length; }
+    const TemplateBank &GetTemplate() { return _tmpl; }
+    
+    // columns ingested, columns pruned (could not reach the threshold) and template rows updated
+    unsigned long GetColumns() { return _count_columns; }
+    unsigned long GetPrunedColumns() { return _count_pruned; }
+    unsigned long GetUpdatedRows() { return _count_rows; }
     
     struct dtm_out IngestFeatureVector(const float *features);
     struct dtm_out IngestFeatureVector(const std::vector<float>& features);
     
+    // costs already calculated for each template feature vector (e.g., by a shared TemplateBank);
+    // with a prefix, costs start at row GetPrefix() and `prefix` is the prefix matcher's result
+    struct dtm_out IngestCostVector(const float *costs);
+    struct dtm_out IngestCostVector(const float *costs, const struct dtm_out &prefix);
+
+    // several signal columns at once (stored one after another), one result per column; costs are
+    // calculated a tile of template rows at a time and the recurrence runs over blocks of template
+    // rows for every column, so template data stays in cache (same results as column by column)
+    void IngestFeatureMatrix(const float *features, size_t columns, struct dtm_out *out);
+    void IngestCostMatrix(const float *costs, size_t columns, struct dtm_out *out); // costs[c * GetLength() + i]
+
 private:
+    // prevent assignment
+    const DynamicTimeMatcher &operator=(const DynamicTimeMatcher &);
+    
     void _CalculateNormalize();
     float _NormalizeScore(float score);
     
-    float _ScoreFeatures(const float *tmpl_feature, const float *signal_feature);
+    // state layout: alpha, then each DPP column as scores followed by lengths
+    static size_t _ColumnFloats(size_t length) { return (length + 1) + ((length + 1) * sizeof(uint16_t) + sizeof(float) - 1) / sizeof(float); }
+    static size_t _StateFloats(size_t length);
+    float *_Alpha() { return _state ? _state : _state_own.data(); }
+    const float *_Alpha() const { return _state ? _state : _state_own.data(); }
+    float *_Score(unsigned int idx) { return _Alpha() + _length + idx * _ColumnFloats(_length); }
+    uint16_t *_Len(unsigned int idx) { return reinterpret_cast<uint16_t *>(_Score(idx) + (_length + 1)); }
+    const float *_Score(unsigned int idx) const { return _Alpha() + _length + idx * _ColumnFloats(_length); }
+    const uint16_t *_Len(unsigned int idx) const { return reinterpret_cast<const uint16_t *>(_Score(idx) + (_length + 1)); }
     
     size_t _features; // number of features in each step of the template
     size_t _length; // number of feature vectors in the template
     
-    ManagedMemory<float> _tmpl; // size = _features * _length
-    ManagedMemory<float> _alpha; // size = _length
+    TemplateBank _tmpl; // _length rows
+    ManagedMemory<float> _costs; // size = _length
     
     float _normalize; // normalization that allows comparing across DynamicTimeMatcher instances
     
-    ManagedMemory<float> _dpp_score;
-    ManagedMemory<unsigned int> _dpp_len;
+    // pruning: scores above the bound are not needed, and rows above _live in the last column are
+    // all above the bound (the row after _live is written as the maximum score)
+    bool _prune;
+    float _bound;
+    unsigned int _live;
+    
+    // largest allowed difference between path length and template position, plus one
+    int _band;
+    
+    // rows shared with a prefix matcher
+    size_t _prefix;
+    
+    // state (see GetStateSize), either in an arena or in memory of its own
+    float *_state;
+    std::vector<float> _state_own;
     unsigned int _idx; // index in the dynamic plex propogation
+    
+    // costs and block boundaries (the row below each block, for every column) for several columns
+    std::vector<float> _costs_matrix;
+    std::vector<float> _edge_score[2];
+    std::vector<uint16_t> _edge_len[2];
+    
+    unsigned long _count_columns;
+    unsigned long _count_pruned;
+    unsigned long _count_rows;
 };
 
 #endif /* DynamicTimeMatcher_hpp */
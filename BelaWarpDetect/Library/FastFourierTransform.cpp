@@ -0,0 +1,296 @@
+//
+//  FastFourierTransform.cpp
+//  BelaWarpDetect
+//
+
+#include "FastFourierTransform.hpp"
+#include "Simd.hpp"
+
+#include <cmath>
+#include <stdexcept>
+
+FastFourierTransform::FastFourierTransform(unsigned int length) :
+_length(length),
+_length_half(length / 2),
+_stage_real(length > 2 ? length / 2 : 1),
+_stage_imag(length > 2 ? length / 2 : 1),
+_unpack_cos(length / 2 + 1),
+_unpack_sin(length / 2 + 1),
+_work_real(length / 2),
+_work_imag(length / 2),
+_temp_real(length / 2),
+_temp_imag(length / 2),
+_batch_work_real(SIMD_WIDTH * (length / 2)),
+_batch_work_imag(SIMD_WIDTH * (length / 2)),
+_batch_temp_real(SIMD_WIDTH * (length / 2)),
+_batch_temp_imag(SIMD_WIDTH * (length / 2)) {
+    // require power of two
+    if (length < 2 || (length & (length - 1)) != 0) {
+        throw std::invalid_argument("length must be a power of two");
+    }
+    
+    // stage twiddles: stage with sub-length n uses exp(-2 pi i p / n) for p < n / 2
+    unsigned int offset = 0;
+    for (unsigned int n = _length_half; n > 1; n >>= 1) {
+        for (unsigned int p = 0; p < n / 2; ++p) {
+            double theta = 2.0 * M_PI * static_cast<double>(p) / static_cast<double>(n);
+            _stage_real[offset + p] = static_cast<float>(cos(theta));
+            _stage_imag[offset + p] = static_cast<float>(-sin(theta));
+        }
+        offset += n / 2;
+    }
+    
+    // unpack twiddles: exp(-2 pi i k / length) for k <= length / 2
+    for (unsigned int k = 0; k <= _length_half; ++k) {
+        double theta = 2.0 * M_PI * static_cast<double>(k) / static_cast<double>(_length);
+        _unpack_cos[k] = static_cast<float>(cos(theta));
+        _unpack_sin[k] = static_cast<float>(sin(theta));
+    }
+}
+
+FastFourierTransform::~FastFourierTransform() {
+    
+}
+
+void FastFourierTransform::_TransformPacked(float *&out_real, float *&out_imag, unsigned int last_lo, unsigned int last_hi) {
+    float *src_r = _work_real.ptr(), *src_i = _work_imag.ptr();
+    float *dst_r = _temp_real.ptr(), *dst_i = _temp_imag.ptr();
+    const float *tw_r = _stage_real.ptr(), *tw_i = _stage_imag.ptr();
+    
+    // stockham radix-2: each stage reads `src` and writes `dst` in sorted order
+    for (unsigned int n = _length_half, s = 1; n > 1; n >>= 1, s <<= 1) {
+        const unsigned int m = n / 2;
+        
+        // last stage (single butterfly group), can be pruned
+        const unsigned int q_lo = (m == 1 ? last_lo : 0), q_hi = (m == 1 ? last_hi : s);
+        
+        if (s >= SIMD_WIDTH) {
+            // inner loop over q is contiguous, use vector lanes
+            for (unsigned int p = 0; p < m; ++p) {
+                const simd_float wr = simd_set1(tw_r[p]), wi = simd_set1(tw_i[p]);
+                const float *ar = src_r + s * p, *ai = src_i + s * p;
+                const float *br = src_r + s * (p + m), *bi = src_i + s * (p + m);
+                float *yr0 = dst_r + s * (2 * p), *yi0 = dst_i + s * (2 * p);
+                float *yr1 = dst_r + s * (2 * p + 1), *yi1 = dst_i + s * (2 * p + 1);
+                
+                for (unsigned int q = q_lo; q < q_hi; q += SIMD_WIDTH) {
+                    simd_float a_r = simd_load(ar + q), a_i = simd_load(ai + q);
+                    simd_float b_r = simd_load(br + q), b_i = simd_load(bi + q);
+                    
+                    simd_store(yr0 + q, simd_add(a_r, b_r));
+                    simd_store(yi0 + q, simd_add(a_i, b_i));
+                    
+                    simd_float d_r = simd_sub(a_r, b_r), d_i = simd_sub(a_i, b_i);
+                    simd_store(yr1 + q, simd_sub(simd_mul(d_r, wr), simd_mul(d_i, wi)));
+                    simd_store(yi1 + q, simd_add(simd_mul(d_r, wi), simd_mul(d_i, wr)));
+                }
+            }
+        }
+        else if (s == 1 && m >= SIMD_WIDTH) {
+            // first stage: vectorize over p instead, outputs are interleaved sum / difference pairs
+            for (unsigned int p = 0; p < m; p += SIMD_WIDTH) {
+                const simd_float wr = simd_load(tw_r + p), wi = simd_load(tw_i + p);
+                simd_float a_r = simd_load(src_r + p), a_i = simd_load(src_i + p);
+                simd_float b_r = simd_load(src_r + p + m), b_i = simd_load(src_i + p + m);
+                
+                simd_float d_r = simd_sub(a_r, b_r), d_i = simd_sub(a_i, b_i);
+                simd_store_interleaved(dst_r + 2 * p, simd_add(a_r, b_r), simd_sub(simd_mul(d_r, wr), simd_mul(d_i, wi)));
+                simd_store_interleaved(dst_i + 2 * p, simd_add(a_i, b_i), simd_add(simd_mul(d_r, wi), simd_mul(d_i, wr)));
+            }
+        }
+        else {
+            for (unsigned int p = 0; p < m; ++p) {
+                const float wr = tw_r[p], wi = tw_i[p];
+                for (unsigned int q = q_lo; q < q_hi; ++q) {
+                    const float a_r = src_r[q + s * p], a_i = src_i[q + s * p];
+                    const float b_r = src_r[q + s * (p + m)], b_i = src_i[q + s * (p + m)];
+                    
+                    dst_r[q + s * (2 * p)] = a_r + b_r;
+                    dst_i[q + s * (2 * p)] = a_i + b_i;
+                    
+                    const float d_r = a_r - b_r, d_i = a_i - b_i;
+                    dst_r[q + s * (2 * p + 1)] = d_r * wr - d_i * wi;
+                    dst_i[q + s * (2 * p + 1)] = d_r * wi + d_i * wr;
+                }
+            }
+        }
+        
+        // advance twiddles
+        tw_r += m;
+        tw_i += m;
+        
+        // swap buffers
+        float *t;
+        t = src_r; src_r = dst_r; dst_r = t;
+        t = src_i; src_i = dst_i; dst_i = t;
+    }
+    
+    out_real = src_r;
+    out_imag = src_i;
+}
+
+void FastFourierTransform::_LastStageRange(unsigned int bin_lo, unsigned int bin_hi, unsigned int &last_lo, unsigned int &last_hi) {
+    // bin k needs packed terms k and length_half - k, which the last stage produces as
+    // butterfly (index mod length_half / 2), so find the butterflies touched by the band
+    const unsigned int s_last = _length_half / 2;
+    last_lo = s_last;
+    last_hi = 0;
+    if (s_last == 0) {
+        last_lo = last_hi = 0;
+    }
+    else {
+        for (unsigned int k = bin_lo; k < bin_hi; ++k) {
+            unsigned int a = (k % _length_half) % s_last, b = ((_length_half - k) % _length_half) % s_last;
+            if (a < last_lo) last_lo = a;
+            if (b < last_lo) last_lo = b;
+            if (a + 1 > last_hi) last_hi = a + 1;
+            if (b + 1 > last_hi) last_hi = b + 1;
+        }
+        
+        // keep vector lanes aligned
+        if (s_last >= SIMD_WIDTH) {
+            last_lo -= last_lo % SIMD_WIDTH;
+            last_hi += (SIMD_WIDTH - last_hi % SIMD_WIDTH) % SIMD_WIDTH;
+        }
+    }
+}
+
+void FastFourierTransform::Forward(const float *input, float *out_real, float *out_imag) {
+    Forward(input, out_real, out_imag, 0, _length_half + 1);
+}
+
+void FastFourierTransform::Forward(const float *input, float *out_real, float *out_imag, unsigned int bin_lo, unsigned int bin_hi) {
+    // pack even samples as real, odd samples as imaginary
+    float *z_r = _work_real.ptr(), *z_i = _work_imag.ptr();
+    for (unsigned int k = 0; k < _length_half; ++k) {
+        z_r[k] = input[2 * k];
+        z_i[k] = input[2 * k + 1];
+    }
+    
+    // only compute the last stage butterflies touched by the band
+    unsigned int last_lo, last_hi;
+    _LastStageRange(bin_lo, bin_hi, last_lo, last_hi);
+    
+    // half length complex transform
+    _TransformPacked(z_r, z_i, last_lo, last_hi);
+    
+    // unpack: X[k] = E[k] + exp(-2 pi i k / N) O[k]
+    for (unsigned int k = bin_lo; k < bin_hi; ++k) {
+        if (k == 0 || k == _length_half) {
+            // purely real terms
+            out_real[k - bin_lo] = (k == 0 ? z_r[0] + z_i[0] : z_r[0] - z_i[0]);
+            out_imag[k - bin_lo] = 0.f;
+            continue;
+        }
+        
+        const unsigned int j = _length_half - k;
+        const float e_r = 0.5f * (z_r[k] + z_r[j]);
+        const float e_i = 0.5f * (z_i[k] - z_i[j]);
+        const float o_r = 0.5f * (z_i[k] + z_i[j]);
+        const float o_i = -0.5f * (z_r[k] - z_r[j]);
+        const float c = _unpack_cos[k], s = _unpack_sin[k];
+        out_real[k - bin_lo] = e_r + o_r * c + o_i * s;
+        out_imag[k - bin_lo] = e_i + o_i * c - o_r * s;
+    }
+}
+
+void FastFourierTransform::_TransformPackedBatch(float *&out_real, float *&out_imag, unsigned int last_lo, unsigned int last_hi) {
+    float *src_r = _batch_work_real.ptr(), *src_i = _batch_work_imag.ptr();
+    float *dst_r = _batch_temp_real.ptr(), *dst_i = _batch_temp_imag.ptr();
+    const float *tw_r = _stage_real.ptr(), *tw_i = _stage_imag.ptr();
+    
+    // same stockham stages as above, but every value is a vector of independent transforms, so all
+    // stages use full vector lanes
+    for (unsigned int n = _length_half, s = 1; n > 1; n >>= 1, s <<= 1) {
+        const unsigned int m = n / 2;
+        const unsigned int q_lo = (m == 1 ? last_lo : 0), q_hi = (m == 1 ? last_hi : s);
+        
+        for (unsigned int p = 0; p < m; ++p) {
+            const simd_float wr = simd_set1(tw_r[p]), wi = simd_set1(tw_i[p]);
+            for (unsigned int q = q_lo; q < q_hi; ++q) {
+                const unsigned int a = (q + s * p) * SIMD_WIDTH, b = (q + s * (p + m)) * SIMD_WIDTH;
+                const unsigned int y0 = (q + s * (2 * p)) * SIMD_WIDTH, y1 = (q + s * (2 * p + 1)) * SIMD_WIDTH;
+                
+                simd_float a_r = simd_load(src_r + a), a_i = simd_load(src_i + a);
+                simd_float b_r = simd_load(src_r + b), b_i = simd_load(src_i + b);
+                
+                simd_store(dst_r + y0, simd_add(a_r, b_r));
+                simd_store(dst_i + y0, simd_add(a_i, b_i));
+                
+                simd_float d_r = simd_sub(a_r, b_r), d_i = simd_sub(a_i, b_i);
+                simd_store(dst_r + y1, simd_sub(simd_mul(d_r, wr), simd_mul(d_i, wi)));
+                simd_store(dst_i + y1, simd_add(simd_mul(d_r, wi), simd_mul(d_i, wr)));
+            }
+        }
+        
+        // advance twiddles
+        tw_r += m;
+        tw_i += m;
+        
+        // swap buffers
+        float *t;
+        t = src_r; src_r = dst_r; dst_r = t;
+        t = src_i; src_i = dst_i; dst_i = t;
+    }
+    
+    out_real = src_r;
+    out_imag = src_i;
+}
+
+void FastFourierTransform::ForwardBatch(const float *const *inputs, unsigned int count, float *out_real, float *out_imag, unsigned int bin_lo, unsigned int bin_hi) {
+    // pack into lanes (unused lanes are zeroed)
+    float *z_r = _batch_work_real.ptr(), *z_i = _batch_work_imag.ptr();
+    for (unsigned int t = 0; t < SIMD_WIDTH; ++t) {
+        if (t < count) {
+            const float *input = inputs[t];
+            for (unsigned int k = 0; k < _length_half; ++k) {
+                z_r[k * SIMD_WIDTH + t] = input[2 * k];
+                z_i[k * SIMD_WIDTH + t] = input[2 * k + 1];
+            }
+        }
+        else {
+            for (unsigned int k = 0; k < _length_half; ++k) {
+                z_r[k * SIMD_WIDTH + t] = 0.f;
+                z_i[k * SIMD_WIDTH + t] = 0.f;
+            }
+        }
+    }
+    
+    // only compute the last stage butterflies touched by the band
+    unsigned int last_lo, last_hi;
+    _LastStageRange(bin_lo, bin_hi, last_lo, last_hi);
+    
+    // half length complex transforms
+    _TransformPackedBatch(z_r, z_i, last_lo, last_hi);
+    
+    // unpack: X[k] = E[k] + exp(-2 pi i k / N) O[k]
+    const unsigned int band = bin_hi - bin_lo;
+    const simd_float half = simd_set1(0.5f);
+    float res_r[SIMD_WIDTH], res_i[SIMD_WIDTH];
+    for (unsigned int k = bin_lo; k < bin_hi; ++k) {
+        const unsigned int j = (_length_half - k) % _length_half;
+        const simd_float zk_r = simd_load(z_r + (k % _length_half) * SIMD_WIDTH), zk_i = simd_load(z_i + (k % _length_half) * SIMD_WIDTH);
+        const simd_float zj_r = simd_load(z_r + j * SIMD_WIDTH), zj_i = simd_load(z_i + j * SIMD_WIDTH);
+        
+        if (k == 0 || k == _length_half) {
+            // purely real terms
+            simd_store(res_r, (k == 0 ? simd_add(zk_r, zk_i) : simd_sub(zk_r, zk_i)));
+            simd_store(res_i, simd_set1(0.f));
+        }
+        else {
+            const simd_float e_r = simd_mul(half, simd_add(zk_r, zj_r));
+            const simd_float e_i = simd_mul(half, simd_sub(zk_i, zj_i));
+            const simd_float o_r = simd_mul(half, simd_add(zk_i, zj_i));
+            const simd_float o_i = simd_mul(half, simd_sub(zj_r, zk_r));
+            const simd_float c = simd_set1(_unpack_cos[k]), s = simd_set1(_unpack_sin[k]);
+            simd_store(res_r, simd_add(e_r, simd_add(simd_mul(o_r, c), simd_mul(o_i, s))));
+            simd_store(res_i, simd_add(e_i, simd_sub(simd_mul(o_i, c), simd_mul(o_r, s))));
+        }
+        
+        // scatter lanes
+        for (unsigned int t = 0; t < count; ++t) {
+            out_real[t * band + k - bin_lo] = res_r[t];
+            out_imag[t * band + k - bin_lo] = res_i[t];
+        }
+    }
+}
@@ -0,0 +1,76 @@
+//
+//  FastFourierTransform.hpp
+//  BelaWarpDetect
+//
+
+#ifndef FastFourierTransform_hpp
+#define FastFourierTransform_hpp
+
+#include <stdio.h>
+
+#include "ManagedMemory.hpp"
+
+/// Dependency free real-input FFT, used when neither Accelerate nor NE10 is available. The real
+/// signal is packed into a half length complex sequence, transformed with a Stockham auto-sort FFT
+/// (no bit reversal, contiguous inner loops that map onto SIMD lanes) and then unpacked.
+class FastFourierTransform
+{
+public:
+    FastFourierTransform(unsigned int length);
+    ~FastFourierTransform();
+    
+    unsigned int GetLength() { return _length; }
+    unsigned int GetLengthOutput() { return _length_half + 1; }
+    
+    // forward transform of `_length` real values, producing `_length / 2 + 1` complex values in
+    // split format (unscaled, same as NE10)
+    void Forward(const float *input, float *out_real, float *out_imag);
+
+    // pruned forward transform that only produces bins [bin_lo, bin_hi) (written to out[0] onward);
+    // the final butterfly stage and the real unpacking skip everything outside the band
+    void Forward(const float *input, float *out_real, float *out_imag, unsigned int bin_lo, unsigned int bin_hi);
+
+    // pruned forward transform of `count` independent inputs at once (one per vector lane, so count
+    // may be at most SIMD_WIDTH); output for input t starts at out[t * (bin_hi - bin_lo)]
+    void ForwardBatch(const float *const *inputs, unsigned int count, float *out_real, float *out_imag, unsigned int bin_lo, unsigned int bin_hi);
+
+private:
+    // prevent copying
+    FastFourierTransform(const FastFourierTransform &);
+    const FastFourierTransform &operator=(const FastFourierTransform &);
+    
+    // complex transform of the packed half length sequence (result lands in either work buffer),
+    // the last stage only computes butterflies [last_lo, last_hi)
+    void _TransformPacked(float *&out_real, float *&out_imag, unsigned int last_lo, unsigned int last_hi);
+    
+    // same as above, but for the lane interleaved batch buffers (value k of lane t at k * SIMD_WIDTH + t)
+    void _TransformPackedBatch(float *&out_real, float *&out_imag, unsigned int last_lo, unsigned int last_hi);
+    
+    // range of last stage butterflies needed for bins [bin_lo, bin_hi)
+    void _LastStageRange(unsigned int bin_lo, unsigned int bin_hi, unsigned int &last_lo, unsigned int &last_hi);
+    
+    unsigned int _length;
+    unsigned int _length_half;
+    
+    // twiddles for each stockham stage (stored back to back)
+    ManagedMemory<float> _stage_real;
+    ManagedMemory<float> _stage_imag;
+    
+    // twiddles used to unpack the real transform
+    ManagedMemory<float> _unpack_cos;
+    ManagedMemory<float> _unpack_sin;
+    
+    // ping pong work buffers
+    ManagedMemory<float> _work_real;
+    ManagedMemory<float> _work_imag;
+    ManagedMemory<float> _temp_real;
+    ManagedMemory<float> _temp_imag;
+    
+    // lane interleaved work buffers for batches
+    ManagedMemory<float> _batch_work_real;
+    ManagedMemory<float> _batch_work_imag;
+    ManagedMemory<float> _batch_temp_real;
+    ManagedMemory<float> _batch_temp_imag;
+};
+
+#endif /* FastFourierTransform_hpp */
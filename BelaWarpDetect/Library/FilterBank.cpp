@@ -0,0 +1,120 @@
+//
+//  FilterBank.cpp
+//  BelaWarpDetect
+//
+
+#include "FilterBank.hpp"
+#include "Simd.hpp"
+
+#include <cmath>
+#include <stdexcept>
+#include <algorithm>
+
+static inline double to_scale(double f, bool log_spaced) {
+    return log_spaced ? log(f) : 2595.0 * log10(1.0 + f / 700.0);
+}
+
+static inline double from_scale(double v, bool log_spaced) {
+    return log_spaced ? exp(v) : 700.0 * (pow(10.0, v / 2595.0) - 1.0);
+}
+
+FilterBank::FilterBank(unsigned int bands, unsigned int idx_lo, unsigned int idx_hi, float bin_width, bool log_spaced) :
+_bands(bands),
+_length_input(idx_hi > idx_lo ? idx_hi - idx_lo : 0),
+_band_start(bands),
+_band_length(bands),
+_band_offset(bands) {
+    if (bands == 0 || idx_hi <= idx_lo) {
+        throw std::invalid_argument("filter bank needs at least one band and one input bin");
+    }
+    if (bin_width <= 0.f || (log_spaced && idx_lo == 0)) {
+        throw std::invalid_argument("invalid frequency range for filter bank");
+    }
+    
+    // band edges, evenly spaced on the chosen scale between the first and last bin
+    double lo = to_scale(bin_width * idx_lo, log_spaced), hi = to_scale(bin_width * (idx_hi - 1), log_spaced);
+    std::vector<double> edges(bands + 2);
+    for (unsigned int i = 0; i < bands + 2; ++i) {
+        edges[i] = from_scale(lo + (hi - lo) * static_cast<double>(i) / static_cast<double>(bands + 1), log_spaced);
+    }
+    
+    for (unsigned int b = 0; b < bands; ++b) {
+        const double left = edges[b], center = edges[b + 1], right = edges[b + 2];
+        
+        // triangle with peak 1 at the center
+        unsigned int start = _length_input, end = 0;
+        std::vector<float> w(_length_input);
+        for (unsigned int i = 0; i < _length_input; ++i) {
+            double f = bin_width * (idx_lo + i);
+            double v = 0.;
+            if (f > left && f <= center) {
+                v = (f - left) / (center - left);
+            }
+            else if (f > center && f < right) {
+                v = (right - f) / (right - center);
+            }
+            
+            if (v > 0.) {
+                w[i] = static_cast<float>(v);
+                if (i < start) start = i;
+                end = i + 1;
+            }
+        }
+        
+        // narrower than a bin (low bands), use the closest bin
+        if (end == 0) {
+            double pos = center / bin_width - idx_lo;
+            start = static_cast<unsigned int>(std::min(std::max(floor(pos + 0.5), 0.), static_cast<double>(_length_input - 1)));
+            end = start + 1;
+            w[start] = 1.f;
+        }
+        
+        _band_start[b] = start;
+        _band_length[b] = end - start;
+        _band_offset[b] = static_cast<unsigned int>(_weights.size());
+        _weights.insert(_weights.end(), w.begin() + start, w.begin() + end);
+    }
+}
+
+FilterBank::~FilterBank() {
+    
+}
+
+float FilterBank::GetWeight(unsigned int band, unsigned int bin) {
+    if (band >= _bands || bin < _band_start[band] || bin >= _band_start[band] + _band_length[band]) {
+        return 0.f;
+    }
+    return _weights[_band_offset[band] + bin - _band_start[band]];
+}
+
+void FilterBank::Apply(const float *input, float *output) {
+    const float *weights = &_weights[0];
+    for (unsigned int b = 0; b < _bands; ++b) {
+        const float *x = input + _band_start[b], *w = weights + _band_offset[b];
+        float sum = 0.f;
+        for (unsigned int i = 0, n = _band_length[b]; i < n; ++i) {
+            sum += w[i] * x[i];
+        }
+        output[b] = sum;
+    }
+    
+    // log compression (vectorized over bands, zero padded tail)
+    if (_log_power) {
+        unsigned int b = 0;
+        for (; b + SIMD_WIDTH <= _bands; b += SIMD_WIDTH) {
+            simd_store(output + b, simd_log1p(simd_load(output + b)));
+        }
+        if (b < _bands) {
+            float tail[SIMD_WIDTH] = {0};
+            for (unsigned int i = b; i < _bands; ++i) tail[i - b] = output[i];
+            simd_store(tail, simd_log1p(simd_load(tail)));
+            for (unsigned int i = b; i < _bands; ++i) output[i] = tail[i - b];
+        }
+    }
+}
+
+void FilterBank::Apply(const float *input, float *output, unsigned int columns) {
+    for (unsigned int c = 0; c < columns; ++c) {
+        Apply(input + c * _length_input, output + c * _bands);
+    }
+}
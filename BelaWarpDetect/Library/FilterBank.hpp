@@ -0,0 +1,48 @@
+//
+//  FilterBank.hpp
+//  BelaWarpDetect
+//
+
+#ifndef FilterBank_hpp
+#define FilterBank_hpp
+
+#include <stdio.h>
+#include <vector>
+
+/// Reduces a column of linear frequency bins to a smaller number of triangular bands, spaced evenly
+/// on the mel (or log frequency) scale. Each band only stores the weights for the bins it covers, so
+/// applying the filter bank costs about two multiply adds per input bin.
+class FilterBank
+{
+public:
+    // input is bins idx_lo through idx_hi - 1, each bin_width Hz apart (sample rate / FFT length)
+    FilterBank(unsigned int bands, unsigned int idx_lo, unsigned int idx_hi, float bin_width, bool log_spaced = false);
+    ~FilterBank();
+    
+    unsigned int GetLengthInput() { return _length_input; }
+    unsigned int GetLengthOutput() { return _bands; }
+    
+    // log compression of the band energies: log(1 + x)
+    void SetLogPower(bool log_power) { _log_power = log_power; }
+    bool GetLogPower() { return _log_power; }
+    
+    // apply to a single column, or to `columns` columns stored one after another
+    void Apply(const float *input, float *output);
+    void Apply(const float *input, float *output, unsigned int columns);
+    
+    // weight of input bin `bin` in band `band` (mostly for testing)
+    float GetWeight(unsigned int band, unsigned int bin);
+
+private:
+    unsigned int _bands;
+    unsigned int _length_input;
+    bool _log_power = false;
+    
+    // sparse weights: band b covers inputs _band_start[b] onward, weights start at _band_offset[b]
+    std::vector<unsigned int> _band_start;
+    std::vector<unsigned int> _band_length;
+    std::vector<unsigned int> _band_offset;
+    std::vector<float> _weights;
+};
+
+#endif /* FilterBank_hpp */
@@ -0,0 +1,114 @@
+//
+//  FixedPointFourierTransform.cpp
+//  BelaWarpDetect
+//
+
+#include "FixedPointFourierTransform.hpp"
+
+#include <cmath>
+#include <stdexcept>
+
+static inline int32_t to_q30(double v) {
+    return static_cast<int32_t>(floor(v * 1073741824.0 + 0.5));
+}
+
+// (a * b) / 2^30, rounded
+static inline int64_t mul_q30(int64_t a, int32_t b) {
+    return (a * b + (1ll << 29)) >> 30;
+}
+
+FixedPointFourierTransform::FixedPointFourierTransform(unsigned int length) :
+_length(length),
+_length_half(length / 2),
+_stage_real(length > 2 ? length / 2 : 1),
+_stage_imag(length > 2 ? length / 2 : 1),
+_unpack_cos(length / 2 + 1),
+_unpack_sin(length / 2 + 1),
+_work_real(length / 2),
+_work_imag(length / 2),
+_temp_real(length / 2),
+_temp_imag(length / 2) {
+    // require power of two, small enough that values (up to 2^15 * length) fit in 32 bits
+    if (length < 2 || (length & (length - 1)) != 0 || length > 32768) {
+        throw std::invalid_argument("length must be a power of two, no larger than 32768");
+    }
+    
+    // stage twiddles: stage with sub-length n uses exp(-2 pi i p / n) for p < n / 2
+    unsigned int offset = 0;
+    for (unsigned int n = _length_half; n > 1; n >>= 1) {
+        for (unsigned int p = 0; p < n / 2; ++p) {
+            double theta = 2.0 * M_PI * static_cast<double>(p) / static_cast<double>(n);
+            _stage_real[offset + p] = to_q30(cos(theta));
+            _stage_imag[offset + p] = to_q30(-sin(theta));
+        }
+        offset += n / 2;
+    }
+    
+    // unpack twiddles: exp(-2 pi i k / length) for k <= length / 2
+    for (unsigned int k = 0; k <= _length_half; ++k) {
+        double theta = 2.0 * M_PI * static_cast<double>(k) / static_cast<double>(_length);
+        _unpack_cos[k] = to_q30(cos(theta));
+        _unpack_sin[k] = to_q30(sin(theta));
+    }
+}
+
+FixedPointFourierTransform::~FixedPointFourierTransform() {
+    
+}
+
+void FixedPointFourierTransform::Forward(const int16_t *input, int32_t *out_real, int32_t *out_imag, unsigned int bin_lo, unsigned int bin_hi) {
+    // pack even samples as real, odd samples as imaginary
+    int32_t *src_r = _work_real.ptr(), *src_i = _work_imag.ptr();
+    int32_t *dst_r = _temp_real.ptr(), *dst_i = _temp_imag.ptr();
+    for (unsigned int k = 0; k < _length_half; ++k) {
+        src_r[k] = input[2 * k];
+        src_i[k] = input[2 * k + 1];
+    }
+    
+    // stockham radix-2 (same ordering as FastFourierTransform)
+    const int32_t *tw_r = _stage_real.ptr(), *tw_i = _stage_imag.ptr();
+    for (unsigned int n = _length_half, s = 1; n > 1; n >>= 1, s <<= 1) {
+        const unsigned int m = n / 2;
+        for (unsigned int p = 0; p < m; ++p) {
+            const int32_t wr = tw_r[p], wi = tw_i[p];
+            for (unsigned int q = 0; q < s; ++q) {
+                const int32_t a_r = src_r[q + s * p], a_i = src_i[q + s * p];
+                const int32_t b_r = src_r[q + s * (p + m)], b_i = src_i[q + s * (p + m)];
+                
+                dst_r[q + s * (2 * p)] = a_r + b_r;
+                dst_i[q + s * (2 * p)] = a_i + b_i;
+                
+                const int64_t d_r = static_cast<int64_t>(a_r) - b_r, d_i = static_cast<int64_t>(a_i) - b_i;
+                dst_r[q + s * (2 * p + 1)] = static_cast<int32_t>(mul_q30(d_r, wr) - mul_q30(d_i, wi));
+                dst_i[q + s * (2 * p + 1)] = static_cast<int32_t>(mul_q30(d_r, wi) + mul_q30(d_i, wr));
+            }
+        }
+        
+        // advance twiddles
+        tw_r += m;
+        tw_i += m;
+        
+        // swap buffers
+        int32_t *t;
+        t = src_r; src_r = dst_r; dst_r = t;
+        t = src_i; src_i = dst_i; dst_i = t;
+    }
+    
+    // unpack: X[k] = E[k] + exp(-2 pi i k / N) O[k] (halving folded into the final shift)
+    const int32_t *z_r = src_r, *z_i = src_i;
+    for (unsigned int k = bin_lo; k < bin_hi; ++k) {
+        if (k == 0 || k == _length_half) {
+            // purely real terms
+            out_real[k - bin_lo] = (k == 0 ? z_r[0] + z_i[0] : z_r[0] - z_i[0]);
+            out_imag[k - bin_lo] = 0;
+            continue;
+        }
+        
+        const unsigned int j = _length_half - k;
+        const int64_t s_r = static_cast<int64_t>(z_r[k]) + z_r[j], d_r = static_cast<int64_t>(z_r[k]) - z_r[j];
+        const int64_t s_i = static_cast<int64_t>(z_i[k]) + z_i[j], d_i = static_cast<int64_t>(z_i[k]) - z_i[j];
+        const int32_t c = _unpack_cos[k], s = _unpack_sin[k];
+        out_real[k - bin_lo] = static_cast<int32_t>((s_r + mul_q30(s_i, c) - mul_q30(d_r, s) + 1) >> 1);
+        out_imag[k - bin_lo] = static_cast<int32_t>((d_i - mul_q30(d_r, c) - mul_q30(s_i, s) + 1) >> 1);
+    }
+}
@@ -0,0 +1,52 @@
+//
+//  FixedPointFourierTransform.hpp
+//  BelaWarpDetect
+//
+
+#ifndef FixedPointFourierTransform_hpp
+#define FixedPointFourierTransform_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "ManagedMemory.hpp"
+
+/// Integer-only real-input FFT for cores without a (fast) floating point unit. Input is Q15 (int16,
+/// 1.0 = 32768), the transform runs on 32-bit values with Q30 twiddles and 64-bit products, so no
+/// per-stage scaling is needed (values grow by at most the length, up to 32768) and the output keeps
+/// the input scale: out / 32768 matches the unscaled float transform. Same packing as
+/// FastFourierTransform.
+class FixedPointFourierTransform
+{
+public:
+    FixedPointFourierTransform(unsigned int length);
+    ~FixedPointFourierTransform();
+    
+    unsigned int GetLength() { return _length; }
+    unsigned int GetLengthOutput() { return _length_half + 1; }
+    
+    // forward transform, producing bins [bin_lo, bin_hi) in split format (written to out[0] onward)
+    void Forward(const int16_t *input, int32_t *out_real, int32_t *out_imag, unsigned int bin_lo, unsigned int bin_hi);
+
+private:
+    // prevent copying
+    FixedPointFourierTransform(const FixedPointFourierTransform &);
+    const FixedPointFourierTransform &operator=(const FixedPointFourierTransform &);
+    
+    unsigned int _length;
+    unsigned int _length_half;
+    
+    // Q30 twiddles for each stockham stage (stored back to back) and for unpacking
+    ManagedMemory<int32_t> _stage_real;
+    ManagedMemory<int32_t> _stage_imag;
+    ManagedMemory<int32_t> _unpack_cos;
+    ManagedMemory<int32_t> _unpack_sin;
+    
+    // ping pong work buffers
+    ManagedMemory<int32_t> _work_real;
+    ManagedMemory<int32_t> _work_imag;
+    ManagedMemory<int32_t> _temp_real;
+    ManagedMemory<int32_t> _temp_imag;
+};
+
+#endif /* FixedPointFourierTransform_hpp */
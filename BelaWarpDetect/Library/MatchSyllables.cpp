@@ -10,19 +10,110 @@
 #include "LoadAudio.hpp"
 #include "ManagedMemory.hpp"
 
+#include <algorithm>
 #include <cmath>
 
-MatchSyllables::MatchSyllables(float sample_rate) :
+MatchSyllables::MatchSyllables(float sample_rate, unsigned int filter_bands, unsigned int buffer_length) :
 _sample_rate(sample_rate),
+_buffer_length(buffer_length),
 _stft(_window_length, _window_stride, _buffer_length),
 _idx_lo(_stft.ConvertFrequencyToIndex(_freq_lo, _sample_rate)),
 _idx_hi(_stft.ConvertFrequencyToIndex(_freq_hi, _sample_rate)),
-_features(_stft.GetLengthPower()) {
+_filter_bank(filter_bands > 0 ? new FilterBank(filter_bands, _idx_lo, _idx_hi, _stft.ConvertIndexToFrequency(1, _sample_rate)) : nullptr),
+_length_features(filter_bands > 0 ? filter_bands : _idx_hi - _idx_lo),
+_features(_length_features),
+_features_batch(_batch_columns * _length_features),
+_power(_idx_hi - _idx_lo),
+_power_batch(filter_bands > 0 ? _batch_columns * (_idx_hi - _idx_lo) : 0),
+_bank(_length_features) {
     _stft.SetWindowHanning();
+    _stft.SetSlidingDFT(_sliding_dft);
+    
+    // log compression happens last (after the filter bank, if any)
+    if (_filter_bank) {
+        _filter_bank->SetLogPower(_log_power);
+    }
+    else {
+        _stft.SetLogPower(_log_power);
+    }
 }
 
 MatchSyllables::~MatchSyllables() {
+    delete _filter_bank;
+}
+
+bool MatchSyllables::SetTemplateStorage(TemplateStorage storage) {
+    // can not change once templates are stored
+    if (_initialized || !_dtms.empty()) {
+        return false;
+    }
+    
+    _template_storage = storage;
+    _bank = TemplateBank(_length_features, storage);
+    
+    return true;
+}
+
+bool MatchSyllables::SetPruning(bool prune) {
+    if (_initialized) {
+        return false;
+    }
+    
+    _prune = prune;
+    
+    return true;
+}
+
+bool MatchSyllables::SetPrefixSharing(bool share_prefixes) {
+    if (_initialized) {
+        return false;
+    }
+    
+    _share_prefixes = share_prefixes;
+    
+    return true;
+}
+
+bool MatchSyllables::SetTemplateRank(size_t rank) {
+    if (_initialized || rank > _length_features) {
+        return false;
+    }
+    
+    _template_rank = rank;
+    
+    return true;
+}
+
+bool MatchSyllables::FetchRankTradeoff(std::vector<float> &energy, std::vector<float> &error) {
+    if (_dtms.empty()) {
+        return false;
+    }
     
+    _bank.GetRankTradeoff(energy, error);
+    
+    return true;
+}
+
+bool MatchSyllables::SetCoarseToFine(unsigned int decimation, float margin) {
+    // templates are decimated as they are added
+    if (_initialized || !_dtms.empty() || decimation == 0) {
+        return false;
+    }
+    
+    _decimation = decimation;
+    _coarse_margin = margin;
+    
+    return true;
+}
+
+bool MatchSyllables::SetLengthBand(bool length_band) {
+    if (_initialized) {
+        return false;
+    }
+    
+    _length_band = length_band;
+    
+    return true;
 }
 
 void MatchSyllables::SetCallbackMatch(void (*cb)(size_t, float, int)) {
@@ -34,18 +125,89 @@ void MatchSyllables::SetCallbackColumn(void (*cb)(std::vector<float>, std::vecto
 }
 
 bool MatchSyllables::_ReadFeatures(std::vector<float> &features) {
-    if (!_stft.ReadPower(features)) {
+    // only the band of interest is calculated (log compression, if enabled, is done by the STFT)
+    if (!_filter_bank) {
+        return _stft.ReadPower(features, _idx_lo, _idx_hi);
+    }
+    
+    // reduce to filter bank
+    if (!_stft.ReadPower(&_power[0], _idx_lo, _idx_hi)) {
         return false;
     }
+    features.resize(_length_features);
+    _filter_bank->Apply(&_power[0], &features[0]);
+    
+    return true;
+}
+
+unsigned int MatchSyllables::_ReadFeatureBatch() {
+    // only the band of interest is calculated (log compression, if enabled, is done by the STFT)
+    if (!_filter_bank) {
+        return _stft.ReadPowerBatch(&_features_batch[0], _batch_columns, _idx_lo, _idx_hi);
+    }
     
-    // log?
-    if (_log_power) {
-        // potentially only calculate log within indices of interest
-        for (auto it = features.begin(); it != features.end(); ++it) {
-            *it = log(1.f + *it);
+    // reduce to filter bank
+    unsigned int columns = _stft.ReadPowerBatch(&_power_batch[0], _batch_columns, _idx_lo, _idx_hi);
+    _filter_bank->Apply(&_power_batch[0], &_features_batch[0], columns);
+    
+    return columns;
+}
+
+void MatchSyllables::_AddToBank(struct ms_dtm &m, const float *tmpl) {
+    if (_decimation > 1) {
+        // average each group of columns (the last can be shorter)
+        const size_t length = m.dtm.GetLength(), coarse_length = (length + _decimation - 1) / _decimation;
+        std::vector<float> pooled(coarse_length * _length_features, 0.f);
+        for (size_t k = 0; k < coarse_length; ++k) {
+            const size_t first = k * _decimation, last = std::min(first + _decimation, length);
+            for (size_t i = first; i < last; ++i) {
+                for (size_t j = 0; j < _length_features; ++j) {
+                    pooled[k * _length_features + j] += tmpl[i * _length_features + j];
+                }
+            }
+            for (size_t j = 0; j < _length_features; ++j) {
+                pooled[k * _length_features + j] /= static_cast<float>(last - first);
+            }
+        }
+        
+        m.coarse.reset(new DynamicTimeMatcher(&pooled[0], coarse_length, _length_features, _template_storage));
+        ms_dtm::SetAlphaProfile(*m.coarse);
+        m.pre_threshold = m.threshold - _coarse_margin;
+        
+        // longest path within the length constraint, plus the columns the coarse matcher lags by
+        m.replay = static_cast<size_t>(ceil(static_cast<float>(length) + m.threshold_length)) + _decimation;
+        _recent_columns = std::max(_recent_columns, m.replay);
+        
+        // only the coarse templates are shared (full resolution matchers use their own)
+        m.bank_offset = _bank.AddTemplate(m.coarse->GetTemplate());
+    }
+    else {
+        m.bank_offset = _bank.AddTemplate(m.dtm.GetTemplate());
+    }
+    _costs.resize(_bank.GetLength());
+    _costs_batch.resize(_batch_columns * _bank.GetLength());
+}
+
+void MatchSyllables::_AddToBank(struct ms_dtm &m, const std::vector<std::vector<float>> &tmpl) {
+    std::vector<float> flat;
+    if (_decimation > 1) {
+        for (size_t i = 0; i < tmpl.size(); ++i) {
+            flat.insert(flat.end(), tmpl[i].begin(), tmpl[i].end());
         }
     }
     
+    _AddToBank(m, flat.data());
+}
+
+bool MatchSyllables::_ConvertSpectrogram(const float *spect, size_t length, size_t features, std::vector<float> &converted) {
+    // only band power can be converted
+    if (!_filter_bank || features != _filter_bank->GetLengthInput() || length == 0) {
+        return false;
+    }
+    
+    converted.resize(length * _length_features);
+    _filter_bank->Apply(spect, &converted[0], static_cast<unsigned int>(length));
+    
     return true;
 }
 
@@ -67,12 +229,13 @@ int MatchSyllables::AddSyllable(const std::vector<float> &audio, float threshold
     // read in template
     std::vector<float> col;
     while (_ReadFeatures(col)) {
-        tmpl.push_back(std::vector<float>(col.begin() + _idx_lo, col.begin() + _idx_hi));
+        tmpl.push_back(col);
     }
     
     // add at end
     size_t index = _next_index++;
-    _dtms.emplace_back(index, tmpl, threshold, constrain_length * static_cast<float>(tmpl.size()));
+    _dtms.emplace_back(index, tmpl, threshold, constrain_length * static_cast<float>(tmpl.size()), _template_storage);
+    _AddToBank(_dtms.back(), tmpl);
     
     return static_cast<int>(index);
 }
@@ -98,27 +261,45 @@ int MatchSyllables::AddSyllable(const std::string file, float threshold, float c
 }
 
 int MatchSyllables::AddSpectrogram(const std::vector<std::vector<float>> &spect, float threshold, float constrain_length) {
+    // band power, pass through the filter bank
+    if (!spect.empty() && _length_features != spect[0].size()) {
+        std::vector<std::vector<float>> converted(spect.size(), std::vector<float>(_length_features));
+        for (size_t i = 0; i < spect.size(); ++i) {
+            if (!_ConvertSpectrogram(&spect[i][0], 1, spect[i].size(), converted[i])) {
+                return -1;
+            }
+        }
+        return AddSpectrogram(converted, threshold, constrain_length);
+    }
+    
     // invalid feature length
-    if ((_idx_hi - _idx_lo) != spect[0].size()) {
+    if (spect.empty() || _length_features != spect[0].size()) {
         return -1;
     }
     
     // add at end
     size_t index = _next_index++;
-    _dtms.emplace_back(index, spect, threshold, constrain_length * static_cast<float>(spect.size()));
+    _dtms.emplace_back(index, spect, threshold, constrain_length * static_cast<float>(spect.size()), _template_storage);
+    _AddToBank(_dtms.back(), spect);
     
     return static_cast<int>(index);
 }
 
 int MatchSyllables::AddSpectrogram(const float *spect, size_t length, size_t features, float threshold, float constrain_length) {
-    // invalid feature length
-    if ((_idx_hi - _idx_lo) != features) {
-        return -1;
+    // band power, pass through the filter bank
+    std::vector<float> converted;
+    if (_length_features != features) {
+        if (!_ConvertSpectrogram(spect, length, features, converted)) {
+            return -1;
+        }
+        spect = &converted[0];
+        features = _length_features;
     }
     
     // add at end
     size_t index = _next_index++;
-    _dtms.emplace_back(index, spect, length, features, threshold, constrain_length * static_cast<float>(length));
+    _dtms.emplace_back(index, spect, length, features, threshold, constrain_length * static_cast<float>(length), _template_storage);
+    _AddToBank(_dtms.back(), spect);
     
     return static_cast<int>(index);
 }
@@ -135,30 +316,94 @@ int MatchSyllables::AddSpectrogram(const std::string file, float threshold, floa
     size_t file_length = ftell(fh);
     rewind(fh);
     
-    // calculate size
-    size_t features = _idx_hi - _idx_lo;
-    size_t length = file_length / sizeof(float) / features;
-    size_t total = features * length;
-    if (file_length != total * sizeof(float)) {
+    // calculate size (files contain band power, as written by output_template.m, or features); with
+    // a filter bank, a size that fits both is rejected rather than guessed
+    const size_t band = _idx_hi - _idx_lo;
+    size_t total = file_length / sizeof(float);
+    bool is_band = total % band == 0, is_features = total % _length_features == 0;
+    if (file_length != total * sizeof(float) || total == 0 || !(is_band || is_features) || (_filter_bank && is_band && is_features)) {
+        fclose(fh);
         return -1;
     }
+    size_t features = is_band ? band : _length_features;
+    size_t length = total / features;
     
     // read file
     ManagedMemory<float> buffer(total);
     if (total != fread(static_cast<void *>(buffer.ptr()), sizeof(float), total, fh)) {
+        fclose(fh);
         return -1;
     }
     
     // close file
     fclose(fh);
     
+    return AddSpectrogram(buffer.ptr(), length, features, threshold, constrain_length);
+}
+
+int MatchSyllables::AddSpectrogram(const float *spect, const float *weights, size_t length, size_t features, float threshold, float constrain_length, float weight_cutoff) {
+    // weights are per feature, so no filter bank conversion
+    if (_length_features != features || length == 0) {
+        return -1;
+    }
+    
+    // every column needs an active bin (see TemplateBank::AddTemplate)
+    for (size_t i = 0; i < length; ++i) {
+        const float *weight = weights + i * features;
+        if (std::find_if(weight, weight + features, [weight_cutoff](float w) { return w > 0.f && w >= weight_cutoff; }) == weight + features) {
+            return -1;
+        }
+    }
+    
     // add at end
     size_t index = _next_index++;
-    _dtms.emplace_back(index, buffer.ptr(), length, features, threshold, constrain_length * static_cast<float>(length));
+    _dtms.emplace_back(index, spect, weights, length, features, weight_cutoff, threshold, constrain_length * static_cast<float>(length), _template_storage);
+    _AddToBank(_dtms.back(), spect);
     
     return static_cast<int>(index);
 }
 
+int MatchSyllables::AddSpectrogram(const std::string file, const std::string weights_file, float threshold, float constrain_length, float weight_cutoff) {
+    // read both files (features, as written by output_template.m)
+    std::vector<float> values[2];
+    const std::string files[2] = {file, weights_file};
+    for (size_t k = 0; k < 2; ++k) {
+        FILE *fh;
+        fh = fopen(files[k].c_str(), "r");
+        if (!fh) {
+            return -1;
+        }
+        
+        // obtain file size:
+        fseek(fh, 0, SEEK_END);
+        size_t file_length = ftell(fh);
+        rewind(fh);
+        
+        size_t total = file_length / sizeof(float);
+        if (file_length != total * sizeof(float) || total % _length_features != 0) {
+            fclose(fh);
+            return -1;
+        }
+        
+        // read file
+        values[k].resize(total);
+        if (total != fread(static_cast<void *>(values[k].data()), sizeof(float), total, fh)) {
+            fclose(fh);
+            return -1;
+        }
+        
+        // close file
+        fclose(fh);
+    }
+    
+    // same size
+    if (values[0].size() != values[1].size()) {
+        return -1;
+    }
+    
+    return AddSpectrogram(values[0].data(), values[1].data(), values[0].size() / _length_features, _length_features, threshold, constrain_length, weight_cutoff);
+}
+
 bool MatchSyllables::Initialize() {
     if (_initialized) {
         return false;
@@ -167,6 +412,84 @@ bool MatchSyllables::Initialize() {
         return false;
     }
     
+    // thresholds for pruning and length constraints
+    for (auto it = _dtms.begin(); it != _dtms.end(); ++it) {
+        it->dtm.SetThreshold(_prune ? it->threshold : 0.f);
+        it->dtm.SetLengthConstraint(_length_band ? it->threshold_length : 0.f);
+        if (it->coarse) {
+            it->coarse->SetThreshold(_prune ? it->pre_threshold : 0.f);
+        }
+    }
+    
+    // shared prefixes, then a bank of the rows after them (the full resolution matchers of
+    // coarse-to-fine matching use their own templates)
+    if (_share_prefixes && _decimation == 1) {
+        std::vector<struct ms_dtm *> group;
+        for (auto it = _dtms.begin(); it != _dtms.end(); ++it) {
+            group.push_back(&*it);
+        }
+        _prefixes.reserve(_dtms.size()); // every prefix splits, so fewer than one per syllable
+        _SharePrefixes(group, 0, nullptr);
+    }
+    if (!_prefixes.empty()) {
+        _bank = TemplateBank(_length_features, _template_storage);
+        for (auto it = _prefixes.begin(); it != _prefixes.end(); ++it) {
+            it->bank_offset = _bank.AddTemplate(it->dtm.GetTemplate(), it->dtm.GetPrefix(), it->dtm.GetLength() - it->dtm.GetPrefix());
+        }
+        for (auto it = _dtms.begin(); it != _dtms.end(); ++it) {
+            it->bank_offset = _bank.AddTemplate(it->dtm.GetTemplate(), it->dtm.GetPrefix(), it->dtm.GetLength() - it->dtm.GetPrefix());
+        }
+        _costs.resize(_bank.GetLength());
+        _costs_batch.resize(_batch_columns * _bank.GetLength());
+        
+        // a slot for each syllable below
+        for (auto it = _dtms.begin(); it != _dtms.end(); ++it) {
+            for (struct ms_prefix *p = it->prefix; p; p = p->parent) {
+                p->slots.push_back(p->dtm);
+                p->parent_slot.push_back(0);
+                p->users.push_back(0);
+                p->out.push_back(dtm_out());
+            }
+        }
+    }
+    
+    // low rank basis, fitted to the rows in the bank
+    _bank.SetRank(_template_rank);
+    
+    // DPP state of all matchers in one arena, in the order they are updated
+    size_t state_size = 0;
+    for (auto it = _prefixes.begin(); it != _prefixes.end(); ++it) {
+        state_size += it->slots.size() * it->dtm.GetStateSize();
+    }
+    for (auto it = _dtms.begin(); it != _dtms.end(); ++it) {
+        state_size += it->dtm.GetStateSize() + (it->coarse ? it->coarse->GetStateSize() : 0);
+    }
+    _state.assign((state_size + DTM_STATE_ALIGN) / sizeof(float), 0.f);
+    char *state = reinterpret_cast<char *>(_state.data());
+    state += (DTM_STATE_ALIGN - reinterpret_cast<uintptr_t>(state) % DTM_STATE_ALIGN) % DTM_STATE_ALIGN;
+    for (auto it = _prefixes.begin(); it != _prefixes.end(); ++it) {
+        for (auto slot = it->slots.begin(); slot != it->slots.end(); ++slot) {
+            slot->SetState(state);
+            state += slot->GetStateSize();
+        }
+    }
+    for (auto it = _dtms.begin(); it != _dtms.end(); ++it) {
+        if (it->coarse) {
+            it->coarse->SetState(state);
+            state += it->coarse->GetStateSize();
+        }
+    }
+    for (auto it = _dtms.begin(); it != _dtms.end(); ++it) {
+        it->dtm.SetState(state);
+        state += it->dtm.GetStateSize();
+    }
+    
+    // coarse-to-fine buffers
+    if (_decimation > 1) {
+        _pooled.assign(_length_features, 0.f);
+        _recent.assign(_recent_columns * _length_features, 0.f);
+    }
+    
     // set initialize
     _initialized = true;
     
@@ -182,10 +505,26 @@ void MatchSyllables::Reset() {
         _stft.Clear();
         
         // flush matches
+        for (auto it = _prefixes.begin(); it != _prefixes.end(); ++it) {
+            std::fill(it->users.begin(), it->users.end(), 0);
+        }
         for (auto it = _dtms.begin(); it != _dtms.end(); ++it) {
             it->dtm.Reset();
             it->last_score = 0.f;
+            if (it->prefix) {
+                it->prefix_slot = _AcquirePrefix(it->prefix);
+            }
+            if (it->coarse) {
+                it->coarse->Reset();
+                it->hold = 0;
+            }
         }
+        _MergePrefixes();
+        
+        // flush coarse-to-fine buffers
+        std::fill(_pooled.begin(), _pooled.end(), 0.f);
+        _pooled_columns = 0;
+        _column = 0;
     }
 }
 
@@ -202,6 +541,19 @@ bool MatchSyllables::IngestAudio(const float *audio, const unsigned int len, con
     return true;
 }
 
+bool MatchSyllables::IngestAudio(const int16_t *audio, const unsigned int len, const unsigned int stride) {
+    if (!_initialized) {
+        return false;
+    }
+    
+    // ingest values
+    if (!_stft.WriteValues(audio, len, stride)) {
+        return false;
+    }
+    
+    return true;
+}
+
 bool MatchSyllables::IngestAudio(const std::vector<float> &audio) {
     if (!_initialized) {
         return false;
@@ -221,41 +573,289 @@ bool MatchSyllables::MatchOnce(float *score, int *len) {
         return false;
     }
     
+    _MatchColumn(&_features[0], score, len);
+    
+    return true;
+}
+
+bool MatchSyllables::MatchPower(const float *power, float *score, int *len) {
+    if (!_initialized) {
+        return false;
+    }
+    
+    // convert to features
+    if (_filter_bank) {
+        _filter_bank->Apply(power, &_features[0]);
+    }
+    else if (_log_power) {
+        for (size_t i = 0; i < _length_features; ++i) {
+            _features[i] = log1pf(power[i]);
+        }
+    }
+    else {
+        _MatchColumn(power, score, len);
+        return true;
+    }
+    
+    _MatchColumn(&_features[0], score, len);
+    
+    return true;
+}
+
+void MatchSyllables::_MatchColumn(const float *features, float *score, int *len) {
+    if (_decimation > 1) {
+        _MatchCoarseToFine(features, score, len);
+        return;
+    }
+    
+    // costs against every template at once
+    _bank.CalculateCosts(features, _costs.data());
+    
+    _MatchCosts(_costs.data(), score, len);
+}
+
+float MatchSyllables::_SharePrefixes(std::vector<struct ms_dtm *> &group, size_t depth, struct ms_prefix *parent) {
+    float bound = 0.f;
+    
+    std::vector<struct ms_dtm *> rest, shared;
+    while (!group.empty()) {
+        // syllables sharing more rows with the first one (each keeps at least one row of its own,
+        // and the length band must match)
+        struct ms_dtm *first = group[0];
+        size_t shared_depth = first->dtm.GetLength() - 1;
+        shared.clear();
+        rest.clear();
+        for (size_t k = 0; k < group.size(); ++k) {
+            struct ms_dtm *m = group[k];
+            size_t common = std::min(first->dtm.CommonPrefix(m->dtm), std::min(first->dtm.GetLength(), m->dtm.GetLength()) - 1);
+            if (common > depth && (!_length_band || m->threshold_length == first->threshold_length)) {
+                shared.push_back(m);
+                shared_depth = std::min(shared_depth, common);
+            }
+            else {
+                rest.push_back(m);
+            }
+        }
+        group.swap(rest);
+        
+        // not shared any further, continue from the parent
+        if (shared.size() < 2) {
+            if (parent) {
+                first->prefix = parent;
+                first->dtm.SetPrefix(depth);
+            }
+            bound = std::max(bound, first->dtm.GetBound());
+            continue;
+        }
+        
+        // new prefix for the shared rows, with the same band and the loosest bound of those below
+        _prefixes.emplace_back(first->dtm, shared_depth, parent);
+        struct ms_prefix *prefix = &_prefixes.back();
+        if (parent) {
+            prefix->dtm.SetPrefix(depth);
+        }
+        if (_length_band) {
+            prefix->dtm.SetLengthConstraint(first->threshold_length);
+        }
+        
+        float shared_bound = _SharePrefixes(shared, shared_depth, prefix);
+        prefix->dtm.SetBound(shared_bound);
+        bound = std::max(bound, shared_bound);
+    }
+    
+    return bound;
+}
+
+size_t MatchSyllables::_AcquirePrefix(struct ms_prefix *prefix) {
+    // parent first
+    size_t parent_slot = prefix->parent ? _AcquirePrefix(prefix->parent) : 0;
+    
+    // a free slot (there is one per syllable below)
+    size_t slot = static_cast<size_t>(std::find(prefix->users.begin(), prefix->users.end(), 0) - prefix->users.begin());
+    prefix->slots[slot].Reset();
+    prefix->parent_slot[slot] = parent_slot;
+    prefix->users[slot] = 1;
+    
+    return slot;
+}
+
+void MatchSyllables::_ReleasePrefix(struct ms_prefix *prefix, size_t slot) {
+    for (; prefix; prefix = prefix->parent) {
+        --prefix->users[slot];
+        slot = prefix->parent_slot[slot];
+    }
+}
+
+void MatchSyllables::_MergePrefixes() {
+    // parents before children, so children of merged slots can merge as well
+    for (auto it = _prefixes.begin(); it != _prefixes.end(); ++it) {
+        for (size_t i = 0; i < it->slots.size(); ++i) {
+            if (it->users[i] == 0) {
+                continue;
+            }
+            for (size_t j = i + 1; j < it->slots.size(); ++j) {
+                if (it->users[j] == 0 || it->parent_slot[j] != it->parent_slot[i] || !it->slots[i].SameState(it->slots[j])) {
+                    continue;
+                }
+                
+                // move everything following slot j to slot i
+                it->users[i] += it->users[j];
+                it->users[j] = 0;
+                for (auto child = it + 1; child != _prefixes.end(); ++child) {
+                    if (child->parent != &*it) {
+                        continue;
+                    }
+                    for (size_t k = 0; k < child->slots.size(); ++k) {
+                        if (child->users[k] > 0 && child->parent_slot[k] == j) {
+                            child->parent_slot[k] = i;
+                        }
+                    }
+                }
+                for (auto m = _dtms.begin(); m != _dtms.end(); ++m) {
+                    if (m->prefix == &*it && m->prefix_slot == j) {
+                        m->prefix_slot = i;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void MatchSyllables::_MatchCosts(const float *costs, float *score, int *len) {
+    // shared prefixes first (parents before children)
+    for (auto it = _prefixes.begin(); it != _prefixes.end(); ++it) {
+        for (size_t k = 0; k < it->slots.size(); ++k) {
+            if (it->users[k] > 0) {
+                it->out[k] = it->parent ? it->slots[k].IngestCostVector(&costs[it->bank_offset], it->parent->out[it->parent_slot[k]]) : it->slots[k].IngestCostVector(&costs[it->bank_offset]);
+            }
+        }
+    }
+    
     for (auto it = _dtms.begin(); it != _dtms.end(); ++it) {
-        struct dtm_out out = it->dtm.IngestFeatureVector(&_features[_idx_lo]);
+        if (!it->prefix) {
+            _Detect(*it, it->dtm.IngestCostVector(&costs[it->bank_offset]), score, len);
+            continue;
+        }
+        
+        // after a match, paths through the prefix start over as well
+        if (_Detect(*it, it->dtm.IngestCostVector(&costs[it->bank_offset], it->prefix->out[it->prefix_slot]), score, len)) {
+            _ReleasePrefix(it->prefix, it->prefix_slot);
+            it->prefix_slot = _AcquirePrefix(it->prefix);
+        }
+    }
+    _MergePrefixes();
         
-        // was last time point below theshold, below length constraint and a local minimum?
-        if (it->last_score >= it->threshold && fabs(static_cast<float>(it->last_len)) < it-> threshold_length && out.normalized_score < it->last_score) {
-            // ALTERNATIVE:
-            //if (out.score >= _dtms[i].threshold && abs((float)out.len_diff) < _dtms[i].length) {
-            //}
+    _ReportColumn();
+}
             
-            // call match callback
-            if (_cb_match) {
-                // trigger callback
-                _cb_match(it->index, it->last_score, it->last_len);
+void MatchSyllables::_MatchCoarseToFine(const float *features, float *score, int *len) {
+    // keep the column, for starting full resolution matchers over
+    std::copy(features, features + _length_features, _recent.begin() + (_column % _recent_columns) * _length_features);
+    
+    // coarse matchers advance once per group of columns (on their average)
+    for (size_t j = 0; j < _length_features; ++j) {
+        _pooled[j] += features[j];
+    }
+    if (++_pooled_columns == _decimation) {
+        for (size_t j = 0; j < _length_features; ++j) {
+            _pooled[j] /= static_cast<float>(_decimation);
+        }
+        _bank.CalculateCosts(&_pooled[0], _costs.data());
+        
+        for (auto it = _dtms.begin(); it != _dtms.end(); ++it) {
+            struct dtm_out out = it->coarse->IngestCostVector(&_costs[it->bank_offset]);
+            if (out.normalized_score < it->pre_threshold) {
+                continue;
             }
             
-            // reset DTM? OR reset all?
-            it->dtm.Reset();
+            // activate: start over from the recent columns (any match ending from here on starts
+            // within them), then keep running until no crossing for as long; a match that ended
+            // within the replay is dropped rather than reported late
+            if (it->hold == 0) {
+                it->dtm.Reset();
+                it->last_score = 0.f;
+                it->last_len = 0;
+                for (unsigned long c = _column - std::min<unsigned long>(_column, it->replay - 1); c < _column; ++c) {
+                    _Detect(*it, it->dtm.IngestFeatureVector(&_recent[(c % _recent_columns) * _length_features]), NULL, NULL, false);
+                }
+            }
+            it->hold = it->replay;
+        }
+        
+        std::fill(_pooled.begin(), _pooled.end(), 0.f);
+        _pooled_columns = 0;
+    }
+    
+    // full resolution matchers, only while active
+    for (auto it = _dtms.begin(); it != _dtms.end(); ++it) {
+        if (it->hold > 0) {
+            _Detect(*it, it->dtm.IngestFeatureVector(features), score, len);
             
-            // zero out score to prevent double trigger
-            out.normalized_score = 0.f;
+            // stay active for the hold, and while a match could still trigger
+            if (--it->hold > 0) {
+                continue;
+            }
+            if (it->last_score >= it->pre_threshold) {
+                it->hold = 1;
+                continue;
+            }
         }
         
-        // populate arguments
+        // inactive (same as a pruned column)
+        it->last_score = 0.f;
+        it->last_len = -static_cast<int>(it->dtm.GetLength());
         if (score) {
-            score[it->index] = out.normalized_score;
+            score[it->index] = it->last_score;
         }
         if (len) {
-            len[it->index] = out.len_diff;
+            len[it->index] = it->last_len;
         }
+    }
+    
+    ++_column;
+    
+    _ReportColumn();
+}
+
+bool MatchSyllables::_Detect(struct ms_dtm &m, struct dtm_out out, float *score, int *len, bool report) {
+    bool matched = false;
+    
+    // was last time point below theshold, below length constraint and a local minimum?
+    if (m.last_score >= m.threshold && fabs(static_cast<float>(m.last_len)) < m.threshold_length && out.normalized_score < m.last_score) {
+        // ALTERNATIVE:
+        //if (out.score >= _dtms[i].threshold && abs((float)out.len_diff) < _dtms[i].length) {
+        //}
         
-        // store last
-        it->last_score = out.normalized_score;
-        it->last_len = out.len_diff;
+        // call match callback
+        if (_cb_match && report) {
+            // trigger callback
+            _cb_match(m.index, m.last_score, m.last_len);
+        }
+        
+        // reset DTM? OR reset all?
+        m.dtm.Reset();
+        
+        // zero out score to prevent double trigger
+        out.normalized_score = 0.f;
+        matched = true;
+    }
+    
+    // populate arguments
+    if (score) {
+        score[m.index] = out.normalized_score;
+    }
+    if (len) {
+        len[m.index] = out.len_diff;
     }
     
+    // store last
+    m.last_score = out.normalized_score;
+    m.last_len = out.len_diff;
+    
+    return matched;
+}
+
+void MatchSyllables::_ReportColumn() {
     // call at end of each column
     if (_cb_column) {
         std::vector<float> scores = std::vector<float>(_next_index);
@@ -266,12 +866,26 @@ bool MatchSyllables::MatchOnce(float *score, int *len) {
         }
         _cb_column(scores, lengths);
     }
-    
-    return true;
 }
 
 void MatchSyllables::PerformMatching() {
-    while (MatchOnce(NULL, NULL));
+    // read several columns per STFT call (transforms run side by side), calculate costs for all of
+    // them in one pass over the template bank, then match each in order
+    unsigned int columns;
+    while ((columns = _ReadFeatureBatch()) > 0) {
+        // the shared bank holds the coarse templates, full resolution matchers go column by column
+        if (_decimation > 1) {
+            for (unsigned int c = 0; c < columns; ++c) {
+                _MatchCoarseToFine(&_features_batch[c * _length_features], NULL, NULL);
+            }
+            continue;
+        }
+        
+        _bank.CalculateCosts(&_features_batch[0], columns, _costs_batch.data());
+        for (unsigned int c = 0; c < columns; ++c) {
+            _MatchCosts(&_costs_batch[c * _bank.GetLength()], NULL, NULL);
+        }
+    }
 }
 
 bool MatchSyllables::ZeroPadAndFetch(std::vector<float> &scores, std::vector<int> &lengths) {
@@ -297,3 +911,23 @@ bool MatchSyllables::ZeroPadAndFetch(std::vector<float> &scores, std::vector<int
     
     return true;
 }
+
+bool MatchSyllables::FetchPruneCounts(std::vector<unsigned long> &columns, std::vector<unsigned long> &pruned, std::vector<unsigned long> &rows) {
+    if (!_initialized) {
+        return false;
+    }
+    
+    // resize returns
+    columns.resize(_next_index);
+    pruned.resize(_next_index);
+    rows.resize(_next_index);
+    
+    // fill counts
+    for (auto it = _dtms.begin(); it != _dtms.end(); ++it) {
+        columns[it->index] = it->dtm.GetColumns();
+        pruned[it->index] = it->dtm.GetPrunedColumns();
+        rows[it->index] = it->dtm.GetUpdatedRows();
+    }
+    
+    return true;
+}
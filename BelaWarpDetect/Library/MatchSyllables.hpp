@@ -10,12 +10,32 @@
 #define MatchSyllables_hpp
 
 #include <stdio.h>
+#include <cmath>
 #include <string>
 #include <vector>
-#include <list>
+#include <memory>
 
 #include "CircularShortTimeFourierTransform.hpp"
 #include "DynamicTimeMatcher.hpp"
+#include "FilterBank.hpp"
+#include "TemplateBank.hpp"
+
+// template rows shared by several syllables (or prefix nodes), matched once for each set of
+// syllables last reset together (paths through the prefix must start after a syllable's reset)
+struct ms_prefix {
+    DynamicTimeMatcher dtm; // template for the slots
+    struct ms_prefix *parent; // shorter shared prefix, if any
+    size_t bank_offset; // first row (after the parent's) in the shared template bank
+    
+    // one slot per syllable below (at most that many sets); each follows a slot of the parent, and
+    // slots in the same state are merged
+    std::vector<DynamicTimeMatcher> slots;
+    std::vector<size_t> parent_slot;
+    std::vector<size_t> users; // syllables below using the slot (0 is free)
+    std::vector<struct dtm_out> out; // result for the current column
+    
+    ms_prefix(const DynamicTimeMatcher &tmpl, size_t length, struct ms_prefix *parent_) : dtm(tmpl, length), parent(parent_), bank_offset(0) {}
+};
 
 struct ms_dtm {
     size_t index;
@@ -24,23 +44,33 @@ struct ms_dtm {
     float threshold_length;
     float last_score;
     int last_len;
+    size_t bank_offset; // first row (after the prefix, if any) in the shared template bank
+    struct ms_prefix *prefix; // shared leading rows, if any
+    size_t prefix_slot; // reset along with this matcher
     
-    ms_dtm(size_t index_, const std::vector<std::vector<float>> &tmpl, float threshold_, float threshold_length_) : index(index_), dtm(tmpl), threshold(threshold_), threshold_length(threshold_length_), last_score(0.f), last_len(0) {
-        float a;
-        size_t dtm_length = dtm.GetLength();
-        std::vector<float> alpha(dtm_length);
-        for (size_t i = 0, maxi = (dtm_length / 2) + 1; i < maxi; ++i) {
-            a = 2.f + 1.f * pow(0.9f, static_cast<float>(i));
-            alpha[i] = a;
-            alpha[dtm_length - 1 - i] = a;
-        }
-        
-        dtm.SetAlpha(alpha);
+    // coarse-to-fine matching: a time decimated matcher, and the full resolution matcher only runs
+    // while `hold` > 0 (after starting over from the last `replay` columns)
+    std::unique_ptr<DynamicTimeMatcher> coarse;
+    float pre_threshold;
+    size_t replay;
+    size_t hold;
+    
+    ms_dtm(size_t index_, const std::vector<std::vector<float>> &tmpl, float threshold_, float threshold_length_, TemplateStorage storage = kTemplateFloat32) : index(index_), dtm(tmpl, storage), threshold(threshold_), threshold_length(threshold_length_), last_score(0.f), last_len(0), bank_offset(0), prefix(nullptr), prefix_slot(0), pre_threshold(0.f), replay(0), hold(0) {
+        SetAlphaProfile(dtm);
+    }
+    
+    ms_dtm(size_t index_, const float *tmpl, size_t length, size_t features, float threshold_, float threshold_length_, TemplateStorage storage = kTemplateFloat32) : index(index_), dtm(tmpl, length, features, storage), threshold(threshold_), threshold_length(threshold_length_), last_score(0.f), last_len(0), bank_offset(0), prefix(nullptr), prefix_slot(0), pre_threshold(0.f), replay(0), hold(0) {
+        SetAlphaProfile(dtm);
     }
     
-    ms_dtm(size_t index_, const float *tmpl, size_t length, size_t features, float threshold_, float threshold_length_) : index(index_), dtm(tmpl, length, features), threshold(threshold_), threshold_length(threshold_length_), last_score(0.f), last_len(0) {
+    ms_dtm(size_t index_, const float *tmpl, const float *weights, size_t length, size_t features, float weight_cutoff, float threshold_, float threshold_length_, TemplateStorage storage = kTemplateFloat32) : index(index_), dtm(tmpl, weights, length, features, weight_cutoff, storage), threshold(threshold_), threshold_length(threshold_length_), last_score(0.f), last_len(0), bank_offset(0), prefix(nullptr), prefix_slot(0), pre_threshold(0.f), replay(0), hold(0) {
+        SetAlphaProfile(dtm);
+    }
+    
+    // steps off the diagonal cost more in the middle of the template than at its ends
+    static void SetAlphaProfile(DynamicTimeMatcher &m) {
         float a;
-        size_t dtm_length = dtm.GetLength();
+        size_t dtm_length = m.GetLength();
         std::vector<float> alpha(dtm_length);
         for (size_t i = 0, maxi = (dtm_length / 2) + 1; i < maxi; ++i) {
             a = 2.f + 1.f * pow(0.9f, static_cast<float>(i));
@@ -48,23 +78,74 @@ struct ms_dtm {
             alpha[dtm_length - 1 - i] = a;
         }
         
-        dtm.SetAlpha(alpha);
+        m.SetAlpha(alpha);
     }
 };
 
 class MatchSyllables
 {
 public:
-    MatchSyllables(float sample_rate);
+    // filter_bands > 0 reduces each spectral column to that many mel bands before matching; the
+    // audio buffer can be small when all audio arrives as band power (MatchPower)
+    MatchSyllables(float sample_rate, unsigned int filter_bands = 0, unsigned int buffer_length = 2097152);
     ~MatchSyllables();
     
+    // number of values per feature column (spectrograms passed to AddSpectrogram can have either
+    // this many features, or one per STFT bin in the band when using a filter bank)
+    size_t GetLengthFeatures() { return _length_features; }
+    
+    // STFT parameters (hanning window), for producing band power elsewhere (e.g. with a
+    // MultiChannelShortTermFourierTransform shared by several matchers)
+    unsigned int GetWindowLength() { return _window_length; }
+    unsigned int GetWindowStride() { return _window_stride; }
+    unsigned int GetIndexLow() { return _idx_lo; }
+    unsigned int GetIndexHigh() { return _idx_hi; }
+    
     // returns a syllable ID, used when identifying
     int AddSyllable(const std::vector<float> &audio, float threshold, float constrain_length = 0.25f);
     int AddSyllable(const std::string file, float threshold, float constrain_length = 0.25f);
     
     int AddSpectrogram(const std::vector<std::vector<float>> &spect, float threshold, float constrain_length = 0.25f);
     int AddSpectrogram(const float *spect, size_t length, size_t features, float threshold, float constrain_length = 0.25f);
-    int AddSpectrogram(const std::string file, float threshold, float constrain_length = 0.25f);
+    int AddSpectrogram(const std::string file, float threshold, float constrain_length = 0.25f); // band power or features, told apart by size (with a filter bank, -1 if both fit)
+    
+    // with a weight for each value (as returned by build_template.m), used in the similarity; bins
+    // weighted below the cutoff are skipped (weights must match GetLengthFeatures() features, and
+    // every column needs a bin at or above the cutoff, otherwise returns -1)
+    int AddSpectrogram(const float *spect, const float *weights, size_t length, size_t features, float threshold, float constrain_length = 0.25f, float weight_cutoff = 0.f);
+    int AddSpectrogram(const std::string file, const std::string weights_file, float threshold, float constrain_length = 0.25f, float weight_cutoff = 0.f);
+    
+    // storage for template rows (see TemplateStorage), only before any syllables are added
+    bool SetTemplateStorage(TemplateStorage storage);
+    TemplateStorage GetTemplateStorage() { return _template_storage; }
+    
+    // skip template rows that can no longer reach a syllable's threshold (off by default; detections
+    // are unchanged, but scores below the threshold read as 0 in column callbacks, MatchOnce,
+    // MatchPower and ZeroPadAndFetch), only before initializing
+    bool SetPruning(bool prune);
+    
+    // enforce each syllable's length constraint inside the matcher (as a band on the warp) rather
+    // than only checking the length of the best path, only before initializing
+    bool SetLengthBand(bool length_band);
+    
+    // match leading template rows shared by several syllables (same rows and alpha, e.g. composites
+    // of a repeated syllable) once, as a trie (same results). After a syllable matches, its shared
+    // rows run separately until they reach the same state as those of the other syllables. Not
+    // combined with coarse-to-fine matching, only before initializing
+    bool SetPrefixSharing(bool share_prefixes);
+    
+    // match template rows through a basis of `rank` vectors fitted to all of them (see
+    // TemplateBank::SetRank, 0 matches exactly), only before initializing; FetchRankTradeoff
+    // reports the captured energy and largest cost error for each rank, for choosing one
+    bool SetTemplateRank(size_t rank);
+    bool FetchRankTradeoff(std::vector<float> &energy, std::vector<float> &error);
+    
+    // coarse-to-fine matching: each template also runs at 1 / `decimation` time resolution (on
+    // averaged columns), and its full resolution matcher only runs once the coarse score reaches
+    // the syllable's threshold minus `margin`, starting over from the recent columns (enough for
+    // any path within the length constraint, without reporting matches that already ended); 1
+    // disables, only before any syllables are added
+    bool SetCoarseToFine(unsigned int decimation, float margin = 0.1f);
     
     void SetCallbackMatch(void (*cb)(size_t, float, int));
     void SetCallbackColumn(void (*cb)(std::vector<float>, std::vector<int>)); // for debugging purposes, called once per syllable per column
@@ -77,20 +158,62 @@ public:
     
     // ingest new audio
     bool IngestAudio(const float *audio, const unsigned int len, const unsigned int stride=1);
+    bool IngestAudio(const int16_t *audio, const unsigned int len, const unsigned int stride=1); // Q15 samples
     bool IngestAudio(const std::vector<float>& audio);
     
     // perform matching
     bool MatchOnce(float *score, int *len);
+    bool MatchPower(const float *power, float *score = NULL, int *len = NULL); // one column of linear band power (GetIndexLow() through GetIndexHigh() - 1)
     void PerformMatching();
     
+    // audio dropped because the buffer was full
+    unsigned int GetOverruns() { return _stft.GetOverruns(); }
+    
     // debugging option
     bool ZeroPadAndFetch(std::vector<float> &scores, std::vector<int> &lengths);
     
+    // for each syllable: columns matched, columns pruned and template rows updated
+    bool FetchPruneCounts(std::vector<unsigned long> &columns, std::vector<unsigned long> &pruned, std::vector<unsigned long> &rows);
+
 private:
+    // prevent copying
+    MatchSyllables(const MatchSyllables &);
+    const MatchSyllables &operator=(const MatchSyllables &);
+    
+    // convert a spectrogram of band power to features (filter bank, if any)
+    bool _ConvertSpectrogram(const float *spect, size_t length, size_t features, std::vector<float> &converted);
+    
+    // add the newest matcher's template (length x features) to the shared bank, or its time
+    // decimated template when matching coarse-to-fine
+    void _AddToBank(struct ms_dtm &m, const float *tmpl);
+    void _AddToBank(struct ms_dtm &m, const std::vector<std::vector<float>> &tmpl);
+    
+    // build the trie of shared prefixes for a group of syllables sharing `depth` rows (under
+    // `parent`), returning the loosest pruning bound below it
+    float _SharePrefixes(std::vector<struct ms_dtm *> &group, size_t depth, struct ms_prefix *parent);
+    
+    // slots of a prefix (and its parents) for a syllable, reset; released when it resets, and merged
+    // with slots in the same state at the end of each column
+    size_t _AcquirePrefix(struct ms_prefix *prefix);
+    void _ReleasePrefix(struct ms_prefix *prefix, size_t slot);
+    void _MergePrefixes();
+    
     // perform matching
     bool _ReadFeatures(std::vector<float> &power);
+    unsigned int _ReadFeatureBatch();
+    void _MatchColumn(const float *features, float *score, int *len);
+    void _MatchCosts(const float *costs, float *score, int *len); // costs against the shared bank
+    void _MatchCoarseToFine(const float *features, float *score, int *len);
+    bool _Detect(struct ms_dtm &m, struct dtm_out out, float *score, int *len, bool report = true); // true for a match (and reset), without reporting it only resets
+    void _ReportColumn();
     
     bool _initialized = false;
+    bool _prune = false;
+    bool _length_band = false;
+    bool _share_prefixes = true;
+    size_t _template_rank = 0;
+    unsigned int _decimation = 1;
+    float _coarse_margin = 0.1f;
     
     // next index
     size_t _next_index = 0;
@@ -99,12 +222,14 @@ private:
     const float _sample_rate;
     
     // parameters
-    const unsigned int _buffer_length = 2097152;
+    const unsigned int _buffer_length;
     const unsigned int _window_length = 512;
     const unsigned int _window_stride = 60;
     const float _freq_lo = 850.0f;
     const float _freq_hi = 9000.0f;
     const bool _log_power = false;
+    const bool _sliding_dft = false; // incremental spectrum instead of an FFT per column
+    const unsigned int _batch_columns = 32; // columns read per STFT call when catching up
     
     // circular short term fourier transform
     CircularShortTermFourierTransform _stft;
@@ -113,11 +238,42 @@ private:
     const unsigned int _idx_lo;
     const unsigned int _idx_hi;
     
-    // current feature column for matching (power)
+    // optional filter bank (otherwise features are bins _idx_lo through _idx_hi - 1)
+    FilterBank *_filter_bank;
+    const size_t _length_features;
+    
+    // current feature column for matching
     std::vector<float> _features;
     
+    // batch of feature columns for PerformMatching (column after column)
+    std::vector<float> _features_batch;
+    
+    // band power before the filter bank
+    std::vector<float> _power;
+    std::vector<float> _power_batch;
+    
     // vector of matchers
-    std::list<struct ms_dtm> _dtms;
+    std::vector<struct ms_dtm> _dtms;
+    
+    // shared prefixes, each after its parent (room for all is reserved first, as matchers and
+    // prefixes point to their prefix)
+    std::vector<struct ms_prefix> _prefixes;
+    
+    // DPP state of every prefix and matcher, one after another in matching order
+    std::vector<float> _state;
+    
+    // template rows of all matchers, so costs for a column are calculated in one pass
+    TemplateStorage _template_storage = kTemplateFloat32;
+    TemplateBank _bank;
+    std::vector<float> _costs;
+    std::vector<float> _costs_batch; // for a batch of feature columns, one after another
+    
+    // coarse-to-fine: sum of the columns in the current group, and the most recent columns (ring)
+    std::vector<float> _pooled;
+    unsigned int _pooled_columns = 0;
+    std::vector<float> _recent;
+    size_t _recent_columns = 0;
+    unsigned long _column = 0;
     
     // callback
     void (*_cb_match)(size_t, float, int) = nullptr;
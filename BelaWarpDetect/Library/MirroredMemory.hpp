@@ -0,0 +1,110 @@
+//
+//  MirroredMemory.hpp
+//  BelaWarpDetect
+//
+
+#ifndef MirroredMemory_hpp
+#define MirroredMemory_hpp
+
+#if defined(__linux__)
+
+#include <stdio.h>
+#include <stdexcept>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/// Memory for a ring buffer where the same pages are mapped twice, back to back, so that
+/// ptr()[i] and ptr()[i + size()] are the same value. Any run of up to size() values starting
+/// inside the buffer is contiguous, even when it wraps around the end (the Linux equivalent of the
+/// virtual memory trick in TPCircularBuffer). The size is rounded up to a whole number of pages.
+template <typename T>
+class MirroredMemory
+{
+    static_assert(std::is_trivial<T>::value, "mirrored memory holds plain values (zero bytes are zero values)");
+
+public:
+    // constructor
+    MirroredMemory(const size_t size) {
+        // round up to page size
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        _bytes = ((size * sizeof(T) + page - 1) / page) * page;
+        if (_bytes == 0) {
+            _bytes = page;
+        }
+        if (_bytes % sizeof(T) != 0) {
+            throw std::invalid_argument("element size must divide the page size");
+        }
+        _size = _bytes / sizeof(T);
+        
+        // anonymous file backing both mappings
+#if defined(SYS_memfd_create)
+        int fd = static_cast<int>(syscall(SYS_memfd_create, "MirroredMemory", 0));
+#else
+        char name[64];
+        snprintf(name, sizeof(name), "/MirroredMemory-%d-%p", static_cast<int>(getpid()), static_cast<void *>(this));
+        int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd >= 0) {
+            shm_unlink(name);
+        }
+#endif
+        if (fd < 0) {
+            throw std::runtime_error("unable to create shared memory");
+        }
+        if (ftruncate(fd, static_cast<off_t>(_bytes)) != 0) {
+            close(fd);
+            throw std::runtime_error("unable to size shared memory");
+        }
+        
+        // reserve twice the address space, then map the file over each half
+        void *addr = mmap(NULL, 2 * _bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("unable to reserve address space");
+        }
+        char *base = static_cast<char *>(addr);
+        if (mmap(base, _bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+            mmap(base + _bytes, _bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            munmap(addr, 2 * _bytes);
+            close(fd);
+            throw std::runtime_error("unable to mirror memory");
+        }
+        
+        // mappings keep the file alive
+        close(fd);
+        
+        // new shared memory already reads as zeros (same as ManagedMemory); still touch every page
+        // of both mappings now, so the ring buffer never faults on its first write to a page (on
+        // Bela, a mode switch in the audio callback)
+        for (size_t offset = 0; offset < 2 * _bytes; offset += page) {
+            base[offset] = 0;
+        }
+        
+        _ptr = reinterpret_cast<T *>(base);
+    }
+    
+    // destructor
+    ~MirroredMemory() { munmap(_ptr, 2 * _bytes); }
+    
+    // size (number of values before the mirror)
+    size_t size() const { return _size; }
+    
+    // get pointer
+    T *ptr() const { return _ptr; }
+
+private:
+    // prevent copying
+    MirroredMemory(const MirroredMemory<T> &);
+    const MirroredMemory<T> &operator=(const MirroredMemory<T> &);
+    
+    size_t _size;
+    size_t _bytes;
+    T *_ptr;
+};
+
+#endif
+
+#endif /* MirroredMemory_hpp */
@@ -0,0 +1,207 @@
+//
+//  MultiChannelShortTimeFourierTransform.cpp
+//  BelaWarpDetect
+//
+
+#include "MultiChannelShortTimeFourierTransform.hpp"
+#include "Simd.hpp"
+
+#include <cmath>
+#include <stdexcept>
+
+MultiChannelShortTermFourierTransform::MultiChannelShortTermFourierTransform(unsigned int channels, unsigned int window_length, unsigned int window_stride, unsigned int buffer_length) :
+_channels(channels),
+_window_stride(window_stride),
+_fft_length(1 << static_cast<fft_length_t>(ceil(log2(window_length)))),
+#if defined(FFT_BACKEND_BUILTIN) && !defined(STFT_Q15_FFT)
+_samples_batch(SIMD_WIDTH * _fft_length),
+_batch_output_real(SIMD_WIDTH * (_fft_length / 2 + 1)),
+_batch_output_imag(SIMD_WIDTH * (_fft_length / 2 + 1)),
+#endif
+_stfts(channels, NULL) {
+    if (channels == 0) {
+        throw std::invalid_argument("at least one channel is required");
+    }
+    
+    // one buffer per channel (release already created channels if allocation fails)
+    try {
+        for (unsigned int c = 0; c < channels; ++c) {
+            _stfts[c] = new CircularShortTermFourierTransform(window_length, window_stride, buffer_length);
+        }
+    }
+    catch (...) {
+        for (auto it = _stfts.begin(); it != _stfts.end(); ++it) {
+            delete *it;
+        }
+        throw;
+    }
+}
+
+MultiChannelShortTermFourierTransform::~MultiChannelShortTermFourierTransform() {
+    for (auto it = _stfts.begin(); it != _stfts.end(); ++it) {
+        delete *it;
+    }
+}
+
+bool MultiChannelShortTermFourierTransform::SetWindow(const std::vector<fft_value_t>& window) {
+    for (auto it = _stfts.begin(); it != _stfts.end(); ++it) {
+        if (!(*it)->SetWindow(window)) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+void MultiChannelShortTermFourierTransform::SetWindowHanning() {
+    for (auto it = _stfts.begin(); it != _stfts.end(); ++it) {
+        (*it)->SetWindowHanning();
+    }
+}
+
+void MultiChannelShortTermFourierTransform::SetWindowHamming() {
+    for (auto it = _stfts.begin(); it != _stfts.end(); ++it) {
+        (*it)->SetWindowHamming();
+    }
+}
+
+void MultiChannelShortTermFourierTransform::SetLogPower(bool log_power) {
+    _log_power = log_power;
+    for (auto it = _stfts.begin(); it != _stfts.end(); ++it) {
+        (*it)->SetLogPower(log_power);
+    }
+}
+
+// columns available on every channel
+unsigned int MultiChannelShortTermFourierTransform::GetLengthColumns() {
+    unsigned int columns = _stfts[0]->GetLengthColumns();
+    for (unsigned int c = 1; c < _channels; ++c) {
+        unsigned int v = _stfts[c]->GetLengthColumns();
+        if (v < columns) {
+            columns = v;
+        }
+    }
+    
+    return columns;
+}
+
+// space available on every channel
+unsigned int MultiChannelShortTermFourierTransform::GetLengthCapacity() {
+    unsigned int capacity = _stfts[0]->GetLengthCapacity();
+    for (unsigned int c = 1; c < _channels; ++c) {
+        unsigned int v = _stfts[c]->GetLengthCapacity();
+        if (v < capacity) {
+            capacity = v;
+        }
+    }
+    
+    return capacity;
+}
+
+unsigned int MultiChannelShortTermFourierTransform::GetLengthPower() {
+    return _stfts[0]->GetLengthPower();
+}
+
+void MultiChannelShortTermFourierTransform::Clear() {
+    for (auto it = _stfts.begin(); it != _stfts.end(); ++it) {
+        (*it)->Clear();
+    }
+}
+
+float MultiChannelShortTermFourierTransform::ConvertIndexToFrequency(unsigned int index, float sample_rate) {
+    return _stfts[0]->ConvertIndexToFrequency(index, sample_rate);
+}
+
+unsigned int MultiChannelShortTermFourierTransform::ConvertFrequencyToIndex(float frequency, float sample_rate) {
+    return _stfts[0]->ConvertFrequencyToIndex(frequency, sample_rate);
+}
+
+void MultiChannelShortTermFourierTransform::ZeroPadToEdge() {
+    for (auto it = _stfts.begin(); it != _stfts.end(); ++it) {
+        (*it)->ZeroPadToEdge();
+    }
+}
+
+// producer side: split the frames into the per-channel buffers
+bool MultiChannelShortTermFourierTransform::WriteValues(const fft_value_t *values, const unsigned int frames, const unsigned int frame_stride, const unsigned int channel_stride) {
+    // check for sufficient space on every channel first (the consumer only ever frees space)
+    if (frames > GetLengthCapacity()) {
+        _count_overruns.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    
+    for (unsigned int c = 0; c < _channels; ++c) {
+        _stfts[c]->WriteValues(values + c * channel_stride, frames, frame_stride);
+    }
+    
+    return true;
+}
+
+bool MultiChannelShortTermFourierTransform::WriteValues(const int16_t *values, const unsigned int frames, const unsigned int frame_stride, const unsigned int channel_stride) {
+    if (frames > GetLengthCapacity()) {
+        _count_overruns.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    
+    for (unsigned int c = 0; c < _channels; ++c) {
+        _stfts[c]->WriteValues(values + c * channel_stride, frames, frame_stride);
+    }
+    
+    return true;
+}
+
+bool MultiChannelShortTermFourierTransform::ReadPower(fft_value_t *power, unsigned int idx_lo, unsigned int idx_hi) {
+    return ReadPowerBatch(power, 1, idx_lo, idx_hi) == 1;
+}
+
+// consumer side: the same columns are read from every channel
+unsigned int MultiChannelShortTermFourierTransform::ReadPowerBatch(fft_value_t *power, unsigned int columns, unsigned int idx_lo, unsigned int idx_hi) {
+    // check band
+    if (idx_lo >= idx_hi || idx_hi > GetLengthPower()) {
+        return 0;
+    }
+    
+    // available columns
+    unsigned int available = GetLengthColumns();
+    if (available == 0) {
+        return 0;
+    }
+    if (columns > available) {
+        columns = available;
+    }
+    
+    unsigned int band = idx_hi - idx_lo;
+    unsigned int transforms = columns * _channels; // transform t is column t / channels of channel t % channels
+    
+#if defined(FFT_BACKEND_BUILTIN) && !defined(STFT_Q15_FFT)
+    // several transforms at once (one per vector lane), mixing channels and columns
+    CircularShortTermFourierTransform *first = _stfts[0];
+    const fft_value_t *inputs[SIMD_WIDTH];
+    for (unsigned int t = 0; t < transforms; t += SIMD_WIDTH) {
+        unsigned int count = (transforms - t < SIMD_WIDTH ? transforms - t : SIMD_WIDTH);
+        
+        // window samples
+        for (unsigned int j = 0; j < count; ++j) {
+            _stfts[(t + j) % _channels]->_WindowSamples(_samples_batch.ptr() + j * _fft_length, ((t + j) / _channels) * _window_stride);
+            inputs[j] = _samples_batch.ptr() + j * _fft_length;
+        }
+        
+        // calculate FFTs (plans are identical, so any channel's will do)
+        first->_fft_config->ForwardBatch(inputs, count, _batch_output_real.ptr(), _batch_output_imag.ptr(), idx_lo, idx_hi);
+        
+        // power
+        first->_CalculateMagnitude(_batch_output_real.ptr(), _batch_output_imag.ptr(), power + t * band, count * band);
+    }
+#else
+    for (unsigned int t = 0; t < transforms; ++t) {
+        _stfts[t % _channels]->_PowerForColumn(power + t * band, (t / _channels) * _window_stride, idx_lo, idx_hi);
+    }
+#endif
+    
+    // advance read pointers
+    for (auto it = _stfts.begin(); it != _stfts.end(); ++it) {
+        (*it)->_ConsumeSamples(columns * _window_stride);
+    }
+    
+    return columns;
+}
@@ -0,0 +1,90 @@
+//
+//  MultiChannelShortTimeFourierTransform.hpp
+//  BelaWarpDetect
+//
+
+#ifndef MultiChannelShortTimeFourierTransform_hpp
+#define MultiChannelShortTimeFourierTransform_hpp
+
+#include <stdio.h>
+#include <vector>
+#include <atomic>
+
+#include "CircularShortTimeFourierTransform.hpp"
+
+/// Short term fourier transform of several synchronized audio channels (e.g. one microphone per
+/// cage). Interleaved audio is split into one circular buffer per channel as it is written, and each
+/// read produces the same column for every channel, so transforms for different channels share
+/// vector lanes (built-in FFT) and the window stays in cache.
+class MultiChannelShortTermFourierTransform
+{
+public:
+    MultiChannelShortTermFourierTransform(unsigned int channels, unsigned int window_length, unsigned int window_stride, unsigned int buffer_length = 4096);
+    ~MultiChannelShortTermFourierTransform();
+    
+    unsigned int GetChannels() { return _channels; }
+    
+    // window (shared by all channels)
+    bool SetWindow(const std::vector<fft_value_t>& window);
+    void SetWindowHanning();
+    void SetWindowHamming();
+    
+    // log compression: power values become log(1 + |X|)
+    void SetLogPower(bool log_power);
+    bool GetLogPower() { return _log_power; }
+    
+    // get length (per channel)
+    unsigned int GetLengthColumns();
+    unsigned int GetLengthCapacity();
+    unsigned int GetLengthPower();
+    
+    // clear all channels (not safe while the producer or consumer is running)
+    void Clear();
+    
+    // single producer / single consumer, same as CircularShortTermFourierTransform
+    unsigned int GetOverruns() { return _count_overruns.load(std::memory_order_relaxed); }
+    void ResetCounters() { _count_overruns.store(0, std::memory_order_relaxed); }
+    
+    // conversion helper functions
+    float ConvertIndexToFrequency(unsigned int index, float sample_rate);
+    unsigned int ConvertFrequencyToIndex(float frequency, float sample_rate); // next highest frequency bin
+    
+    // zero pad all channels to edge
+    void ZeroPadToEdge();
+    
+    // write `frames` frames, where sample i of channel c is values[i * frame_stride + c * channel_stride]
+    // (interleaved: frame_stride = channels, channel_stride = 1; non-interleaved: frame_stride = 1,
+    // channel_stride = frames); all channels are written or none are, so they stay aligned
+    bool WriteValues(const fft_value_t *values, const unsigned int frames, const unsigned int frame_stride, const unsigned int channel_stride = 1);
+    bool WriteValues(const int16_t *values, const unsigned int frames, const unsigned int frame_stride, const unsigned int channel_stride = 1); // Q15 samples
+    
+    // read one column of band power [idx_lo, idx_hi) for every channel (channel c at power[c * band])
+    bool ReadPower(fft_value_t *power, unsigned int idx_lo, unsigned int idx_hi);
+    
+    // read up to `columns` columns for every channel; column k of channel c is stored at
+    // power[(k * channels + c) * band]; returns number of columns read
+    unsigned int ReadPowerBatch(fft_value_t *power, unsigned int columns, unsigned int idx_lo, unsigned int idx_hi);
+
+private:
+    // prevent copying
+    MultiChannelShortTermFourierTransform(const MultiChannelShortTermFourierTransform &);
+    const MultiChannelShortTermFourierTransform &operator=(const MultiChannelShortTermFourierTransform &);
+    
+    unsigned int _channels;
+    fft_length_t _window_stride;
+    fft_length_t _fft_length;
+    bool _log_power = false;
+    
+#if defined(FFT_BACKEND_BUILTIN) && !defined(STFT_Q15_FFT)
+    ManagedMemory<fft_value_t> _samples_batch; // windowed values (one per lane)
+    ManagedMemory<fft_value_t> _batch_output_real;
+    ManagedMemory<fft_value_t> _batch_output_imag;
+#endif
+    
+    // one circular buffer (and transform state) per channel
+    std::vector<CircularShortTermFourierTransform *> _stfts;
+    
+    std::atomic<unsigned int> _count_overruns{0};
+};
+
+#endif /* MultiChannelShortTimeFourierTransform_hpp */
@@ -0,0 +1,220 @@
+//
+//  MultiStreamDynamicTimeMatcher.cpp
+//  BelaWarpDetect
+//
+
+#include "MultiStreamDynamicTimeMatcher.hpp"
+#include "Simd.hpp"
+
+#include <limits>
+#include <stdexcept>
+
+#define STREAM_STRIDE(streams) ((((streams) + SIMD_WIDTH - 1) / SIMD_WIDTH) * SIMD_WIDTH)
+
+MultiStreamDynamicTimeMatcher::MultiStreamDynamicTimeMatcher(const std::vector<std::vector<float>> &templ, size_t streams) :
+_features(templ.empty() ? 0 : templ[0].size()),
+_length(templ.size()),
+_streams(streams),
+_stride(STREAM_STRIDE(streams)),
+_tmpl(_features),
+_costs_stream(_length),
+_costs(_length * _stride),
+_alpha(_length),
+_normalize(0),
+_dpp_score(2 * (_length + 1) * _stride),
+_dpp_len(2 * (_length + 1) * _stride) {
+    // require at least one stream
+    if (streams == 0) {
+        throw std::invalid_argument("requires at least one stream");
+    }
+    
+    for (unsigned int i = 0; i < _length; ++i) {
+        // confirm matching number of features
+        if (templ[i].size() != _features) {
+            throw std::invalid_argument("requires constant sized feature vector");
+        }
+        
+        // copy template features
+        _tmpl.AddTemplate(&templ[i][0], 1);
+    }
+    
+    // calculate normalization
+    _CalculateNormalize();
+    
+    // allocate alpha
+    SetAlpha(1.0);
+    
+    // reset dpp storage
+    Reset();
+}
+
+MultiStreamDynamicTimeMatcher::MultiStreamDynamicTimeMatcher(const float *templ, size_t length, size_t features, size_t streams) :
+_features(features),
+_length(length),
+_streams(streams),
+_stride(STREAM_STRIDE(streams)),
+_tmpl(_features),
+_costs_stream(_length),
+_costs(_length * _stride),
+_alpha(_length),
+_normalize(0),
+_dpp_score(2 * (_length + 1) * _stride),
+_dpp_len(2 * (_length + 1) * _stride) {
+    // require at least one stream
+    if (streams == 0) {
+        throw std::invalid_argument("requires at least one stream");
+    }
+    
+    // copy template features
+    _tmpl.AddTemplate(templ, length);
+    
+    // calculate normalization
+    _CalculateNormalize();
+    
+    // allocate alpha
+    SetAlpha(1.0);
+    
+    // reset dpp storage
+    Reset();
+}
+
+MultiStreamDynamicTimeMatcher::~MultiStreamDynamicTimeMatcher() {
+    
+}
+
+bool MultiStreamDynamicTimeMatcher::SetAlpha(float alpha) {
+    // set alpha
+    for (unsigned int i = 0; i < _length; ++i) {
+        _alpha[i] = alpha;
+    }
+    
+    return true;
+}
+
+bool MultiStreamDynamicTimeMatcher::SetAlpha(const std::vector<float>& alpha) {
+    // check alpha length
+    if (alpha.size() != _length) {
+        return false;
+    }
+    
+    // set alpha
+    for (unsigned int i = 0; i < _length; ++i) {
+        _alpha[i] = alpha[i];
+    }
+    
+    return true;
+}
+
+void MultiStreamDynamicTimeMatcher::Reset() {
+    // set index to first column of DPP
+    _idx = 0;
+    
+    for (size_t s = 0; s < _streams; ++s) {
+        Reset(s);
+    }
+}
+
+void MultiStreamDynamicTimeMatcher::Reset(size_t stream) {
+    if (stream >= _streams) {
+        return;
+    }
+    
+    // column that will be read next
+    float *lst_score = _dpp_score.ptr() + (_idx == 0 ? 0 : (_length + 1) * _stride);
+    float *lst_len = _dpp_len.ptr() + (_idx == 0 ? 0 : (_length + 1) * _stride);
+    
+    lst_score[stream] = 0.f;
+    lst_len[stream] = 0.f;
+    for (size_t i = 1; i < (_length + 1); ++i) {
+        lst_score[i * _stride + stream] = std::numeric_limits<float>::max();
+        lst_len[i * _stride + stream] = 0.f; // nan costs can carry a maxed out score (and its length) forward
+    }
+}
+
+void MultiStreamDynamicTimeMatcher::_CalculateNormalize() {
+    _normalize = 0.5 * static_cast<float>(_length);
+}
+
+float MultiStreamDynamicTimeMatcher::_NormalizeScore(float score) {
+    float normalized = (_normalize - score) / _normalize;
+    if (normalized < 0.f) {
+        return 0.f;
+    }
+    if (normalized > 1.f) {
+        return 1.f;
+    }
+    return normalized;
+}
+
+void MultiStreamDynamicTimeMatcher::IngestFeatureVectors(const float *features, size_t feature_stride, struct dtm_out *out) {
+    // costs for each stream, stored stream-minor
+    float *costs = _costs.ptr();
+    for (size_t s = 0; s < _streams; ++s) {
+        _tmpl.CalculateCosts(features + s * feature_stride, _costs_stream.ptr());
+        for (size_t i = 0; i < _length; ++i) {
+            costs[i * _stride + s] = _costs_stream[i];
+        }
+    }
+    
+    IngestCostVectors(costs, out);
+}
+
+void MultiStreamDynamicTimeMatcher::IngestCostVectors(const float *costs, struct dtm_out *out) {
+    // pointers to alternating DPP results
+    float *lst_score, *lst_len, *cur_score, *cur_len;
+    if (_idx == 0) {
+        lst_score = _dpp_score.ptr();
+        lst_len = _dpp_len.ptr();
+        cur_score = _dpp_score.ptr() + (_length + 1) * _stride;
+        cur_len = _dpp_len.ptr() + (_length + 1) * _stride;
+        _idx = 1;
+    }
+    else {
+        lst_score = _dpp_score.ptr() + (_length + 1) * _stride;
+        lst_len = _dpp_len.ptr() + (_length + 1) * _stride;
+        cur_score = _dpp_score.ptr();
+        cur_len = _dpp_len.ptr();
+        _idx = 0;
+    }
+    
+    // same recurrence as DynamicTimeMatcher, one stream per lane (the comparisons become masks)
+    const simd_float one = simd_set1(1.f);
+    for (size_t i = 0; i < _length; ++i) {
+        const simd_float alpha = simd_set1(_alpha[i]);
+        const size_t here = i * _stride, next = (i + 1) * _stride;
+        for (size_t s = 0; s < _stride; s += SIMD_WIDTH) {
+            // nan costs (special case) only take the diagonal, with no added cost
+            simd_float cost = simd_load(costs + here + s);
+            simd_float valid = simd_cmpeq(cost, cost);
+            cost = simd_and(valid, cost);
+            simd_float cost_alpha = simd_mul(cost, alpha);
+            
+            // diagonal (move in both template and signal space)
+            simd_float score = simd_add(simd_load(lst_score + here + s), cost);
+            simd_float len = simd_add(simd_load(lst_len + here + s), one);
+            
+            // up (move in template space, but not in signal space)
+            simd_float t_score = simd_add(simd_load(cur_score + here + s), cost_alpha);
+            simd_float better = simd_and(valid, simd_cmplt(t_score, score));
+            score = simd_select(better, t_score, score);
+            len = simd_select(better, simd_load(cur_len + here + s), len);
+            
+            // left (move in signal space, not in template space)
+            t_score = simd_add(simd_load(lst_score + next + s), cost_alpha);
+            better = simd_and(valid, simd_cmplt(t_score, score));
+            score = simd_select(better, t_score, score);
+            len = simd_select(better, simd_add(simd_load(lst_len + next + s), one), len);
+            
+            simd_store(cur_score + next + s, score);
+            simd_store(cur_len + next + s, len);
+        }
+    }
+    
+    // results for each stream
+    const size_t last = _length * _stride;
+    for (size_t s = 0; s < _streams; ++s) {
+        out[s].score = cur_score[last + s];
+        out[s].normalized_score = _NormalizeScore(cur_score[last + s]);
+        out[s].len_diff = static_cast<int>(cur_len[last + s]) - static_cast<int>(_length);
+    }
+}
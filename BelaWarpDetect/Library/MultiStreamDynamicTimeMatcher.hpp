@@ -0,0 +1,75 @@
+//
+//  MultiStreamDynamicTimeMatcher.hpp
+//  BelaWarpDetect
+//
+
+#ifndef MultiStreamDynamicTimeMatcher_hpp
+#define MultiStreamDynamicTimeMatcher_hpp
+
+#include <stdio.h>
+#include <vector>
+
+#include "DynamicTimeMatcher.hpp"
+#include "ManagedMemory.hpp"
+#include "TemplateBank.hpp"
+
+/// Matches one template against several independent signals (streams, e.g. one per microphone or
+/// cage) at once. The recurrence in DynamicTimeMatcher depends on the previous template position
+/// (the "up" move), so it can not be vectorized along the template; instead each SIMD lane holds one
+/// stream, and scores and lengths are stored stream-minor (all streams for a template position are
+/// adjacent). Each stream behaves exactly like its own DynamicTimeMatcher.
+class MultiStreamDynamicTimeMatcher
+{
+public:
+    MultiStreamDynamicTimeMatcher(const std::vector<std::vector<float>> &templ, size_t streams);
+    MultiStreamDynamicTimeMatcher(const float *templ, size_t length, size_t features, size_t streams);
+    ~MultiStreamDynamicTimeMatcher();
+    
+    bool SetAlpha(float alpha);
+    bool SetAlpha(const std::vector<float>& alpha);
+    
+    // reset all streams, or just one (e.g. after it matched)
+    void Reset();
+    void Reset(size_t stream);
+    
+    float GetNormalize() { return _normalize; }
+    
+    size_t GetFeatures() { return _features; }
+    size_t GetLength() { return _length; }
+    size_t GetStreams() { return _streams; }
+    size_t GetStride() { return _stride; } // streams rounded up to SIMD_WIDTH
+    
+    // one feature vector per stream (stream s starts at features + s * feature_stride), one result
+    // per stream
+    void IngestFeatureVectors(const float *features, size_t feature_stride, struct dtm_out *out);
+    
+    // costs already calculated, costs[i * GetStride() + s] for template position i and stream s
+    void IngestCostVectors(const float *costs, struct dtm_out *out);
+
+private:
+    // prevent copying
+    MultiStreamDynamicTimeMatcher(const MultiStreamDynamicTimeMatcher &);
+    const MultiStreamDynamicTimeMatcher &operator=(const MultiStreamDynamicTimeMatcher &);
+    
+    void _CalculateNormalize();
+    float _NormalizeScore(float score);
+    
+    size_t _features; // number of features in each step of the template
+    size_t _length; // number of feature vectors in the template
+    size_t _streams;
+    size_t _stride;
+    
+    TemplateBank _tmpl; // _length rows
+    ManagedMemory<float> _costs_stream; // size = _length
+    ManagedMemory<float> _costs; // size = _length * _stride
+    ManagedMemory<float> _alpha; // size = _length
+    
+    float _normalize; // normalization that allows comparing across matcher instances
+    
+    // lengths are stored as floats (exact up to 2^24), so they can be selected alongside scores
+    ManagedMemory<float> _dpp_score; // size = 2 * (_length + 1) * _stride
+    ManagedMemory<float> _dpp_len;
+    unsigned int _idx; // index in the dynamic plex propogation
+};
+
+#endif /* MultiStreamDynamicTimeMatcher_hpp */
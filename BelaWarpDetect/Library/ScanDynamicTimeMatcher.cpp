@@ -0,0 +1,288 @@
+//
+//  ScanDynamicTimeMatcher.cpp
+//  BelaWarpDetect
+//
+
+#include "ScanDynamicTimeMatcher.hpp"
+#include "Simd.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#define SCAN_CHUNK(length) (((length) + SIMD_WIDTH - 1) / SIMD_WIDTH)
+
+// does moving up (score `up`) beat the best score so far (`score`, from a left move where `left` is
+// set)? ties go to the diagonal, then up, then left, as in DynamicTimeMatcher
+static inline simd_float up_is_better(simd_float up, simd_float score, simd_float left) {
+    return simd_or(simd_cmplt(up, score), simd_and(simd_cmpeq(up, score), left));
+}
+
+ScanDynamicTimeMatcher::ScanDynamicTimeMatcher(const std::vector<std::vector<float>> &templ) :
+_features(templ.empty() ? 0 : templ[0].size()),
+_length(templ.size()),
+_lanes(SIMD_WIDTH),
+_chunk(SCAN_CHUNK(_length)),
+_slots(_chunk * _lanes),
+_tmpl(_features),
+_costs(_slots),
+_alpha(_slots),
+_normalize(0),
+_scan_score(_slots),
+_scan_left(_slots),
+_scan_len(_slots),
+_scan_up(_slots),
+_dpp_score(2 * _slots),
+_dpp_len(2 * _slots) {
+    // require non-zero length
+    if (_length == 0) {
+        throw std::invalid_argument("requires non-empty template with non-empty feature vector");
+    }
+    
+    // copy template features
+    std::vector<float> flat(_length * _features);
+    for (size_t i = 0; i < _length; ++i) {
+        // confirm matching number of features
+        if (templ[i].size() != _features) {
+            throw std::invalid_argument("requires constant sized feature vector");
+        }
+        
+        std::copy(templ[i].begin(), templ[i].end(), flat.begin() + i * _features);
+    }
+    
+    _Initialize(&flat[0]);
+}
+
+ScanDynamicTimeMatcher::ScanDynamicTimeMatcher(const float *templ, size_t length, size_t features) :
+_features(features),
+_length(length),
+_lanes(SIMD_WIDTH),
+_chunk(SCAN_CHUNK(_length)),
+_slots(_chunk * _lanes),
+_tmpl(_features),
+_costs(_slots),
+_alpha(_slots),
+_normalize(0),
+_scan_score(_slots),
+_scan_left(_slots),
+_scan_len(_slots),
+_scan_up(_slots),
+_dpp_score(2 * _slots),
+_dpp_len(2 * _slots) {
+    // require non-zero length
+    if (_length == 0) {
+        throw std::invalid_argument("requires non-empty template with non-empty feature vector");
+    }
+    
+    _Initialize(templ);
+}
+
+ScanDynamicTimeMatcher::~ScanDynamicTimeMatcher() {
+    
+}
+
+void ScanDynamicTimeMatcher::_Initialize(const float *templ) {
+    // template rows in slot order (so costs come out in slot order), padding stays zero
+    std::vector<float> slotted(_slots * _features, 0.f);
+    for (size_t i = 0; i < _length; ++i) {
+        std::copy(templ + i * _features, templ + (i + 1) * _features, slotted.begin() + _Slot(i) * _features);
+    }
+    _tmpl.AddTemplate(&slotted[0], _slots);
+    
+    // calculate normalization
+    _CalculateNormalize();
+    
+    // allocate alpha
+    SetAlpha(1.0);
+    
+    // reset dpp storage
+    Reset();
+}
+
+bool ScanDynamicTimeMatcher::SetAlpha(float alpha) {
+    // set alpha
+    for (size_t i = 0; i < _length; ++i) {
+        _alpha[_Slot(i)] = alpha;
+    }
+    
+    return true;
+}
+
+bool ScanDynamicTimeMatcher::SetAlpha(const std::vector<float>& alpha) {
+    // check alpha length
+    if (alpha.size() != _length) {
+        return false;
+    }
+    
+    // set alpha
+    for (size_t i = 0; i < _length; ++i) {
+        _alpha[_Slot(i)] = alpha[i];
+    }
+    
+    return true;
+}
+
+void ScanDynamicTimeMatcher::Reset() {
+    // set index to first column of DPP
+    _idx = 0;
+    
+    for (size_t s = 0; s < _slots; ++s) {
+        _dpp_score[s] = std::numeric_limits<float>::max();
+        _dpp_len[s] = 0.f; // nan costs can carry a maxed out score (and its length) forward
+    }
+}
+
+void ScanDynamicTimeMatcher::_CalculateNormalize() {
+    _normalize = 0.5 * static_cast<float>(_length);
+}
+
+float ScanDynamicTimeMatcher::_NormalizeScore(float score) {
+    float normalized = (_normalize - score) / _normalize;
+    if (normalized < 0.f) {
+        return 0.f;
+    }
+    if (normalized > 1.f) {
+        return 1.f;
+    }
+    return normalized;
+}
+
+struct dtm_out ScanDynamicTimeMatcher::IngestFeatureVector(const float *features) {
+    // costs come out in slot order
+    _tmpl.CalculateCosts(features, _costs.ptr());
+    
+    return _IngestSlotCosts();
+}
+
+struct dtm_out ScanDynamicTimeMatcher::IngestFeatureVector(const std::vector<float>& features) {
+    return IngestFeatureVector(&features[0]);
+}
+
+struct dtm_out ScanDynamicTimeMatcher::IngestCostVector(const float *costs) {
+    // chunk by chunk (avoids dividing for every position)
+    for (size_t l = 0, i = 0; l < _lanes; ++l) {
+        for (size_t j = 0; j < _chunk && i < _length; ++j, ++i) {
+            _costs[j * _lanes + l] = costs[i];
+        }
+    }
+    
+    return _IngestSlotCosts();
+}
+
+struct dtm_out ScanDynamicTimeMatcher::_IngestSlotCosts() {
+    // error response
+    struct dtm_out ret = {-1.0, -1.0, 0};
+    
+    // pointers to alternating DPP results
+    float *lst_score, *lst_len, *cur_score, *cur_len;
+    if (_idx == 0) {
+        lst_score = _dpp_score.ptr();
+        lst_len = _dpp_len.ptr();
+        cur_score = _dpp_score.ptr() + _slots;
+        cur_len = _dpp_len.ptr() + _slots;
+        _idx = 1;
+    }
+    else {
+        lst_score = _dpp_score.ptr() + _slots;
+        lst_len = _dpp_len.ptr() + _slots;
+        cur_score = _dpp_score.ptr();
+        cur_len = _dpp_len.ptr();
+        _idx = 0;
+    }
+    
+    const simd_float one = simd_set1(1.f);
+    const simd_float inf = simd_set1(std::numeric_limits<float>::infinity());
+    const size_t last = (_chunk - 1) * _lanes;
+    
+    // the first position of each chunk follows the last position of the previous chunk (or position
+    // 0 of the template, which always has score and length 0)
+    float first_score[SIMD_WIDTH], first_len[SIMD_WIDTH];
+    first_score[0] = 0.f;
+    first_len[0] = 0.f;
+    for (size_t l = 1; l < _lanes; ++l) {
+        first_score[l] = lst_score[last + l - 1];
+        first_len[l] = lst_len[last + l - 1];
+    }
+    
+    // 1. scan each chunk on its own (one chunk per lane): best of diagonal and left at each position,
+    // then the up move within the chunk
+    simd_float run_score = simd_set1(0.f), run_left = simd_set1(0.f), run_len = simd_set1(0.f), run_up = simd_set1(0.f);
+    for (size_t j = 0; j < _chunk; ++j) {
+        const size_t row = j * _lanes;
+        
+        // nan costs (special case) only take the diagonal, with no added cost
+        simd_float cost = simd_load(_costs.ptr() + row);
+        simd_float valid = simd_cmpeq(cost, cost);
+        cost = simd_and(valid, cost);
+        simd_float cost_alpha = simd_mul(cost, simd_load(_alpha.ptr() + row));
+        
+        // diagonal (move in both template and signal space)
+        simd_float score = simd_add(j == 0 ? simd_load(first_score) : simd_load(lst_score + row - _lanes), cost);
+        simd_float len = simd_add(j == 0 ? simd_load(first_len) : simd_load(lst_len + row - _lanes), one);
+        
+        // left (move in signal space, not in template space)
+        simd_float t_score = simd_add(simd_load(lst_score + row), cost_alpha);
+        simd_float left = simd_and(valid, simd_cmplt(t_score, score));
+        score = simd_select(left, t_score, score);
+        len = simd_select(left, simd_add(simd_load(lst_len + row), one), len);
+        
+        // up (move in template space, but not in signal space), blocked by nan costs
+        simd_float up = simd_select(valid, cost_alpha, inf);
+        if (j == 0) {
+            run_score = score;
+            run_left = left;
+            run_len = len;
+            run_up = up;
+        }
+        else {
+            t_score = simd_add(run_score, up);
+            simd_float better = up_is_better(t_score, score, left);
+            run_score = simd_select(better, t_score, score);
+            run_left = simd_select(better, run_left, left);
+            run_len = simd_select(better, run_len, len);
+            run_up = simd_add(run_up, up);
+        }
+        
+        simd_store(_scan_score.ptr() + row, run_score);
+        simd_store(_scan_left.ptr() + row, simd_and(run_left, one));
+        simd_store(_scan_len.ptr() + row, run_len);
+        simd_store(_scan_up.ptr() + row, run_up);
+    }
+    
+    // 2. chain the chunks: the score and length entering each chunk from below
+    float carry_score[SIMD_WIDTH], carry_len[SIMD_WIDTH];
+    carry_score[0] = 0.f;
+    carry_len[0] = 0.f;
+    for (size_t l = 1; l < _lanes; ++l) {
+        float up = carry_score[l - 1] + _scan_up[last + l - 1];
+        float score = _scan_score[last + l - 1];
+        if (up < score || (up == score && _scan_left[last + l - 1] != 0.f)) {
+            carry_score[l] = up;
+            carry_len[l] = carry_len[l - 1];
+        }
+        else {
+            carry_score[l] = score;
+            carry_len[l] = _scan_len[last + l - 1];
+        }
+    }
+    
+    // 3. apply the incoming up move to every position
+    const simd_float in_score = simd_load(carry_score), in_len = simd_load(carry_len);
+    for (size_t j = 0; j < _chunk; ++j) {
+        const size_t row = j * _lanes;
+        
+        simd_float t_score = simd_add(in_score, simd_load(_scan_up.ptr() + row));
+        simd_float score = simd_load(_scan_score.ptr() + row);
+        simd_float better = up_is_better(t_score, score, simd_cmpeq(simd_load(_scan_left.ptr() + row), one));
+        
+        simd_store(cur_score + row, simd_select(better, t_score, score));
+        simd_store(cur_len + row, simd_select(better, in_len, simd_load(_scan_len.ptr() + row)));
+    }
+    
+    const size_t end = _Slot(_length - 1);
+    ret.score = cur_score[end];
+    ret.normalized_score = _NormalizeScore(cur_score[end]);
+    ret.len_diff = static_cast<int>(cur_len[end]) - static_cast<int>(_length);
+    
+    return ret;
+}
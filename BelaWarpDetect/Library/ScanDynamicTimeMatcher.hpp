@@ -0,0 +1,89 @@
+//
+//  ScanDynamicTimeMatcher.hpp
+//  BelaWarpDetect
+//
+
+#ifndef ScanDynamicTimeMatcher_hpp
+#define ScanDynamicTimeMatcher_hpp
+
+#include <stdio.h>
+#include <vector>
+
+#include "DynamicTimeMatcher.hpp"
+#include "ManagedMemory.hpp"
+#include "TemplateBank.hpp"
+
+/// Same matching as DynamicTimeMatcher, with the column update written as a min-plus prefix scan so a
+/// single signal can use every SIMD lane. The "up" move makes each template position depend on the
+/// one before it; here the template is split into SIMD_WIDTH contiguous chunks (one per lane), each
+/// lane scans its chunk, the chunk results are chained (SIMD_WIDTH serial steps) and then applied to
+/// every position. The serial chain shrinks from the template length to about 2 * length /
+/// SIMD_WIDTH + SIMD_WIDTH steps, which pays off for long templates.
+///
+/// Each position tracks the length of the path it came from, with the same tie breaking as
+/// DynamicTimeMatcher (diagonal, then up, then left), so lengths are exact. Scores can differ in the
+/// last bits, since costs along the up move are summed in a different order across chunks.
+class ScanDynamicTimeMatcher
+{
+public:
+    ScanDynamicTimeMatcher(const std::vector<std::vector<float>> &templ);
+    ScanDynamicTimeMatcher(const float *templ, size_t length, size_t features);
+    ~ScanDynamicTimeMatcher();
+    
+    bool SetAlpha(float alpha);
+    bool SetAlpha(const std::vector<float>& alpha);
+    
+    void Reset();
+    
+    float GetNormalize() { return _normalize; }
+    
+    size_t GetFeatures() { return _features; }
+    size_t GetLength() { return _length; }
+    
+    struct dtm_out IngestFeatureVector(const float *features);
+    struct dtm_out IngestFeatureVector(const std::vector<float>& features);
+    
+    // costs already calculated for each template feature vector (in template order)
+    struct dtm_out IngestCostVector(const float *costs);
+
+private:
+    // prevent copying
+    ScanDynamicTimeMatcher(const ScanDynamicTimeMatcher &);
+    const ScanDynamicTimeMatcher &operator=(const ScanDynamicTimeMatcher &);
+    
+    void _Initialize(const float *templ);
+    void _CalculateNormalize();
+    float _NormalizeScore(float score);
+    
+    // slot (chunk row * SIMD_WIDTH + lane) holding template position i
+    size_t _Slot(size_t i) { return (i % _chunk) * _lanes + (i / _chunk); }
+    
+    struct dtm_out _IngestSlotCosts();
+    
+    size_t _features; // number of features in each step of the template
+    size_t _length; // number of feature vectors in the template
+    size_t _lanes; // SIMD_WIDTH
+    size_t _chunk; // template positions per lane
+    size_t _slots; // _chunk * _lanes
+    
+    // everything below is stored by slot, so each chunk row is one vector
+    TemplateBank _tmpl; // _slots rows (padding rows are zero)
+    ManagedMemory<float> _costs; // size = _slots
+    ManagedMemory<float> _alpha; // size = _slots
+    
+    float _normalize; // normalization that allows comparing across DynamicTimeMatcher instances
+    
+    // scan of each chunk: best score, whether it came from a left move, its length, and the total
+    // cost of moving up through the chunk so far
+    ManagedMemory<float> _scan_score;
+    ManagedMemory<float> _scan_left;
+    ManagedMemory<float> _scan_len;
+    ManagedMemory<float> _scan_up;
+    
+    // lengths are stored as floats (exact up to 2^24), so they can be selected alongside scores
+    ManagedMemory<float> _dpp_score; // size = 2 * _slots (template position 0 is always 0)
+    ManagedMemory<float> _dpp_len;
+    unsigned int _idx; // index in the dynamic plex propogation
+};
+
+#endif /* ScanDynamicTimeMatcher_hpp */
@@ -0,0 +1,293 @@
+//
+//  Simd.hpp
+//  BelaWarpDetect
+//
+
+#ifndef Simd_hpp
+#define Simd_hpp
+
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+
+// Thin wrapper around the vector instructions available on each host (AVX or SSE on x86, NEON on
+// ARM, plain floats otherwise). Loads and stores are unaligned, so callers do not need to worry
+// about allocation alignment. Loops should process SIMD_WIDTH values at a time and finish the tail
+// with scalar code. `simd_store_interleaved` writes a0 b0 a1 b1 ... (2 * SIMD_WIDTH values) and
+// `simd_load_deinterleaved` reads them back. The bitwise operations act on the float bit patterns,
+// `simd_cvt_bits` converts a bit pattern (as a signed 32-bit integer) to float. `simd_load_int16`
+// loads SIMD_WIDTH signed 16-bit integers and converts them to float (`simd_load_int8` likewise for
+// 8-bit integers, `simd_load_half` for finite IEEE half precision values). Comparisons return a mask
+// (all bits set where true, never true for nan) for `simd_and` or `simd_select(mask, a, b)`.
+
+#if defined(__AVX__)
+#include <immintrin.h>
+
+#define SIMD_WIDTH 8
+
+typedef __m256 simd_float;
+
+static inline simd_float simd_load(const float *p) { return _mm256_loadu_ps(p); }
+static inline void simd_store(float *p, simd_float a) { _mm256_storeu_ps(p, a); }
+static inline simd_float simd_set1(float v) { return _mm256_set1_ps(v); }
+static inline simd_float simd_add(simd_float a, simd_float b) { return _mm256_add_ps(a, b); }
+static inline simd_float simd_sub(simd_float a, simd_float b) { return _mm256_sub_ps(a, b); }
+static inline simd_float simd_mul(simd_float a, simd_float b) { return _mm256_mul_ps(a, b); }
+static inline simd_float simd_min(simd_float a, simd_float b) { return _mm256_min_ps(a, b); }
+static inline simd_float simd_max(simd_float a, simd_float b) { return _mm256_max_ps(a, b); }
+static inline simd_float simd_sqrt(simd_float a) { return _mm256_sqrt_ps(a); }
+#if defined(__FMA__)
+static inline simd_float simd_madd(simd_float a, simd_float b, simd_float c) { return _mm256_fmadd_ps(a, b, c); }
+#else
+static inline simd_float simd_madd(simd_float a, simd_float b, simd_float c) { return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+#endif
+static inline void simd_store_interleaved(float *p, simd_float a, simd_float b) {
+    __m256 lo = _mm256_unpacklo_ps(a, b), hi = _mm256_unpackhi_ps(a, b);
+    _mm256_storeu_ps(p, _mm256_permute2f128_ps(lo, hi, 0x20));
+    _mm256_storeu_ps(p + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+}
+static inline void simd_load_deinterleaved(const float *p, simd_float *a, simd_float *b) {
+    __m256 x = _mm256_loadu_ps(p), y = _mm256_loadu_ps(p + 8);
+    __m256 lo = _mm256_permute2f128_ps(x, y, 0x20), hi = _mm256_permute2f128_ps(x, y, 0x31);
+    *a = _mm256_shuffle_ps(lo, hi, 0x88);
+    *b = _mm256_shuffle_ps(lo, hi, 0xDD);
+}
+static inline simd_float simd_set1_bits(uint32_t v) { return _mm256_castsi256_ps(_mm256_set1_epi32(static_cast<int>(v))); }
+static inline simd_float simd_and(simd_float a, simd_float b) { return _mm256_and_ps(a, b); }
+static inline simd_float simd_or(simd_float a, simd_float b) { return _mm256_or_ps(a, b); }
+static inline simd_float simd_cvt_bits(simd_float a) { return _mm256_cvtepi32_ps(_mm256_castps_si256(a)); }
+static inline simd_float simd_cmplt(simd_float a, simd_float b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+static inline simd_float simd_cmpeq(simd_float a, simd_float b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+static inline simd_float simd_select(simd_float mask, simd_float a, simd_float b) { return _mm256_blendv_ps(b, a, mask); }
+static inline simd_float simd_load_int16(const int16_t *p) {
+    // sign extend each half with SSE2 (AVX alone has no 256-bit integer operations)
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+    __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16));
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+}
+#if defined(__AVX2__)
+static inline simd_float simd_load_int8(const int8_t *p) { return _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(p)))); }
+#else
+static inline simd_float simd_load_int8(const int8_t *p) {
+    __m128i x = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p));
+    x = _mm_unpacklo_epi8(x, x);
+    __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 24));
+    __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 24));
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+}
+#endif
+#if defined(__F16C__)
+static inline simd_float simd_load_half(const uint16_t *p) { return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p))); }
+#else
+static inline __m128 simd_half_to_float(__m128i h) {
+    // magnitude moved into float position, rescaled by 2^112 (also handles subnormals), then the sign
+    __m128 mag = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x7fff)), 13)), _mm_set1_ps(5.192296858534828e33f));
+    return _mm_or_ps(mag, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x8000)), 16)));
+}
+static inline simd_float simd_load_half(const uint16_t *p) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    __m128 lo = simd_half_to_float(_mm_unpacklo_epi16(x, _mm_setzero_si128()));
+    __m128 hi = simd_half_to_float(_mm_unpackhi_epi16(x, _mm_setzero_si128()));
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+}
+#endif
+static inline float simd_hsum(simd_float a) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+
+#define SIMD_WIDTH 4
+
+typedef __m128 simd_float;
+
+static inline simd_float simd_load(const float *p) { return _mm_loadu_ps(p); }
+static inline void simd_store(float *p, simd_float a) { _mm_storeu_ps(p, a); }
+static inline simd_float simd_set1(float v) { return _mm_set1_ps(v); }
+static inline simd_float simd_add(simd_float a, simd_float b) { return _mm_add_ps(a, b); }
+static inline simd_float simd_sub(simd_float a, simd_float b) { return _mm_sub_ps(a, b); }
+static inline simd_float simd_mul(simd_float a, simd_float b) { return _mm_mul_ps(a, b); }
+static inline simd_float simd_min(simd_float a, simd_float b) { return _mm_min_ps(a, b); }
+static inline simd_float simd_max(simd_float a, simd_float b) { return _mm_max_ps(a, b); }
+static inline simd_float simd_sqrt(simd_float a) { return _mm_sqrt_ps(a); }
+static inline simd_float simd_madd(simd_float a, simd_float b, simd_float c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+static inline void simd_store_interleaved(float *p, simd_float a, simd_float b) {
+    _mm_storeu_ps(p, _mm_unpacklo_ps(a, b));
+    _mm_storeu_ps(p + 4, _mm_unpackhi_ps(a, b));
+}
+static inline void simd_load_deinterleaved(const float *p, simd_float *a, simd_float *b) {
+    __m128 x = _mm_loadu_ps(p), y = _mm_loadu_ps(p + 4);
+    *a = _mm_shuffle_ps(x, y, _MM_SHUFFLE(2, 0, 2, 0));
+    *b = _mm_shuffle_ps(x, y, _MM_SHUFFLE(3, 1, 3, 1));
+}
+static inline simd_float simd_set1_bits(uint32_t v) { return _mm_castsi128_ps(_mm_set1_epi32(static_cast<int>(v))); }
+static inline simd_float simd_and(simd_float a, simd_float b) { return _mm_and_ps(a, b); }
+static inline simd_float simd_or(simd_float a, simd_float b) { return _mm_or_ps(a, b); }
+static inline simd_float simd_cvt_bits(simd_float a) { return _mm_cvtepi32_ps(_mm_castps_si128(a)); }
+static inline simd_float simd_cmplt(simd_float a, simd_float b) { return _mm_cmplt_ps(a, b); }
+static inline simd_float simd_cmpeq(simd_float a, simd_float b) { return _mm_cmpeq_ps(a, b); }
+static inline simd_float simd_select(simd_float mask, simd_float a, simd_float b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+static inline simd_float simd_load_int16(const int16_t *p) {
+    __m128i x = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p));
+    return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+}
+static inline simd_float simd_load_int8(const int8_t *p) {
+    int32_t v;
+    memcpy(&v, p, sizeof(v));
+    __m128i x = _mm_cvtsi32_si128(v);
+    x = _mm_unpacklo_epi8(x, x);
+    return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 24));
+}
+static inline simd_float simd_load_half(const uint16_t *p) {
+    // magnitude moved into float position, rescaled by 2^112 (also handles subnormals), then the sign
+    __m128i h = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(p)), _mm_setzero_si128());
+    __m128 mag = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x7fff)), 13)), _mm_set1_ps(5.192296858534828e33f));
+    return _mm_or_ps(mag, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x8000)), 16)));
+}
+static inline float simd_hsum(simd_float a) {
+    __m128 s = _mm_add_ps(a, _mm_movehl_ps(a, a));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+
+#define SIMD_WIDTH 4
+
+typedef float32x4_t simd_float;
+
+static inline simd_float simd_load(const float *p) { return vld1q_f32(p); }
+static inline void simd_store(float *p, simd_float a) { vst1q_f32(p, a); }
+static inline simd_float simd_set1(float v) { return vdupq_n_f32(v); }
+static inline simd_float simd_add(simd_float a, simd_float b) { return vaddq_f32(a, b); }
+static inline simd_float simd_sub(simd_float a, simd_float b) { return vsubq_f32(a, b); }
+static inline simd_float simd_mul(simd_float a, simd_float b) { return vmulq_f32(a, b); }
+static inline simd_float simd_min(simd_float a, simd_float b) { return vminq_f32(a, b); }
+static inline simd_float simd_max(simd_float a, simd_float b) { return vmaxq_f32(a, b); }
+static inline simd_float simd_madd(simd_float a, simd_float b, simd_float c) { return vmlaq_f32(c, a, b); }
+static inline void simd_store_interleaved(float *p, simd_float a, simd_float b) {
+    float32x4x2_t v = {{a, b}};
+    vst2q_f32(p, v);
+}
+static inline void simd_load_deinterleaved(const float *p, simd_float *a, simd_float *b) {
+    float32x4x2_t v = vld2q_f32(p);
+    *a = v.val[0];
+    *b = v.val[1];
+}
+static inline simd_float simd_set1_bits(uint32_t v) { return vreinterpretq_f32_u32(vdupq_n_u32(v)); }
+static inline simd_float simd_and(simd_float a, simd_float b) { return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(a), vreinterpretq_u32_f32(b))); }
+static inline simd_float simd_or(simd_float a, simd_float b) { return vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(a), vreinterpretq_u32_f32(b))); }
+static inline simd_float simd_cvt_bits(simd_float a) { return vcvtq_f32_s32(vreinterpretq_s32_f32(a)); }
+static inline simd_float simd_cmplt(simd_float a, simd_float b) { return vreinterpretq_f32_u32(vcltq_f32(a, b)); }
+static inline simd_float simd_cmpeq(simd_float a, simd_float b) { return vreinterpretq_f32_u32(vceqq_f32(a, b)); }
+static inline simd_float simd_select(simd_float mask, simd_float a, simd_float b) { return vbslq_f32(vreinterpretq_u32_f32(mask), a, b); }
+static inline simd_float simd_load_int16(const int16_t *p) { return vcvtq_f32_s32(vmovl_s16(vld1_s16(p))); }
+static inline simd_float simd_load_int8(const int8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return vcvtq_f32_s32(vmovl_s16(vget_low_s16(vmovl_s8(vreinterpret_s8_u32(vdup_n_u32(v))))));
+}
+static inline simd_float simd_load_half(const uint16_t *p) {
+    // magnitude moved into float position, rescaled by 2^112, then the sign (ARMv7 NEON flushes
+    // subnormals, so half subnormals become zero there)
+    uint32x4_t h = vmovl_u16(vld1_u16(p));
+    float32x4_t mag = vmulq_f32(vreinterpretq_f32_u32(vshlq_n_u32(vandq_u32(h, vdupq_n_u32(0x7fff)), 13)), vdupq_n_f32(5.192296858534828e33f));
+    return vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(mag), vshlq_n_u32(vandq_u32(h, vdupq_n_u32(0x8000)), 16)));
+}
+#if defined(__aarch64__)
+static inline simd_float simd_sqrt(simd_float a) { return vsqrtq_f32(a); }
+static inline float simd_hsum(simd_float a) { return vaddvq_f32(a); }
+#else
+// ARMv7 has no vector square root, so use the reciprocal square root estimate (two newton steps)
+// and mask out zeros, which would otherwise produce 0 * inf
+static inline simd_float simd_sqrt(simd_float a) {
+    float32x4_t e = vrsqrteq_f32(a);
+    e = vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(a, e), e));
+    e = vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(a, e), e));
+    uint32x4_t nonzero = vcgtq_f32(a, vdupq_n_f32(0.f));
+    return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(vmulq_f32(a, e)), nonzero));
+}
+static inline float simd_hsum(simd_float a) {
+    float32x2_t s = vadd_f32(vget_low_f32(a), vget_high_f32(a));
+    return vget_lane_f32(vpadd_f32(s, s), 0);
+}
+#endif
+
+#else
+
+#define SIMD_WIDTH 1
+
+typedef float simd_float;
+
+static inline simd_float simd_load(const float *p) { return *p; }
+static inline void simd_store(float *p, simd_float a) { *p = a; }
+static inline simd_float simd_set1(float v) { return v; }
+static inline simd_float simd_add(simd_float a, simd_float b) { return a + b; }
+static inline simd_float simd_sub(simd_float a, simd_float b) { return a - b; }
+static inline simd_float simd_mul(simd_float a, simd_float b) { return a * b; }
+static inline simd_float simd_min(simd_float a, simd_float b) { return a < b ? a : b; }
+static inline simd_float simd_max(simd_float a, simd_float b) { return a > b ? a : b; }
+static inline simd_float simd_sqrt(simd_float a) { return std::sqrt(a); }
+static inline simd_float simd_madd(simd_float a, simd_float b, simd_float c) { return a * b + c; }
+static inline void simd_store_interleaved(float *p, simd_float a, simd_float b) { p[0] = a; p[1] = b; }
+static inline void simd_load_deinterleaved(const float *p, simd_float *a, simd_float *b) { *a = p[0]; *b = p[1]; }
+static inline simd_float simd_set1_bits(uint32_t v) { float r; memcpy(&r, &v, sizeof(r)); return r; }
+static inline simd_float simd_and(simd_float a, simd_float b) {
+    uint32_t x, y;
+    memcpy(&x, &a, sizeof(x)); memcpy(&y, &b, sizeof(y));
+    x &= y;
+    memcpy(&a, &x, sizeof(a));
+    return a;
+}
+static inline simd_float simd_or(simd_float a, simd_float b) {
+    uint32_t x, y;
+    memcpy(&x, &a, sizeof(x)); memcpy(&y, &b, sizeof(y));
+    x |= y;
+    memcpy(&a, &x, sizeof(a));
+    return a;
+}
+static inline simd_float simd_cvt_bits(simd_float a) { int32_t x; memcpy(&x, &a, sizeof(x)); return static_cast<float>(x); }
+static inline simd_float simd_cmplt(simd_float a, simd_float b) { return simd_set1_bits(a < b ? 0xffffffffu : 0u); }
+static inline simd_float simd_cmpeq(simd_float a, simd_float b) { return simd_set1_bits(a == b ? 0xffffffffu : 0u); }
+static inline simd_float simd_select(simd_float mask, simd_float a, simd_float b) { uint32_t m; memcpy(&m, &mask, sizeof(m)); return m ? a : b; }
+static inline simd_float simd_load_int16(const int16_t *p) { return static_cast<float>(*p); }
+static inline simd_float simd_load_int8(const int8_t *p) { return static_cast<float>(*p); }
+static inline simd_float simd_load_half(const uint16_t *p) {
+    uint32_t x = static_cast<uint32_t>(*p & 0x7fff) << 13;
+    float mag;
+    memcpy(&mag, &x, sizeof(mag));
+    return (*p & 0x8000) ? -mag * 5.192296858534828e33f : mag * 5.192296858534828e33f;
+}
+static inline float simd_hsum(simd_float a) { return a; }
+
+#endif
+
+// log(1 + x) for finite x >= 0, within about one float ulp of the exact result: 1 + x is split into
+// m * 2^e with m in [1, 2), then log(m) uses a degree 7 polynomial (error below 3e-7)
+static inline simd_float simd_log1p(simd_float x) {
+    const simd_float one = simd_set1(1.f);
+    simd_float y = simd_add(x, one);
+    
+    // exponent and mantissa
+    simd_float e = simd_sub(simd_mul(simd_cvt_bits(simd_and(y, simd_set1_bits(0x7f800000u))), simd_set1(1.f / 8388608.f)), simd_set1(127.f));
+    simd_float t = simd_sub(simd_or(simd_and(y, simd_set1_bits(0x007fffffu)), one), one);
+    
+    // log(1 + t) ~ t * p(t), t in [0, 1)
+    simd_float p = simd_set1(0.0104857475f);
+    p = simd_madd(p, t, simd_set1(-0.0541747091f));
+    p = simd_madd(p, t, simd_set1(0.133350572f));
+    p = simd_madd(p, t, simd_set1(-0.22500654f));
+    p = simd_madd(p, t, simd_set1(0.327937049f));
+    p = simd_madd(p, t, simd_set1(-0.499423277f));
+    p = simd_madd(p, t, simd_set1(0.999978515f));
+    
+    return simd_madd(e, simd_set1(0.693147181f), simd_mul(p, t));
+}
+
+#endif /* Simd_hpp */
@@ -0,0 +1,747 @@
+//
+//  TemplateBank.cpp
+//  BelaWarpDetect
+//
+
+#include "TemplateBank.hpp"
+#include "Simd.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring> // memcpy
+#include <stdexcept>
+
+// rows per block of the matrix-vector product
+#define TEMPLATE_BANK_BLOCK 4
+
+// bytes of rows per tile when calculating costs for several columns (fits in L1)
+#define TEMPLATE_BANK_TILE 16384
+
+// feature counts with their own unrolled kernels (by padded row stride): by default the 850-9000 Hz
+// band of MatchSyllables' 512 point FFT at 44.1 kHz (95 bins) and at 48 kHz (86 bins)
+#ifndef TEMPLATE_BANK_FEATURES_A
+#define TEMPLATE_BANK_FEATURES_A 95
+#endif
+#ifndef TEMPLATE_BANK_FEATURES_B
+#define TEMPLATE_BANK_FEATURES_B 86
+#endif
+
+#define TEMPLATE_BANK_STRIDE(features) ((((features) + SIMD_WIDTH - 1) / SIMD_WIDTH) * SIMD_WIDTH)
+
+// 1 - cosine similarity, from the dot product and precomputed norms
+static inline float cosine_cost(float dot, float power_t, float scale_t, float power_s, float scale_s) {
+    // check power?
+    if (power_t < 0.5 && power_s < 0.5) {
+        return 0.f;
+    }
+    
+    // an all zero vector has an infinite scale, making the result nan (0 * inf)
+    return 1.f - dot * scale_t * scale_s;
+}
+
+// nearest half precision value (ties to even), clamped to the largest finite half
+static uint16_t float_to_half(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint16_t sign = static_cast<uint16_t>((x >> 16) & 0x8000);
+    float a = std::fabs(f);
+    
+    // subnormal halves are multiples of 2^-24
+    if (a < 6.103515625e-05f) {
+        return sign | static_cast<uint16_t>(lrintf(a * 16777216.f));
+    }
+    
+    // rebias the exponent and round the mantissa from 23 to 10 bits
+    uint32_t ax = x & 0x7fffffff;
+    uint32_t h = (ax >> 13) - ((127 - 15) << 10);
+    uint32_t rem = ax & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) {
+        ++h;
+    }
+    if (h > 0x7bff) {
+        h = 0x7bff;
+    }
+    return sign | static_cast<uint16_t>(h);
+}
+
+// same conversion as simd_load_half
+static float half_to_float(uint16_t h) {
+    uint32_t x = static_cast<uint32_t>(h & 0x7fff) << 13;
+    float mag;
+    memcpy(&mag, &x, sizeof(mag));
+    mag *= 5.192296858534828e33f; // 2^112
+    return (h & 0x8000) ? -mag : mag;
+}
+
+static inline simd_float load_row(const float *p) { return simd_load(p); }
+static inline simd_float load_row(const uint16_t *p) { return simd_load_half(p); }
+static inline simd_float load_row(const int8_t *p) { return simd_load_int8(p); }
+
+// the blocked matrix-vector product for each storage type; a non-zero Stride fixes the row stride
+// at compile time, so the inner loop has a known trip count and is fully unrolled
+template <typename T, size_t Stride>
+static void calculate_costs_fixed(const T *row, size_t stride, size_t length, const float *s, const float *power, const float *scale, float power_s, float scale_s, float *costs) {
+    if (Stride) {
+        stride = Stride;
+    }
+    
+    // blocks of rows share each load of the signal
+    size_t i = 0;
+    for (; i + TEMPLATE_BANK_BLOCK <= length; i += TEMPLATE_BANK_BLOCK, row += TEMPLATE_BANK_BLOCK * stride) {
+        simd_float acc0 = simd_set1(0.f), acc1 = simd_set1(0.f), acc2 = simd_set1(0.f), acc3 = simd_set1(0.f);
+        for (size_t j = 0; j < stride; j += SIMD_WIDTH) {
+            simd_float v = simd_load(s + j);
+            acc0 = simd_madd(load_row(row + j), v, acc0);
+            acc1 = simd_madd(load_row(row + stride + j), v, acc1);
+            acc2 = simd_madd(load_row(row + 2 * stride + j), v, acc2);
+            acc3 = simd_madd(load_row(row + 3 * stride + j), v, acc3);
+        }
+        
+        costs[i] = cosine_cost(simd_hsum(acc0), power[i], scale[i], power_s, scale_s);
+        costs[i + 1] = cosine_cost(simd_hsum(acc1), power[i + 1], scale[i + 1], power_s, scale_s);
+        costs[i + 2] = cosine_cost(simd_hsum(acc2), power[i + 2], scale[i + 2], power_s, scale_s);
+        costs[i + 3] = cosine_cost(simd_hsum(acc3), power[i + 3], scale[i + 3], power_s, scale_s);
+    }
+    
+    // remaining rows
+    for (; i < length; ++i, row += stride) {
+        simd_float acc = simd_set1(0.f);
+        for (size_t j = 0; j < stride; j += SIMD_WIDTH) {
+            acc = simd_madd(load_row(row + j), simd_load(s + j), acc);
+        }
+        
+        costs[i] = cosine_cost(simd_hsum(acc), power[i], scale[i], power_s, scale_s);
+    }
+}
+
+// dispatch to the kernels specialized for the deployed feature counts, or the generic kernel
+template <typename T>
+static void calculate_costs(const T *row, size_t stride, size_t length, const float *s, const float *power, const float *scale, float power_s, float scale_s, float *costs) {
+    switch (stride) {
+        case TEMPLATE_BANK_STRIDE(TEMPLATE_BANK_FEATURES_A):
+            calculate_costs_fixed<T, TEMPLATE_BANK_STRIDE(TEMPLATE_BANK_FEATURES_A)>(row, stride, length, s, power, scale, power_s, scale_s, costs);
+            break;
+        
+        case TEMPLATE_BANK_STRIDE(TEMPLATE_BANK_FEATURES_B):
+            calculate_costs_fixed<T, TEMPLATE_BANK_STRIDE(TEMPLATE_BANK_FEATURES_B)>(row, stride, length, s, power, scale, power_s, scale_s, costs);
+            break;
+        
+        default:
+            calculate_costs_fixed<T, 0>(row, stride, length, s, power, scale, power_s, scale_s, costs);
+            break;
+    }
+}
+
+// weighted rows: only blocks with active bins (each block is one vector, inactive bins have weight
+// 0), weighted template values and weights against the signal and its square (the signal norm is
+// weighted by each row's weights)
+static void calculate_weighted_costs(const uint16_t *block, const float *value, const float *weight, const size_t *begin, size_t length, const float *s, const float *s_sq, const float *power, const float *scale, float *costs) {
+    for (size_t i = 0; i < length; ++i) {
+        simd_float dot = simd_set1(0.f), power_s = simd_set1(0.f);
+        for (size_t k = begin[i]; k < begin[i + 1]; ++k) {
+            dot = simd_madd(simd_load(value + k * SIMD_WIDTH), simd_load(s + block[k]), dot);
+            power_s = simd_madd(simd_load(weight + k * SIMD_WIDTH), simd_load(s_sq + block[k]), power_s);
+        }
+        
+        float power_sum = simd_hsum(power_s);
+        costs[i] = cosine_cost(simd_hsum(dot), power[i], scale[i], power_sum, 1.f / sqrt(power_sum));
+    }
+}
+
+TemplateBank::TemplateBank(size_t features, TemplateStorage storage) :
+_features(features),
+_stride(TEMPLATE_BANK_STRIDE(features)),
+_length(0),
+_storage(storage),
+_dense_rows(0),
+_weighted_begin(1, 0),
+_rank(0),
+_rank_stride(0),
+_basis_valid(false),
+_signal(_stride, 0.f),
+_signal_sq(_stride, 0.f) {
+    if (features == 0) {
+        throw std::invalid_argument("requires non-empty feature vector");
+    }
+    if (features > 65536) {
+        throw std::invalid_argument("requires at most 65536 features");
+    }
+}
+
+TemplateBank::~TemplateBank() {
+    
+}
+
+size_t TemplateBank::GetBytes() {
+    size_t bytes = sizeof(uint16_t) * _weighted_index.size() + 2 * sizeof(float) * _weighted_value.size();
+    if (_rank > 0) {
+        return bytes + sizeof(float) * (_rank * _stride + _coordinates.size());
+    }
+    switch (_storage) {
+        case kTemplateFloat16:
+            return bytes + sizeof(uint16_t) * _rows_half.size();
+        
+        case kTemplateInt8:
+            return bytes + sizeof(int8_t) * _rows_int8.size();
+        
+        default:
+            return bytes + sizeof(float) * _rows.size();
+    }
+}
+
+void TemplateBank::_AddSegment(size_t length, bool weighted) {
+    // new rows are matched exactly, and change the basis
+    _rank = 0;
+    _basis_valid = false;
+    
+    // extend the last segment, if the same kind
+    if (!_segments.empty() && _segments.back().weighted == weighted) {
+        _segments.back().length += length;
+        return;
+    }
+    
+    struct bank_segment segment;
+    segment.first = _length;
+    segment.length = length;
+    segment.offset = weighted ? _weighted_begin.size() - 1 : _dense_rows;
+    segment.weighted = weighted;
+    _segments.push_back(segment);
+}
+
+size_t TemplateBank::AddTemplate(const float *tmpl, size_t length) {
+    size_t first = _length;
+    if (length == 0) {
+        return first;
+    }
+    
+    _AddSegment(length, false);
+    
+    // copy rows (padding stays zero), keeping the stored values for the norms
+    std::vector<float> stored(_features);
+    for (size_t i = 0; i < length; ++i) {
+        const float *row = tmpl + i * _features;
+        const size_t offset = (_dense_rows + i) * _stride;
+        float step = 1.f;
+        
+        switch (_storage) {
+            case kTemplateFloat16:
+                _rows_half.resize(offset + _stride, 0);
+                for (size_t j = 0; j < _features; ++j) {
+                    _rows_half[offset + j] = float_to_half(row[j]);
+                    stored[j] = half_to_float(_rows_half[offset + j]);
+                }
+                break;
+            
+            case kTemplateInt8:
+            {
+                // largest magnitude maps to 127
+                float max_abs = 0.f;
+                for (size_t j = 0; j < _features; ++j) {
+                    max_abs = std::max(max_abs, std::fabs(row[j]));
+                }
+                if (max_abs > 0.f) {
+                    step = max_abs / 127.f;
+                }
+                
+                _rows_int8.resize(offset + _stride, 0);
+                for (size_t j = 0; j < _features; ++j) {
+                    long q = lrintf(row[j] / step);
+                    q = std::max(-127L, std::min(127L, q));
+                    _rows_int8[offset + j] = static_cast<int8_t>(q);
+                    stored[j] = step * static_cast<float>(q);
+                }
+                break;
+            }
+            
+            default:
+                _rows.resize(offset + _stride, 0.f);
+                memcpy(&_rows[offset], row, sizeof(float) * _features);
+                memcpy(&stored[0], row, sizeof(float) * _features);
+                break;
+        }
+        
+        // rows are fixed, so norms are only calculated once
+        float norm_t = 0;
+        for (size_t j = 0; j < _features; ++j) {
+            norm_t += stored[j] * stored[j];
+        }
+        
+        _power.push_back(norm_t);
+        _scale.push_back(step / sqrt(norm_t));
+    }
+    
+    _dense_rows += length;
+    _length += length;
+    
+    return first;
+}
+
+size_t TemplateBank::AddTemplate(const float *tmpl, const float *weights, size_t length, float cutoff) {
+    size_t first = _length;
+    if (length == 0) {
+        return first;
+    }
+    
+    // every row needs an active bin (otherwise it has no norm, and no cost against any signal)
+    for (size_t i = 0; i < length; ++i) {
+        const float *weight = weights + i * _features;
+        size_t j = 0;
+        while (j < _features && !(weight[j] > 0.f && weight[j] >= cutoff)) {
+            ++j;
+        }
+        if (j == _features) {
+            throw std::invalid_argument("requires an active bin (weight above zero and the cutoff) in every row");
+        }
+    }
+    
+    _AddSegment(length, true);
+    
+    for (size_t i = 0; i < length; ++i) {
+        const float *row = tmpl + i * _features;
+        const float *weight = weights + i * _features;
+        
+        // blocks with active bins, norm weighted the same way as the similarity
+        float norm_t = 0;
+        for (size_t j = 0; j < _features; j += SIMD_WIDTH) {
+            float value[SIMD_WIDTH] = {0.f}, active[SIMD_WIDTH] = {0.f};
+            bool any = false;
+            for (size_t u = 0; u < SIMD_WIDTH && j + u < _features; ++u) {
+                if (weight[j + u] > 0.f && weight[j + u] >= cutoff) {
+                    value[u] = weight[j + u] * row[j + u];
+                    active[u] = weight[j + u];
+                    norm_t += weight[j + u] * row[j + u] * row[j + u];
+                    any = true;
+                }
+            }
+            
+            if (any) {
+                _weighted_index.push_back(static_cast<uint16_t>(j));
+                _weighted_value.insert(_weighted_value.end(), value, value + SIMD_WIDTH);
+                _weighted_weight.insert(_weighted_weight.end(), active, active + SIMD_WIDTH);
+            }
+        }
+        _weighted_begin.push_back(_weighted_index.size());
+        
+        _power.push_back(norm_t);
+        _scale.push_back(1.f / sqrt(norm_t));
+    }
+    
+    _length += length;
+    
+    return first;
+}
+
+size_t TemplateBank::AddTemplate(const TemplateBank &bank) {
+    return AddTemplate(bank, 0, bank._length);
+}
+
+// copy `length` dense rows (only the vector matching the storage is filled)
+template <typename T>
+static void copy_rows(std::vector<T> &dst, const std::vector<T> &src, size_t row, size_t length, size_t stride) {
+    if (!src.empty()) {
+        dst.insert(dst.end(), src.begin() + row * stride, src.begin() + (row + length) * stride);
+    }
+}
+
+size_t TemplateBank::AddTemplate(const TemplateBank &bank, size_t first, size_t length) {
+    if (bank._features != _features) {
+        throw std::invalid_argument("requires the same number of features");
+    }
+    if (bank._storage != _storage) {
+        throw std::invalid_argument("requires the same template storage");
+    }
+    if (first + length > bank._length) {
+        throw std::invalid_argument("requires rows within the bank");
+    }
+    
+    size_t ret = _length;
+    
+    // each segment overlapping the rows, after the rows already here (same padding, so rows and
+    // norms can be copied as is)
+    for (size_t k = 0; k < bank._segments.size(); ++k) {
+        const struct bank_segment &segment = bank._segments[k];
+        const size_t lo = std::max(first, segment.first), hi = std::min(first + length, segment.first + segment.length);
+        if (lo >= hi) {
+            continue;
+        }
+        
+        const size_t row = lo - segment.first + segment.offset, count = hi - lo;
+        _AddSegment(count, segment.weighted);
+        _length += count;
+        
+        if (segment.weighted) {
+            const size_t weighted = _weighted_index.size(), begin = bank._weighted_begin[row], end = bank._weighted_begin[row + count];
+            for (size_t i = 1; i <= count; ++i) {
+                _weighted_begin.push_back(weighted + bank._weighted_begin[row + i] - begin);
+            }
+            _weighted_index.insert(_weighted_index.end(), bank._weighted_index.begin() + begin, bank._weighted_index.begin() + end);
+            _weighted_value.insert(_weighted_value.end(), bank._weighted_value.begin() + begin * SIMD_WIDTH, bank._weighted_value.begin() + end * SIMD_WIDTH);
+            _weighted_weight.insert(_weighted_weight.end(), bank._weighted_weight.begin() + begin * SIMD_WIDTH, bank._weighted_weight.begin() + end * SIMD_WIDTH);
+        }
+        else {
+            copy_rows(_rows, bank._rows, row, count, _stride);
+            copy_rows(_rows_half, bank._rows_half, row, count, _stride);
+            copy_rows(_rows_int8, bank._rows_int8, row, count, _stride);
+            _dense_rows += count;
+        }
+    }
+    
+    _power.insert(_power.end(), bank._power.begin() + first, bank._power.begin() + first + length);
+    _scale.insert(_scale.end(), bank._scale.begin() + first, bank._scale.begin() + first + length);
+    
+    return ret;
+}
+
+const struct TemplateBank::bank_segment &TemplateBank::_FindSegment(size_t row) const {
+    size_t k = 0;
+    while (row >= _segments[k].first + _segments[k].length) {
+        ++k;
+    }
+    return _segments[k];
+}
+
+// same stored values for `length` values of two dense rows
+template <typename T>
+static bool same_values(const std::vector<T> &a, size_t offset_a, const std::vector<T> &b, size_t offset_b, size_t length) {
+    return a.empty() || std::equal(a.begin() + offset_a, a.begin() + offset_a + length, b.begin() + offset_b);
+}
+
+bool TemplateBank::SameRow(size_t row, const TemplateBank &bank, size_t bank_row) const {
+    if (bank._features != _features || bank._storage != _storage || row >= _length || bank_row >= bank._length) {
+        return false;
+    }
+    if (_power[row] != bank._power[bank_row] || _scale[row] != bank._scale[bank_row]) {
+        return false;
+    }
+    
+    const struct bank_segment &segment = _FindSegment(row), &bank_segment = bank._FindSegment(bank_row);
+    if (segment.weighted != bank_segment.weighted) {
+        return false;
+    }
+    
+    const size_t r = row - segment.first + segment.offset, b = bank_row - bank_segment.first + bank_segment.offset;
+    if (segment.weighted) {
+        const size_t begin = _weighted_begin[r], count = _weighted_begin[r + 1] - begin, bank_begin = bank._weighted_begin[b];
+        return count == bank._weighted_begin[b + 1] - bank_begin &&
+            same_values(_weighted_index, begin, bank._weighted_index, bank_begin, count) &&
+            same_values(_weighted_value, begin * SIMD_WIDTH, bank._weighted_value, bank_begin * SIMD_WIDTH, count * SIMD_WIDTH) &&
+            same_values(_weighted_weight, begin * SIMD_WIDTH, bank._weighted_weight, bank_begin * SIMD_WIDTH, count * SIMD_WIDTH);
+    }
+    
+    return same_values(_rows, r * _stride, bank._rows, b * _stride, _stride) &&
+        same_values(_rows_half, r * _stride, bank._rows_half, b * _stride, _stride) &&
+        same_values(_rows_int8, r * _stride, bank._rows_int8, b * _stride, _stride);
+}
+
+void TemplateBank::_CalculateSegmentCosts(const struct bank_segment &segment, size_t first, size_t length, const float *s, const float *s_sq, const float *p, float power_s, float scale_s, float *costs) {
+    const size_t row = first - segment.first + segment.offset; // dense or weighted row
+    const float *power = &_power[first], *scale = &_scale[first];
+    
+    if (segment.weighted) {
+        calculate_weighted_costs(_weighted_index.data(), _weighted_value.data(), _weighted_weight.data(), &_weighted_begin[row], length, s, s_sq, power, scale, costs);
+        return;
+    }
+    
+    // coordinates against the projected signal
+    if (_rank > 0) {
+        calculate_costs(&_coordinates[row * _rank_stride], _rank_stride, length, p, power, &_coordinate_scale[row], power_s, scale_s, costs);
+        return;
+    }
+    
+    switch (_storage) {
+        case kTemplateFloat16:
+            calculate_costs(&_rows_half[row * _stride], _stride, length, s, power, scale, power_s, scale_s, costs);
+            break;
+        
+        case kTemplateInt8:
+            calculate_costs(&_rows_int8[row * _stride], _stride, length, s, power, scale, power_s, scale_s, costs);
+            break;
+    
+        default:
+            calculate_costs(&_rows[row * _stride], _stride, length, s, power, scale, power_s, scale_s, costs);
+            break;
+    }
+}
+
+void TemplateBank::CalculateCosts(const float *signal, float *costs) {
+    CalculateCosts(signal, 1, costs);
+}
+
+void TemplateBank::CalculateCosts(const float *signal, size_t columns, float *costs) {
+    if (columns == 0) {
+        return;
+    }
+    
+    // padded copies, squares (for weighted rows) and norms of every column
+    if (_signal_power.size() < columns) {
+        _signal.resize(columns * _stride, 0.f);
+        _signal_sq.resize(columns * _stride, 0.f);
+        _signal_power.resize(columns);
+        _signal_scale.resize(columns);
+    }
+    for (size_t c = 0; c < columns; ++c) {
+        float *s = &_signal[c * _stride], *s_sq = &_signal_sq[c * _stride];
+        memcpy(s, signal + c * _features, sizeof(float) * _features);
+        
+        float power_s = 0;
+        for (size_t j = 0; j < _features; ++j) {
+            s_sq[j] = s[j] * s[j];
+            power_s += s_sq[j];
+        }
+        _signal_power[c] = power_s;
+        _signal_scale[c] = 1.f / sqrt(power_s);
+    }
+    
+    // coordinates of every column in the basis (padding stays zero)
+    if (_rank > 0) {
+        if (_projected.size() < columns * _rank_stride) {
+            _projected.resize(columns * _rank_stride, 0.f);
+        }
+        for (size_t c = 0; c < columns; ++c) {
+            for (size_t r = 0; r < _rank; ++r) {
+                simd_float acc = simd_set1(0.f);
+                for (size_t j = 0; j < _stride; j += SIMD_WIDTH) {
+                    acc = simd_madd(simd_load(&_basis[r * _stride + j]), simd_load(&_signal[c * _stride + j]), acc);
+                }
+                _projected[c * _rank_stride + r] = simd_hsum(acc);
+            }
+        }
+    }
+    
+    // rows per tile (a whole number of blocks)
+    size_t row_bytes = _rank > 0 ? _rank_stride * sizeof(float) : _stride * (_storage == kTemplateFloat16 ? sizeof(uint16_t) : (_storage == kTemplateInt8 ? sizeof(int8_t) : sizeof(float)));
+    size_t tile = std::max(static_cast<size_t>(1), TEMPLATE_BANK_TILE / (row_bytes * TEMPLATE_BANK_BLOCK)) * TEMPLATE_BANK_BLOCK;
+    
+    // each tile of rows against every column
+    for (size_t k = 0; k < _segments.size(); ++k) {
+        const struct bank_segment &segment = _segments[k];
+        for (size_t r = segment.first; r < segment.first + segment.length; r += tile) {
+            size_t rows = std::min(tile, segment.first + segment.length - r);
+            for (size_t c = 0; c < columns; ++c) {
+                _CalculateSegmentCosts(segment, r, rows, &_signal[c * _stride], &_signal_sq[c * _stride], _rank > 0 ? &_projected[c * _rank_stride] : NULL, _signal_power[c], _signal_scale[c], costs + c * _length + r);
+            }
+        }
+    }
+}
+
+void TemplateBank::_DecodeRow(size_t row, size_t dense_row, double *values) {
+    const size_t offset = dense_row * _stride;
+    switch (_storage) {
+        case kTemplateFloat16:
+            for (size_t j = 0; j < _features; ++j) {
+                values[j] = half_to_float(_rows_half[offset + j]);
+            }
+            break;
+        
+        case kTemplateInt8:
+        {
+            // the quantization step is folded into the scale
+            double step = _power[row] > 0.f ? static_cast<double>(_scale[row]) * sqrt(static_cast<double>(_power[row])) : 0.;
+            for (size_t j = 0; j < _features; ++j) {
+                values[j] = step * _rows_int8[offset + j];
+            }
+            break;
+        }
+        
+        default:
+            for (size_t j = 0; j < _features; ++j) {
+                values[j] = _rows[offset + j];
+            }
+            break;
+    }
+}
+
+// eigenvalues and eigenvectors (columns of `vectors`) of a symmetric n x n matrix, by cyclic Jacobi
+// rotations (the matrix is destroyed)
+static void symmetric_eigen(std::vector<double> &a, size_t n, std::vector<double> &values, std::vector<double> &vectors) {
+    vectors.assign(n * n, 0.);
+    for (size_t i = 0; i < n; ++i) {
+        vectors[i * n + i] = 1.;
+    }
+    
+    for (int sweep = 0; sweep < 100; ++sweep) {
+        // done once the off diagonal is negligible
+        double off = 0., total = 0.;
+        for (size_t p = 0; p < n; ++p) {
+            for (size_t q = 0; q < n; ++q) {
+                total += a[p * n + q] * a[p * n + q];
+                if (p != q) {
+                    off += a[p * n + q] * a[p * n + q];
+                }
+            }
+        }
+        if (off <= 1e-24 * total) {
+            break;
+        }
+        
+        for (size_t p = 0; p + 1 < n; ++p) {
+            for (size_t q = p + 1; q < n; ++q) {
+                double apq = a[p * n + q];
+                if (apq == 0.) {
+                    continue;
+                }
+                
+                // rotation that zeroes a[p][q]
+                double theta = (a[q * n + q] - a[p * n + p]) / (2. * apq);
+                double t = (theta >= 0. ? 1. : -1.) / (fabs(theta) + sqrt(theta * theta + 1.));
+                double c = 1. / sqrt(t * t + 1.), s = t * c;
+                
+                for (size_t k = 0; k < n; ++k) {
+                    double akp = a[k * n + p], akq = a[k * n + q];
+                    a[k * n + p] = c * akp - s * akq;
+                    a[k * n + q] = s * akp + c * akq;
+                }
+                for (size_t k = 0; k < n; ++k) {
+                    double apk = a[p * n + k], aqk = a[q * n + k];
+                    a[p * n + k] = c * apk - s * aqk;
+                    a[q * n + k] = s * apk + c * aqk;
+                }
+                for (size_t k = 0; k < n; ++k) {
+                    double vkp = vectors[k * n + p], vkq = vectors[k * n + q];
+                    vectors[k * n + p] = c * vkp - s * vkq;
+                    vectors[k * n + q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+    
+    values.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        values[i] = a[i * n + i];
+    }
+}
+
+void TemplateBank::_CalculateBasis() {
+    if (_basis_valid) {
+        return;
+    }
+    
+    // Gram matrix of the stored dense rows
+    const size_t n = _features;
+    std::vector<double> gram(n * n, 0.), values(n);
+    for (size_t k = 0; k < _segments.size(); ++k) {
+        if (_segments[k].weighted) {
+            continue;
+        }
+        for (size_t i = 0; i < _segments[k].length; ++i) {
+            _DecodeRow(_segments[k].first + i, _segments[k].offset + i, &values[0]);
+            for (size_t a = 0; a < n; ++a) {
+                for (size_t b = a; b < n; ++b) {
+                    gram[a * n + b] += values[a] * values[b];
+                }
+            }
+        }
+    }
+    for (size_t a = 0; a < n; ++a) {
+        for (size_t b = 0; b < a; ++b) {
+            gram[a * n + b] = gram[b * n + a];
+        }
+    }
+    
+    std::vector<double> eigenvalues, eigenvectors;
+    symmetric_eigen(gram, n, eigenvalues, eigenvectors);
+    
+    // basis vectors by decreasing eigenvalue
+    std::vector<size_t> order(n);
+    for (size_t i = 0; i < n; ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&eigenvalues](size_t a, size_t b) { return eigenvalues[a] > eigenvalues[b]; });
+    
+    _eigenvalues.resize(n);
+    _basis.assign(n * _stride, 0.f);
+    for (size_t r = 0; r < n; ++r) {
+        _eigenvalues[r] = std::max(0., eigenvalues[order[r]]);
+        for (size_t j = 0; j < n; ++j) {
+            _basis[r * _stride + j] = static_cast<float>(eigenvectors[j * n + order[r]]);
+        }
+    }
+    
+    _basis_valid = true;
+}
+
+bool TemplateBank::SetRank(size_t rank) {
+    if (rank > _features) {
+        return false;
+    }
+    
+    _rank = 0;
+    _coordinates.clear();
+    _coordinate_scale.clear();
+    if (rank == 0) {
+        return true;
+    }
+    
+    _CalculateBasis();
+    
+    // coordinates of each dense row (padding stays zero), with exact norms
+    _rank_stride = ((rank + SIMD_WIDTH - 1) / SIMD_WIDTH) * SIMD_WIDTH;
+    _coordinates.assign(_dense_rows * _rank_stride, 0.f);
+    _coordinate_scale.resize(_dense_rows);
+    std::vector<double> values(_features);
+    for (size_t k = 0; k < _segments.size(); ++k) {
+        if (_segments[k].weighted) {
+            continue;
+        }
+        for (size_t i = 0; i < _segments[k].length; ++i) {
+            const size_t dense_row = _segments[k].offset + i;
+            _DecodeRow(_segments[k].first + i, dense_row, &values[0]);
+            for (size_t r = 0; r < rank; ++r) {
+                double coordinate = 0.;
+                for (size_t j = 0; j < _features; ++j) {
+                    coordinate += _basis[r * _stride + j] * values[j];
+                }
+                _coordinates[dense_row * _rank_stride + r] = static_cast<float>(coordinate);
+            }
+            _coordinate_scale[dense_row] = 1.f / sqrt(_power[_segments[k].first + i]);
+        }
+    }
+    
+    _rank = rank;
+    
+    return true;
+}
+
+void TemplateBank::GetRankTradeoff(std::vector<float> &energy, std::vector<float> &error) {
+    _CalculateBasis();
+    
+    // captured energy, from the eigenvalues
+    double total = 0., captured = 0.;
+    for (size_t r = 0; r < _features; ++r) {
+        total += _eigenvalues[r];
+    }
+    energy.resize(_features);
+    for (size_t r = 0; r < _features; ++r) {
+        captured += _eigenvalues[r];
+        energy[r] = total > 0. ? static_cast<float>(captured / total) : 1.f;
+    }
+    
+    // largest relative norm outside the first k basis vectors, over every dense row
+    error.assign(_features, 0.f);
+    std::vector<double> values(_features);
+    for (size_t k = 0; k < _segments.size(); ++k) {
+        if (_segments[k].weighted) {
+            continue;
+        }
+        for (size_t i = 0; i < _segments[k].length; ++i) {
+            _DecodeRow(_segments[k].first + i, _segments[k].offset + i, &values[0]);
+            double power = 0.;
+            for (size_t j = 0; j < _features; ++j) {
+                power += values[j] * values[j];
+            }
+            if (power <= 0.) {
+                continue;
+            }
+            
+            double remaining = power;
+            for (size_t r = 0; r < _features; ++r) {
+                double coordinate = 0.;
+                for (size_t j = 0; j < _features; ++j) {
+                    coordinate += _basis[r * _stride + j] * values[j];
+                }
+                remaining -= coordinate * coordinate;
+                error[r] = std::max(error[r], static_cast<float>(sqrt(std::max(0., remaining) / power)));
+            }
+        }
+    }
+}
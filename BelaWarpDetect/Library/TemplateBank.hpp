@@ -0,0 +1,136 @@
+//
+//  TemplateBank.hpp
+//  BelaWarpDetect
+//
+
+#ifndef TemplateBank_hpp
+#define TemplateBank_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+
+// how template rows are stored: full precision, IEEE half precision (half the memory) or 8-bit
+// integers with a scale per row (a quarter of the memory); signals and costs are always float.
+// Rows are converted back to float as they are read, which only pays off when the rows would
+// otherwise not fit in cache and the conversion is cheap (AVX2 and F16C convert a vector per
+// instruction, SSE2 and NEON take several)
+enum TemplateStorage {
+    kTemplateFloat32,
+    kTemplateFloat16,
+    kTemplateInt8
+};
+
+/// Feature vectors of one or more templates stored as rows of one contiguous matrix, each row padded
+/// to a whole number of SIMD vectors. For each signal column, the cosine distance to every row is
+/// computed in a single blocked matrix-vector product (several rows share each load of the signal),
+/// using norms precomputed when rows are added. Rows can be stored quantized (see TemplateStorage) to
+/// cut the memory read per column, so large template libraries stay in cache; norms are calculated
+/// from the quantized rows, so a row still has a cost of 0 against itself.
+///
+/// Rows can also carry weights (e.g. 1 / (1 + std) across the renditions a template was built from),
+/// giving a weighted cosine similarity: sum(w t s) / sqrt(sum(w t^2) sum(w s^2)). Weighted rows keep
+/// only the vectors of bins (SIMD_WIDTH adjacent bins) with an active bin (weight at or above a
+/// cutoff), as a sparse list, so sparse (e.g. harmonic) syllables cost less; these rows are always
+/// stored as float.
+///
+/// Dense rows can also be matched through a low rank approximation (SetRank): the leading
+/// eigenvectors of the rows' Gram matrix (an uncentered PCA, the right singular vectors of the row
+/// matrix) form a basis, each row is replaced by its `rank` coordinates and each signal column is
+/// projected onto the basis once, so a column costs rank * (features + rows) instead of features *
+/// rows. Norms stay exact, so only the dot product is approximated, and the cost error of a row is
+/// at most the part of its norm outside the basis (see GetRankTradeoff).
+class TemplateBank
+{
+public:
+    TemplateBank(size_t features, TemplateStorage storage = kTemplateFloat32);
+    ~TemplateBank();
+    
+    size_t GetFeatures() { return _features; }
+    size_t GetLength() { return _length; } // total number of rows
+    TemplateStorage GetStorage() const { return _storage; }
+    size_t GetBytes(); // memory read by the rows for each column (the basis and coordinates at low rank)
+    
+    // append `length` feature vectors (stored one after another) or rows of another bank with the
+    // same number of features and storage; returns the index of the first row added
+    size_t AddTemplate(const float *tmpl, size_t length);
+    size_t AddTemplate(const float *tmpl, const float *weights, size_t length, float cutoff = 0.f); // weights for each value, at least one above zero and the cutoff in every row
+    size_t AddTemplate(const TemplateBank &bank);
+    size_t AddTemplate(const TemplateBank &bank, size_t first, size_t length); // rows first through first + length - 1
+    
+    // whether a row is stored exactly the same as a row of another bank (so it always has the same cost)
+    bool SameRow(size_t row, const TemplateBank &bank, size_t bank_row) const;
+    
+    // cost (1 - cosine similarity) of the signal against every row; 0 when both have little power and
+    // nan when exactly one is all zeros
+    void CalculateCosts(const float *signal, float *costs);
+
+    // match dense rows through their coordinates in a basis of `rank` vectors (0 matches them exactly);
+    // rows added later are matched exactly again, until the rank is set again
+    bool SetRank(size_t rank);
+    size_t GetRank() { return _rank; }
+    
+    // for each rank k (1 through features), the fraction of the dense rows' energy (sum of squares)
+    // captured by the first k basis vectors (energy[k - 1]), and the largest part of any row's norm
+    // outside them (error[k - 1]), which bounds how far that row's cost can move
+    void GetRankTradeoff(std::vector<float> &energy, std::vector<float> &error);
+    
+    // costs for `columns` signal columns (stored one after another), costs[c * GetLength() + i]; rows
+    // are visited in tiles that stay in cache while every column passes over them
+    void CalculateCosts(const float *signal, size_t columns, float *costs);
+
+private:
+    // consecutive rows stored the same way (offset is the first dense or weighted row)
+    struct bank_segment {
+        size_t first;
+        size_t length;
+        size_t offset;
+        bool weighted;
+    };
+    
+    void _AddSegment(size_t length, bool weighted);
+    void _DecodeRow(size_t row, size_t dense_row, double *values); // stored values of a dense row
+    void _CalculateBasis();
+    const struct bank_segment &_FindSegment(size_t row) const;
+    void _CalculateSegmentCosts(const struct bank_segment &segment, size_t first, size_t length, const float *s, const float *s_sq, const float *p, float power_s, float scale_s, float *costs);
+    
+    size_t _features;
+    size_t _stride; // values per row (features rounded up to SIMD_WIDTH, zero padded)
+    size_t _length;
+    TemplateStorage _storage;
+    
+    std::vector<struct bank_segment> _segments;
+    
+    // dense rows, only the one matching _storage is used, size = _stride * _dense_rows
+    size_t _dense_rows;
+    std::vector<float> _rows;
+    std::vector<uint16_t> _rows_half;
+    std::vector<int8_t> _rows_int8;
+    
+    // weighted rows, active blocks of row k are _weighted_begin[k] through _weighted_begin[k + 1] - 1
+    std::vector<size_t> _weighted_begin;
+    std::vector<uint16_t> _weighted_index; // first bin of each block
+    std::vector<float> _weighted_value; // weight * template value, SIMD_WIDTH per block
+    std::vector<float> _weighted_weight; // 0 for inactive bins
+    
+    std::vector<float> _power; // squared norm of each row
+    std::vector<float> _scale; // 1 / norm of each row (times the quantization step for int8 rows)
+    
+    // low rank: basis vectors (_stride values each, by decreasing eigenvalue, all features of them),
+    // and the coordinates (_rank_stride each) and 1 / norm of each dense row
+    size_t _rank;
+    size_t _rank_stride; // rank rounded up to SIMD_WIDTH
+    bool _basis_valid;
+    std::vector<double> _eigenvalues;
+    std::vector<float> _basis;
+    std::vector<float> _coordinates;
+    std::vector<float> _coordinate_scale;
+    
+    std::vector<float> _signal; // padded copy of the signal column(s)
+    std::vector<float> _signal_sq; // and its square
+    std::vector<float> _signal_power; // squared norm of each signal column
+    std::vector<float> _signal_scale; // 1 / norm of each signal column
+    std::vector<float> _projected; // coordinates of each signal column, at low rank
+};
+
+#endif /* TemplateBank_hpp */
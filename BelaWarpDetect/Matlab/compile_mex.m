@@ -26,11 +26,6 @@ for i = 1:2:nparams
     eval([nm ' = varargin{i+1};']);
 end
 
-% check platform
-if ~ismac
-    error('Only supports the macOS platform (requires Accelerate framework).');
-end
-
 % print nice message
 fprintf('Compiling functions...\n');
 
@@ -70,14 +65,24 @@ end
 if ismac
     lf{end + 1} = '-framework Accelerate';
     lf{end + 1} = '-framework AudioToolbox';
+else
+    lf{end + 1} = '-lsndfile';
 end
 
 c{end + 1} = ['LDFLAGS="\$LDFLAGS ' strjoin(lf) '"'];
 
+% platform specific sources (macOS uses Accelerate and TPCircularBuffer, other platforms use the
+% built-in FFT and ring buffer)
+if ismac
+    platform = {'TPCircularBuffer/TPCircularBuffer.c'};
+else
+    platform = {'Library/FastFourierTransform.cpp'};
+end
+
 % call mex functions
-functions = {{'Matlab/dtm.cpp', 'Library/CircularShortTimeFourierTransform.cpp', 'Library/DynamicTimeMatcher.cpp', 'TPCircularBuffer/TPCircularBuffer.c'}, ...
-    {'Matlab/match_syllables.cpp', 'Library/CircularShortTimeFourierTransform.cpp', 'Library/DynamicTimeMatcher.cpp', 'Library/LoadAudio.cpp', 'Library/MatchSyllables.cpp', 'TPCircularBuffer/TPCircularBuffer.c'}, ...
-    {'Matlab/eval_syllable.cpp', 'Library/CircularShortTimeFourierTransform.cpp', 'Library/DynamicTimeMatcher.cpp', 'Library/LoadAudio.cpp', 'Library/MatchSyllables.cpp', 'TPCircularBuffer/TPCircularBuffer.c'}};
+functions = {[{'Matlab/dtm.cpp', 'Library/CircularShortTimeFourierTransform.cpp', 'Library/DynamicTimeMatcher.cpp', 'Library/TemplateBank.cpp'} platform], ...
+    [{'Matlab/match_syllables.cpp', 'Library/CircularShortTimeFourierTransform.cpp', 'Library/DynamicTimeMatcher.cpp', 'Library/TemplateBank.cpp', 'Library/LoadAudio.cpp', 'Library/MatchSyllables.cpp', 'Library/FilterBank.cpp'} platform], ...
+    [{'Matlab/eval_syllable.cpp', 'Library/CircularShortTimeFourierTransform.cpp', 'Library/DynamicTimeMatcher.cpp', 'Library/TemplateBank.cpp', 'Library/LoadAudio.cpp', 'Library/MatchSyllables.cpp', 'Library/FilterBank.cpp'} platform]};
 for j = 1:length(functions)
     if iscell(functions{j})
         fprintf('%s\n', functions{j}{1});
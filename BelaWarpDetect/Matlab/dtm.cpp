@@ -38,7 +38,6 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     unsigned int idx_hi = stft.ConvertFrequencyToIndex(freq_hi, sampling_rate);
     
     /* allocate space for outputs */
-    unsigned int len_feature = stft.GetLengthPower();
     unsigned int len_templ = stft.ConvertSamplesToColumns(templ.size());
     unsigned int len_signal = stft.ConvertSamplesToColumns(signal.size());
     
@@ -47,12 +46,11 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     std::vector<float> col;
     std::vector<std::vector<float>> features_templ;
     for (unsigned int i = 0; i < len_templ; ++i) {
-        if (!stft.ReadPower(col)) {
+        if (!stft.ReadPower(col, idx_lo, idx_hi)) {
             mexErrMsgIdAndTxt("MATLAB:dtm:internalError", "Unable to generate expected number of spectral columns for the template.");
         }
         
-        // slice, slow
-        features_templ.push_back(std::vector<float>(col.begin() + idx_lo, col.begin() + idx_hi));
+        features_templ.push_back(col);
     }
     
     /* make matcher */
@@ -66,16 +64,18 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     plhs[1] = mxCreateDoubleMatrix(1, len_signal, mxREAL);
     lengths = mxGetPr(plhs[1]);
     
-    /* process signal */
+    /* process signal (all columns in one batched read) */
     stft.Clear();
     stft.WriteValues(signal);
+    unsigned int len_feature = idx_hi - idx_lo;
+    std::vector<float> features_signal(len_signal * len_feature);
+    if (len_signal > 0 && len_signal != stft.ReadPowerBatch(&features_signal[0], len_signal, idx_lo, idx_hi)) {
+        mexErrMsgIdAndTxt("MATLAB:dtm:internalError", "Unable to generate expected number of spectral columns for the signal.");
+    }
+    
     for (unsigned int i = 0; i < len_signal; ++i) {
-        if (!stft.ReadPower(col)) {
-            mexErrMsgIdAndTxt("MATLAB:dtm:internalError", "Unable to generate expected number of spectral columns for the signal.");
-        }
-        
         // result
-        auto result = dtm.IngestFeatureVector(std::vector<float>(col.begin() + idx_lo, col.begin() + idx_hi));
+        auto result = dtm.IngestFeatureVector(&features_signal[i * len_feature]);
         
         // append to results
         scores[i] = static_cast<double>(result.score);
@@ -77,5 +77,11 @@ for syllable = syllables
         fh = fopen(fullfile(pth, 'bela', nm), 'w');
         fwrite(fh, v(:), 'single');
         fclose(fh);
+        
+        % weights, same layout (for MatchSyllables::AddSpectrogram with a weights file)
+        v = single(weights);
+        fh = fopen(fullfile(pth, 'bela', strrep(nm, '.bin', '_weights.bin')), 'w');
+        fwrite(fh, v(:), 'single');
+        fclose(fh);
     end
 end
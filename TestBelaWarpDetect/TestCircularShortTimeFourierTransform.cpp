@@ -7,6 +7,8 @@
 //
 
 #include <stdio.h>
+#include <algorithm>
+#include <thread>
 
 #include "catch.hpp"
 
@@ -15,7 +17,7 @@
 #define COMPARE_FLOAT(a, b) (abs((a) - (b)) < 1e-6)
 #define COMPARE_FLOAT_THRESH(a, b, threshold) (abs((a) - (b)) < threshold)
 
-#if defined(BELA_MAJOR_VERSION)
+#if !defined(STFT_TPCIRCULARBUFFER)
 #define STFT_EMPTY_CAPACITY(a) (a - 1)
 #else
 #define STFT_EMPTY_CAPACITY(a) (a)
@@ -183,4 +185,333 @@ TEST_CASE("Testing Circular STFT Buffer") {
             CHECK(COMPARE_FLOAT_THRESH(power[i], 0.0, 1e-4));
         }
     }
+    SECTION("Band Matches Full") {
+        CircularShortTermFourierTransform stft_band(window_length, 224, buffer_size);
+        stft.SetWindowHanning();
+        stft_band.SetWindowHanning();
+        
+        // add values
+        std::vector<float> values = std::vector<float>(window_length);
+        for (unsigned int i = 0; i < window_length; ++i) {
+            values[i] = sin(0.3 * i) + 0.2 * cos(1.7 * i);
+        }
+        stft.WriteValues(values);
+        stft_band.WriteValues(values);
+        
+        // invalid bands
+        std::vector<float> band;
+        CHECK_FALSE(stft_band.ReadPower(band, 10, 10));
+        CHECK_FALSE(stft_band.ReadPower(band, 10, power_length + 1));
+        
+        // full power and band power
+        std::vector<float> power;
+        REQUIRE(stft.ReadPower(power));
+        REQUIRE(stft_band.ReadPower(band, 10, power_length));
+        REQUIRE(band.size() == power_length - 10);
+        for (unsigned int i = 10; i < power_length; ++i) {
+            CHECK(COMPARE_FLOAT_THRESH(band[i - 10], power[i], 1e-4));
+        }
+    }
+    
+    SECTION("Batch Matches Sequential") {
+        CircularShortTermFourierTransform stft_batch(window_length, 224, buffer_size);
+        stft.SetWindowHanning();
+        stft_batch.SetWindowHanning();
+        
+        // add values (enough for a partial batch)
+        std::vector<float> values = std::vector<float>(window_length + 10 * 224);
+        for (unsigned int i = 0; i < values.size(); ++i) {
+            values[i] = sin(0.3 * i) + 0.2 * cos(1.7 * i + 0.01 * i * i);
+        }
+        stft.WriteValues(values);
+        stft_batch.WriteValues(values);
+        
+        // read more columns than available
+        unsigned int columns = stft.GetLengthColumns();
+        std::vector<float> batch((columns + 3) * (power_length - 10));
+        REQUIRE(stft_batch.ReadPowerBatch(&batch[0], columns + 3, 10, power_length) == columns);
+        CHECK(stft_batch.GetLengthColumns() == 0);
+        
+        // compare to sequential reads
+        std::vector<float> band;
+        for (unsigned int c = 0; c < columns; ++c) {
+            REQUIRE(stft.ReadPower(band, 10, power_length));
+            for (unsigned int i = 0; i < band.size(); ++i) {
+                CHECK(COMPARE_FLOAT_THRESH(batch[c * band.size() + i], band[i], 1e-4));
+            }
+        }
+    }
+    
+    SECTION("Wrap Around") {
+        CircularShortTermFourierTransform stft_large(window_length, 224, 8 * buffer_size);
+        stft.SetWindowHanning();
+        stft_large.SetWindowHanning();
+        
+        // stream through the small buffer several times, comparing against a buffer that never wraps
+        std::vector<float> block(1000), expected, actual;
+        for (unsigned int b = 0; b < 20; ++b) {
+            for (unsigned int i = 0; i < block.size(); ++i) {
+                block[i] = sin(0.05 * (b * block.size() + i));
+            }
+            REQUIRE(stft.WriteValues(&block[0], 500, 2));
+            REQUIRE(stft_large.WriteValues(&block[0], 500, 2));
+            
+            while (stft_large.ReadPower(expected)) {
+                REQUIRE(stft.ReadPower(actual));
+                for (unsigned int i = 0; i < power_length; ++i) {
+                    CHECK(actual[i] == expected[i]);
+                }
+            }
+            CHECK(stft.GetLengthValues() == stft_large.GetLengthValues());
+        }
+    }
+    
+    SECTION("Q15 Samples") {
+        CircularShortTermFourierTransform stft_float(window_length, 224, buffer_size);
+        stft.SetWindowHanning();
+        stft_float.SetWindowHanning();
+        
+        // interleaved 16-bit samples (every other one used) against the same values as float
+        std::vector<int16_t> block(2 * 2000);
+        std::vector<float> block_float(2000);
+        for (unsigned int i = 0; i < block_float.size(); ++i) {
+            block[2 * i] = static_cast<int16_t>(floor(20000.0 * sin(0.07 * i) + 0.5));
+            block[2 * i + 1] = 32767;
+            block_float[i] = block[2 * i] / 32768.f;
+        }
+        REQUIRE(stft.WriteValues(&block[0], 2000, 2));
+        REQUIRE(stft_float.WriteValues(block_float));
+        CHECK(stft.GetLengthValues() == stft_float.GetLengthValues());
+        
+        std::vector<float> expected, actual;
+        unsigned int columns = 0;
+        while (stft_float.ReadPower(expected)) {
+            REQUIRE(stft.ReadPower(actual));
+            for (unsigned int i = 0; i < power_length; ++i) {
+                CHECK(COMPARE_FLOAT_THRESH(actual[i], expected[i], 1e-3 * (1.0 + expected[i])));
+            }
+            ++columns;
+        }
+        CHECK(columns == 8);
+    }
+    
+    SECTION("Log Power") {
+        CircularShortTermFourierTransform stft_log(window_length, 224, buffer_size);
+        stft_log.SetLogPower(true);
+        
+        // wide range of magnitudes
+        std::vector<float> values = std::vector<float>(window_length + 15 * 224);
+        for (unsigned int i = 0; i < values.size(); ++i) {
+            values[i] = pow(10.0, (i % 1000) / 200.0 - 2.0) * sin(0.3 * i);
+        }
+        REQUIRE(stft.WriteValues(values));
+        REQUIRE(stft_log.WriteValues(values));
+        
+        std::vector<float> power, power_log;
+        while (stft.ReadPower(power, 3, power_length)) {
+            REQUIRE(stft_log.ReadPower(power_log, 3, power_length));
+            for (unsigned int i = 0; i < power.size(); ++i) {
+                CHECK(COMPARE_FLOAT_THRESH(power_log[i], log1p(power[i]), 1e-5 * (1.0 + log1p(power[i]))));
+            }
+        }
+    }
+    
+    SECTION("Overruns") {
+        // not a full column yet (nothing lost)
+        std::vector<float> power;
+        CHECK_FALSE(stft.ReadPower(power));
+        CHECK(stft.GetOverruns() == 0);
+        
+        std::vector<float> values(buffer_size + 1, 1.0);
+        CHECK_FALSE(stft.WriteValues(values));
+        CHECK(stft.GetOverruns() == 1);
+        
+        stft.ResetCounters();
+        CHECK(stft.GetOverruns() == 0);
+    }
+    
+    SECTION("Concurrent Producer") {
+        CircularShortTermFourierTransform stft_reference(window_length, 224, 64 * buffer_size);
+        
+        // signal
+        std::vector<float> values(window_length + 1000 * 224);
+        for (unsigned int i = 0; i < values.size(); ++i) {
+            values[i] = sin(0.01 * i) + 0.1 * cos(0.77 * i);
+        }
+        
+        // expected columns
+        REQUIRE(stft_reference.WriteValues(values));
+        std::vector<std::vector<float>> expected;
+        std::vector<float> col;
+        while (stft_reference.ReadPower(col)) {
+            expected.push_back(col);
+        }
+        
+        // write from another thread in small blocks, retrying when full
+        std::thread producer([&]() {
+            for (unsigned int i = 0; i < values.size(); i += 128) {
+                unsigned int len = std::min(128u, static_cast<unsigned int>(values.size()) - i);
+                while (!stft.WriteValues(&values[i], len)) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        
+        // read all columns
+        unsigned int mismatched = 0;
+        for (unsigned int c = 0; c < expected.size(); ) {
+            if (!stft.ReadPower(col)) {
+                std::this_thread::yield();
+                continue;
+            }
+            if (col != expected[c]) {
+                ++mismatched;
+            }
+            ++c;
+        }
+        producer.join();
+        
+        CHECK(mismatched == 0);
+    }
+    
+    SECTION("Sliding DFT") {
+        CircularShortTermFourierTransform stft_sliding(window_length, 60, buffer_size);
+        
+        // window must match FFT length
+        CircularShortTermFourierTransform stft_odd(200, 60, buffer_size);
+        CHECK_FALSE(stft_odd.SetSlidingDFT(true));
+        
+        // add values
+        std::vector<float> values = std::vector<float>(window_length + 40 * 60);
+        for (unsigned int i = 0; i < values.size(); ++i) {
+            values[i] = sin(0.3 * i) + 0.2 * cos(1.7 * i + 0.001 * i * i);
+        }
+        
+        // periodic hann (exact in the frequency domain) and the default hann window
+        std::vector<float> periodic(window_length);
+        for (unsigned int i = 0; i < window_length; ++i) {
+            periodic[i] = 0.5 - 0.5 * cos(2.0 * M_PI * i / window_length);
+        }
+        for (int hann = 0; hann < 2; ++hann) {
+            CAPTURE(hann);
+            
+            CircularShortTermFourierTransform stft_fft(window_length, 60, buffer_size);
+            if (hann) {
+                stft_fft.SetWindowHanning();
+                stft_sliding.SetWindowHanning();
+            }
+            else {
+                stft_fft.SetWindow(periodic);
+                stft_sliding.SetWindow(periodic);
+            }
+            REQUIRE(stft_sliding.SetSlidingDFT(true, 16));
+            
+            stft_sliding.Clear();
+            stft_fft.WriteValues(values);
+            stft_sliding.WriteValues(values);
+            
+            // compare all columns (crosses several anchors), relative to the peak
+            std::vector<float> expected, actual;
+            while (stft_fft.ReadPower(expected, 10, 110)) {
+                REQUIRE(stft_sliding.ReadPower(actual, 10, 110));
+                float peak = *std::max_element(expected.begin(), expected.end());
+                for (unsigned int i = 0; i < expected.size(); ++i) {
+                    CHECK(COMPARE_FLOAT_THRESH(actual[i], expected[i], (hann ? 2e-3 : 1e-4) * peak));
+                }
+            }
+            CHECK(stft_sliding.GetLengthColumns() == 0);
+        }
+        
+        // triangular window (needs more taps than the kernel allows)
+        std::vector<float> triangle(window_length);
+        for (unsigned int i = 0; i < window_length; ++i) {
+            triangle[i] = 1.0 - std::abs(2.0 * i / window_length - 1.0);
+        }
+        CircularShortTermFourierTransform stft_triangle(window_length, 60, buffer_size);
+        stft_triangle.SetWindow(triangle);
+        CHECK_FALSE(stft_triangle.SetSlidingDFT(true));
+        CHECK_FALSE(stft_triangle.GetSlidingDFT());
+        
+        // set while sliding, falls back to the FFT
+        REQUIRE(stft_sliding.GetSlidingDFT());
+        stft_sliding.SetWindow(triangle);
+        CHECK_FALSE(stft_sliding.GetSlidingDFT());
+        
+        stft_sliding.Clear();
+        stft_triangle.WriteValues(values);
+        stft_sliding.WriteValues(values);
+        std::vector<float> expected, actual;
+        while (stft_triangle.ReadPower(expected, 10, 110)) {
+            REQUIRE(stft_sliding.ReadPower(actual, 10, 110));
+            for (unsigned int i = 0; i < expected.size(); ++i) {
+                CHECK(COMPARE_FLOAT_THRESH(actual[i], expected[i], 1e-5));
+            }
+        }
+        CHECK(stft_sliding.GetLengthColumns() == 0);
+    }
+}
+
+TEST_CASE("Testing Circular STFT Shared Setup") {
+    unsigned int window_length = 512;
+    
+    // signal
+    std::vector<float> values(window_length + 20 * 60);
+    for (unsigned int i = 0; i < values.size(); ++i) {
+        values[i] = sin(0.05 * i) + 0.3 * cos(0.9 * i);
+    }
+    
+    // expected columns (first transform of this length sets up the plan and window)
+    std::vector<std::vector<float>> expected;
+    {
+        CircularShortTermFourierTransform stft(window_length, 60);
+        stft.SetWindowHanning();
+        REQUIRE(stft.WriteValues(values));
+        std::vector<float> col;
+        while (stft.ReadPower(col)) {
+            expected.push_back(col);
+        }
+    }
+    REQUIRE(expected.size() == 21);
+    
+    SECTION("Windows Match") {
+        CircularShortTermFourierTransform stft_a(window_length, 60), stft_b(window_length, 60);
+        stft_a.SetWindowHanning();
+        stft_b.SetWindowHanning();
+        CHECK(stft_a.GetWindow() == stft_b.GetWindow());
+        
+        // changing one window does not change the other
+        stft_a.SetWindowHamming();
+        CHECK(stft_a.GetWindow() != stft_b.GetWindow());
+        stft_a.SetWindowHanning();
+        CHECK(stft_a.GetWindow() == stft_b.GetWindow());
+    }
+    
+    SECTION("Concurrent Instances") {
+        // several threads repeatedly create transforms (reusing pooled plans) and use them at once
+        const unsigned int threads = 4;
+        std::vector<unsigned int> mismatched(threads, 0);
+        std::vector<std::thread> workers;
+        for (unsigned int t = 0; t < threads; ++t) {
+            workers.push_back(std::thread([&, t]() {
+                for (unsigned int r = 0; r < 10; ++r) {
+                    CircularShortTermFourierTransform stft(window_length, 60);
+                    stft.SetWindowHanning();
+                    stft.WriteValues(values);
+                    std::vector<float> col;
+                    for (unsigned int c = 0; stft.ReadPower(col); ++c) {
+                        if (c >= expected.size() || col != expected[c]) {
+                            ++mismatched[t];
+                        }
+                    }
+                }
+            }));
+        }
+        for (auto it = workers.begin(); it != workers.end(); ++it) {
+            it->join();
+        }
+        
+        for (unsigned int t = 0; t < threads; ++t) {
+            CHECK(mismatched[t] == 0);
+        }
+    }
 }
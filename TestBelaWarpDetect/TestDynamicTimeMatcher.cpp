@@ -0,0 +1,425 @@
+//
+//  TestDynamicTimeMatcher.cpp
+//  TestBelaWarpDetect
+//
+
+#include <stdio.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "DynamicTimeMatcher.hpp"
+
+#define COMPARE_FLOAT_THRESH(a, b, threshold) (std::abs((a) - (b)) < threshold)
+
+// straightforward dynamic time matching (cosine distance computed from scratch for every cell)
+class ReferenceTimeMatcher
+{
+public:
+    ReferenceTimeMatcher(const std::vector<std::vector<float>> &templ, float alpha, int band = std::numeric_limits<int>::max()) : _templ(templ), _alpha(alpha), _band(band), _last(templ.size() + 1), _last_len(templ.size() + 1) {
+        Reset();
+    }
+    
+    void Reset() {
+        _last[0] = 0.f;
+        _last_len[0] = 0;
+        for (size_t i = 1; i < _last.size(); ++i) {
+            _last[i] = std::numeric_limits<float>::max();
+            _last_len[i] = 0;
+        }
+    }
+    
+    struct dtm_out IngestFeatureVector(const std::vector<float> &features) {
+        std::vector<float> cur(_last.size());
+        std::vector<unsigned int> cur_len(_last.size());
+        cur[0] = 0.f;
+        cur_len[0] = 0;
+        for (size_t i = 0; i < _templ.size(); ++i) {
+            double dot = 0, norm_t = 0, norm_s = 0;
+            for (size_t j = 0; j < features.size(); ++j) {
+                dot += _templ[i][j] * features[j];
+                norm_t += _templ[i][j] * _templ[i][j];
+                norm_s += features[j] * features[j];
+            }
+            
+            float cost = (norm_t < 0.5 && norm_s < 0.5) ? 0.f : static_cast<float>(1.0 - dot / (sqrt(norm_t) * sqrt(norm_s)));
+            if (std::isnan(cost)) {
+                cur[i + 1] = _last[i];
+                cur_len[i + 1] = _last_len[i] + 1;
+                continue;
+            }
+            
+            cur[i + 1] = _last[i] + cost;
+            cur_len[i + 1] = _last_len[i] + 1;
+            // up and left only within the band (|path length - template position| < band)
+            if (cur[i] + cost * _alpha < cur[i + 1] && static_cast<int>(i + 1) - static_cast<int>(cur_len[i]) < _band) {
+                cur[i + 1] = cur[i] + cost * _alpha;
+                cur_len[i + 1] = cur_len[i];
+            }
+            if (_last[i + 1] + cost * _alpha < cur[i + 1] && static_cast<int>(_last_len[i + 1]) + 1 - static_cast<int>(i + 1) < _band) {
+                cur[i + 1] = _last[i + 1] + cost * _alpha;
+                cur_len[i + 1] = _last_len[i + 1] + 1;
+            }
+        }
+        _last = cur;
+        _last_len = cur_len;
+        
+        struct dtm_out ret = {cur.back(), 0.f, static_cast<int>(cur_len.back()) - static_cast<int>(_templ.size())};
+        return ret;
+    }
+
+private:
+    std::vector<std::vector<float>> _templ;
+    float _alpha;
+    int _band;
+    std::vector<float> _last;
+    std::vector<unsigned int> _last_len;
+};
+
+// deterministic pseudo random features, with some silent (all zero) and quiet columns
+static std::vector<std::vector<float>> make_features(size_t length, size_t features, unsigned int seed) {
+    std::vector<std::vector<float>> ret(length, std::vector<float>(features));
+    for (size_t i = 0; i < length; ++i) {
+        float gain = (i % 7 == 3) ? 0.f : ((i % 5 == 1) ? 0.05f : 1.f);
+        for (size_t j = 0; j < features; ++j) {
+            seed = seed * 1103515245u + 12345u;
+            ret[i][j] = gain * static_cast<float>((seed >> 16) & 0x7fff) / 32768.f;
+        }
+    }
+    return ret;
+}
+
+TEST_CASE("Testing Dynamic Time Matcher") {
+    const size_t features = 40;
+    std::vector<std::vector<float>> templ = make_features(30, features, 1);
+    
+    SECTION("Invalid Arguments") {
+        std::vector<std::vector<float>> ragged = templ;
+        ragged[4].resize(features - 1);
+        CHECK_THROWS_AS(DynamicTimeMatcher(ragged), std::invalid_argument);
+        
+        // path lengths are 16 bits
+        std::vector<float> too_long(65535, 1.f);
+        CHECK_THROWS_AS(DynamicTimeMatcher(&too_long[0], too_long.size(), 1), std::invalid_argument);
+    }
+    
+    SECTION("Matches Reference") {
+        DynamicTimeMatcher dtm(templ);
+        REQUIRE(dtm.SetAlpha(1.5f));
+        ReferenceTimeMatcher ref(templ, 1.5f);
+        
+        std::vector<std::vector<float>> signal = make_features(200, features, 2);
+        for (size_t i = 0; i < signal.size(); ++i) {
+            if (i == 120) {
+                dtm.Reset();
+                ref.Reset();
+            }
+            
+            struct dtm_out out = dtm.IngestFeatureVector(signal[i]);
+            struct dtm_out expected = ref.IngestFeatureVector(signal[i]);
+            CAPTURE(i);
+            CHECK(COMPARE_FLOAT_THRESH(out.score, expected.score, 1e-4 * (1.f + expected.score)));
+            CHECK(out.len_diff == expected.len_diff);
+        }
+    }
+    
+    SECTION("Finds Template") {
+        DynamicTimeMatcher dtm(templ);
+        REQUIRE(dtm.GetLength() == templ.size());
+        REQUIRE(dtm.GetFeatures() == features);
+        
+        // noise, then the template itself
+        std::vector<std::vector<float>> signal = make_features(50, features, 3);
+        signal.insert(signal.end(), templ.begin(), templ.end());
+        
+        struct dtm_out out;
+        for (size_t i = 0; i < signal.size(); ++i) {
+            out = dtm.IngestFeatureVector(signal[i]);
+        }
+        CHECK(COMPARE_FLOAT_THRESH(out.score, 0.f, 1e-3));
+        CHECK(out.normalized_score > 0.99f);
+        CHECK(out.len_diff == 0);
+    }
+    
+    SECTION("Prunes Below Threshold") {
+        const float threshold = 0.8f;
+        DynamicTimeMatcher dtm(templ), pruned(templ);
+        REQUIRE(dtm.SetAlpha(1.5f));
+        REQUIRE(pruned.SetAlpha(1.5f));
+        REQUIRE(pruned.SetThreshold(threshold));
+        CHECK_FALSE(pruned.SetThreshold(1.5f));
+        
+        // noise with the template (and a slower copy) in between
+        std::vector<std::vector<float>> signal = make_features(80, features, 4);
+        signal.insert(signal.end(), templ.begin(), templ.end());
+        for (size_t i = 0; i < templ.size(); ++i) {
+            signal.push_back(templ[i]);
+            if (i % 4 == 0) {
+                signal.push_back(templ[i]);
+            }
+        }
+        std::vector<std::vector<float>> noise = make_features(60, features, 5);
+        signal.insert(signal.end(), noise.begin(), noise.end());
+        
+        // results that can reach the threshold are unchanged
+        size_t above = 0;
+        for (size_t i = 0; i < signal.size(); ++i) {
+            struct dtm_out expected = dtm.IngestFeatureVector(signal[i]);
+            struct dtm_out out = pruned.IngestFeatureVector(signal[i]);
+            CAPTURE(i);
+            if (expected.normalized_score >= threshold) {
+                ++above;
+                CHECK(out.score == expected.score);
+                CHECK(out.len_diff == expected.len_diff);
+            }
+            else {
+                CHECK(out.normalized_score <= expected.normalized_score);
+            }
+        }
+        CHECK(above > 0);
+        
+        // most of the work is skipped
+        CHECK(pruned.GetColumns() == signal.size());
+        CHECK(pruned.GetPrunedColumns() > signal.size() / 2);
+        CHECK(pruned.GetUpdatedRows() < signal.size() * templ.size());
+        CHECK(dtm.GetPrunedColumns() == 0);
+        CHECK(dtm.GetUpdatedRows() == signal.size() * templ.size());
+    }
+    
+    SECTION("Length Band") {
+        // the template, slowed down by half, between noise
+        std::vector<std::vector<float>> signal = make_features(40, features, 6);
+        for (size_t i = 0; i < templ.size(); ++i) {
+            signal.push_back(templ[i]);
+            if (i % 2 == 0) {
+                signal.push_back(templ[i]);
+            }
+        }
+        std::vector<std::vector<float>> noise = make_features(40, features, 7);
+        signal.insert(signal.end(), noise.begin(), noise.end());
+        
+        for (float threshold_length : {4.f, 7.5f, 20.f}) {
+            DynamicTimeMatcher dtm(templ);
+            REQUIRE(dtm.SetAlpha(1.5f));
+            REQUIRE(dtm.SetLengthConstraint(threshold_length));
+            CHECK_FALSE(dtm.SetLengthConstraint(-1.f));
+            ReferenceTimeMatcher ref(templ, 1.5f, static_cast<int>(ceil(threshold_length)));
+            
+            float best = 0.f;
+            for (size_t i = 0; i < signal.size(); ++i) {
+                struct dtm_out out = dtm.IngestFeatureVector(signal[i]);
+                struct dtm_out expected = ref.IngestFeatureVector(signal[i]);
+                CAPTURE(threshold_length);
+                CAPTURE(i);
+                CHECK(COMPARE_FLOAT_THRESH(out.score, expected.score, 1e-4 * (1.f + expected.score)));
+                CHECK(out.len_diff == expected.len_diff);
+                if (out.normalized_score > 0.f) {
+                    CHECK(std::abs(static_cast<float>(out.len_diff)) < threshold_length);
+                }
+                best = std::max(best, out.normalized_score);
+            }
+            
+            // the slowed down template (15 columns longer) is only found with a wide enough band
+            if (threshold_length > 15.f) {
+                CHECK(best > 0.9f);
+            }
+            else {
+                CHECK(best < 0.9f);
+            }
+        }
+    }
+    
+    SECTION("Shares Prefix") {
+        // same opening as the template, then different rows
+        const size_t shared = 12;
+        std::vector<std::vector<float>> other(templ.begin(), templ.begin() + shared);
+        std::vector<std::vector<float>> rest = make_features(18, features, 10);
+        other.insert(other.end(), rest.begin(), rest.end());
+        std::vector<float> flat;
+        for (size_t i = 0; i < other.size(); ++i) {
+            flat.insert(flat.end(), other[i].begin(), other[i].end());
+        }
+        TemplateBank bank(features);
+        bank.AddTemplate(&flat[0], other.size());
+        
+        // noise, the other template, noise, then the template
+        std::vector<std::vector<float>> signal = make_features(40, features, 11);
+        signal.insert(signal.end(), other.begin(), other.end());
+        std::vector<std::vector<float>> noise = make_features(30, features, 12);
+        signal.insert(signal.end(), noise.begin(), noise.end());
+        signal.insert(signal.end(), templ.begin(), templ.end());
+        
+        for (int mode = 0; mode < 3; ++mode) {
+            DynamicTimeMatcher first(templ), plain(other), shared_dtm(other);
+            REQUIRE(first.SetAlpha(1.5f));
+            REQUIRE(plain.SetAlpha(1.5f));
+            REQUIRE(shared_dtm.SetAlpha(1.5f));
+            REQUIRE(first.CommonPrefix(plain) == shared);
+            
+            // prefix matcher with the loosest bound, and the same band
+            DynamicTimeMatcher prefix(first, shared);
+            REQUIRE(prefix.GetLength() == shared);
+            if (mode == 1) {
+                REQUIRE(plain.SetThreshold(0.8f));
+                REQUIRE(shared_dtm.SetThreshold(0.8f));
+                REQUIRE(prefix.SetBound(shared_dtm.GetBound()));
+            }
+            if (mode == 2) {
+                REQUIRE(plain.SetLengthConstraint(7.5f));
+                REQUIRE(shared_dtm.SetLengthConstraint(7.5f));
+                REQUIRE(prefix.SetLengthConstraint(7.5f));
+            }
+            CHECK_FALSE(shared_dtm.SetPrefix(other.size()));
+            REQUIRE(shared_dtm.SetPrefix(shared));
+            
+            std::vector<float> costs(other.size());
+            for (size_t i = 0; i < signal.size(); ++i) {
+                struct dtm_out expected = plain.IngestFeatureVector(signal[i]);
+                bank.CalculateCosts(&signal[i][0], &costs[0]);
+                struct dtm_out out = shared_dtm.IngestCostVector(&costs[shared], prefix.IngestCostVector(&costs[0]));
+                CAPTURE(mode);
+                CAPTURE(i);
+                CHECK(out.score == expected.score);
+                CHECK(out.len_diff == expected.len_diff);
+            }
+            CHECK(shared_dtm.GetUpdatedRows() < plain.GetUpdatedRows());
+        }
+        
+        // repeated without a gap, with the matchers (and the prefix) reset one column after the
+        // first ends (as after a detection), while the prefix is already on the second
+        std::vector<std::vector<float>> repeated = make_features(40, features, 13);
+        repeated.insert(repeated.end(), other.begin(), other.end());
+        repeated.insert(repeated.end(), other.begin(), other.end());
+        repeated.insert(repeated.end(), noise.begin(), noise.end());
+        {
+            DynamicTimeMatcher first(templ), plain(other), shared_dtm(other);
+            DynamicTimeMatcher prefix(first, shared), running(first, shared);
+            REQUIRE(shared_dtm.SetPrefix(shared));
+            
+            std::vector<float> costs(other.size());
+            float best_plain = 0.f;
+            size_t same = 0;
+            for (size_t i = 0; i < repeated.size(); ++i) {
+                struct dtm_out expected = plain.IngestFeatureVector(repeated[i]);
+                bank.CalculateCosts(&repeated[i][0], &costs[0]);
+                struct dtm_out out = shared_dtm.IngestCostVector(&costs[shared], prefix.IngestCostVector(&costs[0]));
+                running.IngestCostVector(&costs[0]);
+                CAPTURE(i);
+                CHECK(out.score == expected.score);
+                CHECK(out.len_diff == expected.len_diff);
+                if (i > 40 + other.size()) {
+                    best_plain = std::max(best_plain, expected.normalized_score);
+                }
+                if (i == 40 + other.size()) {
+                    plain.Reset();
+                    shared_dtm.Reset();
+                    prefix.Reset();
+                    CHECK_FALSE(prefix.SameState(running));
+                }
+                
+                // back to the same state once paths that started before the reset are no longer the
+                // best through the prefix
+                if (i > 40 + other.size() && same == 0 && prefix.SameState(running)) {
+                    same = i;
+                }
+            }
+            CHECK(best_plain > 0.8f);
+            CHECK(same > 0);
+        }
+        
+        // a different alpha ends the prefix
+        DynamicTimeMatcher first(templ), different(other);
+        std::vector<float> alpha(other.size(), 1.f);
+        alpha[5] = 2.f;
+        REQUIRE(different.SetAlpha(alpha));
+        CHECK(first.CommonPrefix(different) == 5);
+    }
+    
+    SECTION("Shared State") {
+        std::vector<std::vector<float>> other = make_features(45, features, 10);
+        std::vector<std::vector<float>> signal = make_features(120, features, 11);
+        
+        DynamicTimeMatcher own(templ), first(templ), second(other), second_own(other);
+        REQUIRE(own.SetAlpha(1.5f));
+        REQUIRE(first.SetAlpha(1.5f));
+        REQUIRE(second_own.SetThreshold(0.2f));
+        CHECK(first.GetStateSize() % DTM_STATE_ALIGN == 0);
+        
+        // both matchers in one arena, after the first has ingested some columns
+        for (size_t i = 0; i < 40; ++i) {
+            first.IngestFeatureVector(signal[i]);
+            own.IngestFeatureVector(signal[i]);
+        }
+        std::vector<float> arena((first.GetStateSize() + second.GetStateSize() + DTM_STATE_ALIGN) / sizeof(float));
+        char *state = reinterpret_cast<char *>(&arena[0]);
+        state += (DTM_STATE_ALIGN - reinterpret_cast<uintptr_t>(state) % DTM_STATE_ALIGN) % DTM_STATE_ALIGN;
+        CHECK_FALSE(first.SetState(state + sizeof(float)));
+        REQUIRE(first.SetState(state));
+        REQUIRE(second.SetState(state + first.GetStateSize()));
+        REQUIRE(second.SetThreshold(0.2f));
+        
+        for (size_t i = 40; i < signal.size(); ++i) {
+            // copies keep their own state
+            if (i == 80) {
+                DynamicTimeMatcher copy(first);
+                CHECK(copy.IngestFeatureVector(signal[i]).score == own.IngestFeatureVector(signal[i]).score);
+                own.Reset();
+                own.IngestFeatureVector(signal[i - 1]);
+                REQUIRE(first.SetState(NULL));
+                first.Reset();
+                first.IngestFeatureVector(signal[i - 1]);
+            }
+            
+            struct dtm_out a = first.IngestFeatureVector(signal[i]), expected = own.IngestFeatureVector(signal[i]);
+            struct dtm_out b = second.IngestFeatureVector(signal[i]), expected_b = second_own.IngestFeatureVector(signal[i]);
+            CAPTURE(i);
+            CHECK(a.score == expected.score);
+            CHECK(a.len_diff == expected.len_diff);
+            CHECK(b.score == expected_b.score);
+            CHECK(b.len_diff == expected_b.len_diff);
+        }
+    }
+    
+    SECTION("Ingests Several Columns") {
+        // long enough for several blocks of template rows
+        std::vector<std::vector<float>> long_templ = make_features(300, features, 8);
+        std::vector<std::vector<float>> signal = make_features(90, features, 9);
+        signal.insert(signal.end(), long_templ.begin(), long_templ.begin() + 100);
+        std::vector<float> flat;
+        for (size_t i = 0; i < signal.size(); ++i) {
+            flat.insert(flat.end(), signal[i].begin(), signal[i].end());
+        }
+        
+        for (float threshold_length : {0.f, 12.f}) {
+            DynamicTimeMatcher single(long_templ), multi(long_templ);
+            REQUIRE(single.SetAlpha(1.5f));
+            REQUIRE(multi.SetAlpha(1.5f));
+            REQUIRE(single.SetLengthConstraint(threshold_length));
+            REQUIRE(multi.SetLengthConstraint(threshold_length));
+            
+            // uneven batches, mixed with single columns
+            std::vector<struct dtm_out> out(signal.size());
+            size_t c = 0;
+            for (size_t n : {1, 7, 32, 0, 50}) {
+                multi.IngestFeatureMatrix(&flat[c * features], n, &out[c]);
+                c += n;
+            }
+            for (; c < signal.size(); ++c) {
+                out[c] = multi.IngestFeatureVector(signal[c]);
+            }
+            
+            for (size_t i = 0; i < signal.size(); ++i) {
+                struct dtm_out expected = single.IngestFeatureVector(signal[i]);
+                CAPTURE(threshold_length);
+                CAPTURE(i);
+                CHECK(out[i].score == expected.score);
+                CHECK(out[i].len_diff == expected.len_diff);
+            }
+            CHECK(multi.GetColumns() == signal.size());
+        }
+    }
+}
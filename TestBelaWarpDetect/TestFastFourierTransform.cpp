@@ -0,0 +1,114 @@
+//
+//  TestFastFourierTransform.cpp
+//  TestBelaWarpDetect
+//
+
+#include <stdio.h>
+#include <cmath>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "FastFourierTransform.hpp"
+#include "Simd.hpp"
+
+#define COMPARE_FLOAT_THRESH(a, b, threshold) (std::abs((a) - (b)) < threshold)
+
+TEST_CASE("Testing Fast Fourier Transform") {
+    SECTION("Invalid Length") {
+        CHECK_THROWS(FastFourierTransform(12));
+    }
+    
+    SECTION("Matches DFT") {
+        unsigned int lengths[] = {2, 4, 8, 16, 64, 512, 1024};
+        for (unsigned int length : lengths) {
+            CAPTURE(length);
+            
+            FastFourierTransform fft(length);
+            REQUIRE(fft.GetLengthOutput() == length / 2 + 1);
+            
+            // deterministic signal with a bit of everything
+            std::vector<float> signal(length);
+            for (unsigned int i = 0; i < length; ++i) {
+                signal[i] = static_cast<float>(sin(0.37 * i) + 0.5 * cos(1.91 * i) + 0.01 * (i % 7));
+            }
+            
+            std::vector<float> real(length / 2 + 1), imag(length / 2 + 1);
+            fft.Forward(&signal[0], &real[0], &imag[0]);
+            
+            // compare against naive DFT
+            for (unsigned int k = 0; k <= length / 2; ++k) {
+                double er = 0.0, ei = 0.0;
+                for (unsigned int n = 0; n < length; ++n) {
+                    double theta = 2.0 * M_PI * static_cast<double>(k) * static_cast<double>(n) / static_cast<double>(length);
+                    er += signal[n] * cos(theta);
+                    ei -= signal[n] * sin(theta);
+                }
+                
+                CAPTURE(k);
+                CHECK(COMPARE_FLOAT_THRESH(real[k], er, 1e-3 * length));
+                CHECK(COMPARE_FLOAT_THRESH(imag[k], ei, 1e-3 * length));
+            }
+        }
+    }
+    SECTION("Pruned Band") {
+        unsigned int length = 512;
+        FastFourierTransform fft(length);
+        
+        std::vector<float> signal(length);
+        for (unsigned int i = 0; i < length; ++i) {
+            signal[i] = static_cast<float>(sin(0.11 * i) - 0.3 * cos(2.3 * i));
+        }
+        
+        std::vector<float> real(length / 2 + 1), imag(length / 2 + 1);
+        fft.Forward(&signal[0], &real[0], &imag[0]);
+        
+        unsigned int bands[][2] = {{0, 1}, {10, 105}, {100, 257}, {255, 257}, {60, 70}};
+        for (auto band : bands) {
+            CAPTURE(band[0]);
+            CAPTURE(band[1]);
+            
+            std::vector<float> band_real(band[1] - band[0]), band_imag(band[1] - band[0]);
+            fft.Forward(&signal[0], &band_real[0], &band_imag[0], band[0], band[1]);
+            for (unsigned int k = band[0]; k < band[1]; ++k) {
+                CHECK(band_real[k - band[0]] == real[k]);
+                CHECK(band_imag[k - band[0]] == imag[k]);
+            }
+        }
+    }
+    SECTION("Batch") {
+        unsigned int length = 512;
+        FastFourierTransform fft(length);
+        
+        // up to one input per lane
+        std::vector<std::vector<float>> signals(SIMD_WIDTH, std::vector<float>(length));
+        const float *inputs[SIMD_WIDTH];
+        for (unsigned int t = 0; t < SIMD_WIDTH; ++t) {
+            for (unsigned int i = 0; i < length; ++i) {
+                signals[t][i] = static_cast<float>(sin(0.11 * (t + 1) * i) - 0.3 * cos(2.3 * i + t));
+            }
+            inputs[t] = &signals[t][0];
+        }
+        
+        unsigned int bands[][2] = {{0, 257}, {10, 105}, {255, 257}};
+        for (auto band : bands) {
+            for (unsigned int count = 1; count <= SIMD_WIDTH; ++count) {
+                CAPTURE(band[0]);
+                CAPTURE(count);
+                
+                unsigned int n = band[1] - band[0];
+                std::vector<float> batch_real(count * n), batch_imag(count * n);
+                fft.ForwardBatch(inputs, count, &batch_real[0], &batch_imag[0], band[0], band[1]);
+                
+                std::vector<float> real(n), imag(n);
+                for (unsigned int t = 0; t < count; ++t) {
+                    fft.Forward(inputs[t], &real[0], &imag[0], band[0], band[1]);
+                    for (unsigned int k = 0; k < n; ++k) {
+                        CHECK(COMPARE_FLOAT_THRESH(batch_real[t * n + k], real[k], 1e-3));
+                        CHECK(COMPARE_FLOAT_THRESH(batch_imag[t * n + k], imag[k], 1e-3));
+                    }
+                }
+            }
+        }
+    }
+}
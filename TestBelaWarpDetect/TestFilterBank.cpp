@@ -0,0 +1,92 @@
+//
+//  TestFilterBank.cpp
+//  TestBelaWarpDetect
+//
+
+#include <stdio.h>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "FilterBank.hpp"
+
+#define COMPARE_FLOAT_THRESH(a, b, threshold) (std::abs((a) - (b)) < threshold)
+
+TEST_CASE("Testing Filter Bank") {
+    // 44.1 kHz, 512 point FFT, 850 Hz to 9 kHz
+    const unsigned int idx_lo = 10, idx_hi = 105;
+    const float bin_width = 44100.f / 512.f;
+    
+    SECTION("Invalid Arguments") {
+        CHECK_THROWS_AS(FilterBank(0, idx_lo, idx_hi, bin_width), std::invalid_argument);
+        CHECK_THROWS_AS(FilterBank(32, idx_hi, idx_lo, bin_width), std::invalid_argument);
+        CHECK_THROWS_AS(FilterBank(32, 0, idx_hi, bin_width, true), std::invalid_argument);
+    }
+    
+    SECTION("Bands Cover Input") {
+        for (unsigned int bands : {32, 48, 64}) {
+            for (int log_spaced = 0; log_spaced < 2; ++log_spaced) {
+                CAPTURE(bands);
+                CAPTURE(log_spaced);
+                
+                FilterBank fb(bands, idx_lo, idx_hi, bin_width, log_spaced != 0);
+                REQUIRE(fb.GetLengthInput() == idx_hi - idx_lo);
+                REQUIRE(fb.GetLengthOutput() == bands);
+                
+                // every band has weight, and band peaks move up in frequency
+                unsigned int last_peak = 0;
+                for (unsigned int b = 0; b < bands; ++b) {
+                    float peak = 0.f;
+                    unsigned int peak_bin = 0;
+                    for (unsigned int i = 0; i < fb.GetLengthInput(); ++i) {
+                        float w = fb.GetWeight(b, i);
+                        CHECK(w >= 0.f);
+                        CHECK(w <= 1.f);
+                        if (w > peak) {
+                            peak = w;
+                            peak_bin = i;
+                        }
+                    }
+                    CHECK(peak > 0.f);
+                    CHECK(peak_bin >= last_peak);
+                    last_peak = peak_bin;
+                }
+            }
+        }
+    }
+    
+    SECTION("Apply") {
+        FilterBank fb(32, idx_lo, idx_hi, bin_width);
+        
+        // two columns
+        std::vector<float> input(2 * fb.GetLengthInput());
+        for (unsigned int i = 0; i < input.size(); ++i) {
+            input[i] = 1.f + static_cast<float>(i % 7);
+        }
+        
+        std::vector<float> single(fb.GetLengthOutput()), batch(2 * fb.GetLengthOutput());
+        fb.Apply(&input[0], &batch[0], 2);
+        for (unsigned int c = 0; c < 2; ++c) {
+            fb.Apply(&input[c * fb.GetLengthInput()], &single[0]);
+            for (unsigned int b = 0; b < fb.GetLengthOutput(); ++b) {
+                // matches dense weights
+                float expected = 0.f;
+                for (unsigned int i = 0; i < fb.GetLengthInput(); ++i) {
+                    expected += fb.GetWeight(b, i) * input[c * fb.GetLengthInput() + i];
+                }
+                CHECK(COMPARE_FLOAT_THRESH(single[b], expected, 1e-4));
+                CHECK(batch[c * fb.GetLengthOutput() + b] == single[b]);
+            }
+        }
+        
+        // log compression
+        std::vector<float> logged(fb.GetLengthOutput());
+        fb.SetLogPower(true);
+        fb.Apply(&input[0], &logged[0]);
+        for (unsigned int b = 0; b < fb.GetLengthOutput(); ++b) {
+            CHECK(COMPARE_FLOAT_THRESH(logged[b], std::log1p(batch[b]), 1e-5));
+        }
+    }
+}
@@ -0,0 +1,72 @@
+//
+//  TestFixedPointFourierTransform.cpp
+//  TestBelaWarpDetect
+//
+
+#include <stdio.h>
+#include <cmath>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "FixedPointFourierTransform.hpp"
+
+#define COMPARE_FLOAT_THRESH(a, b, threshold) (std::abs((a) - (b)) < threshold)
+
+TEST_CASE("Testing Fixed Point Fourier Transform") {
+    SECTION("Invalid Length") {
+        CHECK_THROWS(FixedPointFourierTransform(12));
+        CHECK_THROWS(FixedPointFourierTransform(65536));
+    }
+    
+    SECTION("Matches DFT") {
+        unsigned int lengths[] = {2, 4, 16, 512, 1024};
+        for (unsigned int length : lengths) {
+            CAPTURE(length);
+            
+            FixedPointFourierTransform fft(length);
+            REQUIRE(fft.GetLengthOutput() == length / 2 + 1);
+            
+            // Q15 signal, close to full scale
+            std::vector<int16_t> signal(length);
+            for (unsigned int i = 0; i < length; ++i) {
+                signal[i] = static_cast<int16_t>(floor(16000.0 * (sin(0.37 * i) + 0.5 * cos(1.91 * i)) + 0.5));
+            }
+            
+            std::vector<int32_t> real(length / 2 + 1), imag(length / 2 + 1);
+            fft.Forward(&signal[0], &real[0], &imag[0], 0, length / 2 + 1);
+            
+            // compare against naive DFT (error of a few units per stage)
+            for (unsigned int k = 0; k <= length / 2; ++k) {
+                double er = 0.0, ei = 0.0;
+                for (unsigned int n = 0; n < length; ++n) {
+                    double theta = 2.0 * M_PI * static_cast<double>(k) * static_cast<double>(n) / static_cast<double>(length);
+                    er += signal[n] * cos(theta);
+                    ei -= signal[n] * sin(theta);
+                }
+                
+                CAPTURE(k);
+                CHECK(COMPARE_FLOAT_THRESH(static_cast<double>(real[k]), er, 4.0 * log2(length)));
+                CHECK(COMPARE_FLOAT_THRESH(static_cast<double>(imag[k]), ei, 4.0 * log2(length)));
+            }
+        }
+    }
+    
+    SECTION("Band") {
+        unsigned int length = 512;
+        FixedPointFourierTransform fft(length);
+        
+        std::vector<int16_t> signal(length);
+        for (unsigned int i = 0; i < length; ++i) {
+            signal[i] = static_cast<int16_t>((i * 7919) % 65536 - 32768);
+        }
+        
+        std::vector<int32_t> real(length / 2 + 1), imag(length / 2 + 1), band_real(length / 2 + 1), band_imag(length / 2 + 1);
+        fft.Forward(&signal[0], &real[0], &imag[0], 0, length / 2 + 1);
+        fft.Forward(&signal[0], &band_real[0], &band_imag[0], 10, 105);
+        for (unsigned int k = 10; k < 105; ++k) {
+            CHECK(band_real[k - 10] == real[k]);
+            CHECK(band_imag[k - 10] == imag[k]);
+        }
+    }
+}
@@ -0,0 +1,234 @@
+//
+//  TestMatchSyllables.cpp
+//  TestBelaWarpDetect
+//
+
+#include <stdio.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "MatchSyllables.hpp"
+
+#define COMPARE_FLOAT_THRESH(a, b, threshold) (std::abs((a) - (b)) < threshold)
+
+struct match {
+    unsigned long column;
+    size_t index;
+    float score;
+    int len;
+};
+
+// callbacks are plain functions, so they record into globals
+static unsigned long g_column = 0;
+static std::vector<struct match> g_matches;
+static std::vector<std::vector<float>> g_scores;
+static std::vector<std::vector<int>> g_lengths;
+
+static void record_match(size_t index, float score, int len) {
+    struct match m = {g_column, index, score, len};
+    g_matches.push_back(m);
+}
+
+static void record_column(std::vector<float> scores, std::vector<int> lengths) {
+    g_scores.push_back(scores);
+    g_lengths.push_back(lengths);
+}
+
+// smooth sweep of band power (a chirp), from feature `from` to feature `to`
+static std::vector<float> make_chirp(size_t length, size_t features, float from, float to) {
+    std::vector<float> ret(length * features);
+    for (size_t i = 0; i < length; ++i) {
+        float center = from + (to - from) * static_cast<float>(i) / static_cast<float>(length);
+        for (size_t j = 0; j < features; ++j) {
+            float d = (static_cast<float>(j) - center) / 4.f;
+            ret[i * features + j] = 0.05f + expf(-d * d);
+        }
+    }
+    return ret;
+}
+
+// pseudo random background band power
+static std::vector<float> make_background(size_t length, size_t features, unsigned int seed) {
+    std::vector<float> ret(length * features);
+    for (size_t i = 0; i < ret.size(); ++i) {
+        seed = seed * 1103515245u + 12345u;
+        ret[i] = static_cast<float>((seed >> 16) & 0x7fff) / 32768.f;
+    }
+    return ret;
+}
+
+// match the signal with the given decimation, returning every match (and the scores of each column)
+static std::vector<struct match> run_matching(const std::vector<std::vector<float>> &templates, const std::vector<float> &signal, unsigned int decimation, float margin = 0.1f, bool share_prefixes = true) {
+    MatchSyllables ms(44100.f, 0, 65536);
+    const size_t features = ms.GetLengthFeatures();
+    REQUIRE(ms.SetCoarseToFine(decimation, margin));
+    REQUIRE(ms.SetPrefixSharing(share_prefixes));
+    for (size_t k = 0; k < templates.size(); ++k) {
+        ms.AddSpectrogram(&templates[k][0], templates[k].size() / features, features, 0.7f);
+    }
+    ms.SetCallbackMatch(record_match);
+    ms.SetCallbackColumn(record_column);
+    REQUIRE(ms.Initialize());
+    
+    g_matches.clear();
+    g_scores.clear();
+    g_lengths.clear();
+    for (g_column = 0; g_column < signal.size() / features; ++g_column) {
+        REQUIRE(ms.MatchPower(&signal[g_column * features]));
+    }
+    
+    return g_matches;
+}
+
+TEST_CASE("Testing Match Syllables") {
+    MatchSyllables sizing(44100.f, 0, 65536);
+    const size_t features = sizing.GetLengthFeatures();
+    
+    // an up sweep and a down sweep
+    std::vector<std::vector<float>> templates;
+    templates.push_back(make_chirp(40, features, 10.f, 70.f));
+    templates.push_back(make_chirp(64, features, 80.f, 20.f));
+    
+    SECTION("Weighted Templates") {
+        // a column without any weight at the cutoff is rejected
+        std::vector<float> weights(templates[0].size(), 1.f);
+        std::fill(weights.begin() + 5 * features, weights.begin() + 6 * features, 0.2f);
+        MatchSyllables ms(44100.f, 0, 65536);
+        CHECK(ms.AddSpectrogram(&templates[0][0], &weights[0], 40, features, 0.7f, 0.25f, 0.5f) == -1);
+        CHECK(ms.AddSpectrogram(&templates[0][0], &weights[0], 40, features, 0.7f) == 0);
+    }
+    
+    SECTION("Spectrogram Files") {
+        // band power or filter bank features, told apart by the file size
+        MatchSyllables ms(44100.f, 40, 65536);
+        const size_t band = ms.GetIndexHigh() - ms.GetIndexLow();
+        const char *file = "test_spectrogram.bin";
+        const size_t totals[] = {band * 3, ms.GetLengthFeatures() * 5, band * ms.GetLengthFeatures()};
+        const bool valid[] = {true, true, false}; // both fit the last, rejected rather than guessed
+        REQUIRE(totals[0] % ms.GetLengthFeatures() != 0);
+        REQUIRE(totals[1] % band != 0);
+        for (size_t k = 0; k < 3; ++k) {
+            std::vector<float> values(totals[k], 1.f);
+            FILE *fh = fopen(file, "wb");
+            REQUIRE(fh);
+            REQUIRE(fwrite(&values[0], sizeof(float), totals[k], fh) == totals[k]);
+            fclose(fh);
+            
+            CAPTURE(k);
+            CHECK((ms.AddSpectrogram(file, 0.7f) >= 0) == valid[k]);
+        }
+        remove(file);
+    }
+    
+    SECTION("Coarse To Fine") {
+        // alone, back to back and repeated
+        std::vector<float> signal = make_background(900, features, 1);
+        const size_t starts[] = {100, 300, 500, 540, 700, 800};
+        const size_t which[] = {0, 1, 0, 0, 1, 0};
+        for (size_t k = 0; k < 6; ++k) {
+            std::copy(templates[which[k]].begin(), templates[which[k]].end(), signal.begin() + starts[k] * features);
+        }
+        
+        std::vector<struct match> expected = run_matching(templates, signal, 1);
+        std::vector<std::vector<float>> expected_scores = g_scores;
+        std::vector<std::vector<int>> expected_lengths = g_lengths;
+        REQUIRE(expected.size() == 6);
+        
+        for (unsigned int decimation : {2, 4}) {
+            std::vector<struct match> matches = run_matching(templates, signal, decimation);
+            
+            // same matches, reported in the same column
+            CAPTURE(decimation);
+            REQUIRE(matches.size() == expected.size());
+            REQUIRE(g_scores.size() == expected_scores.size());
+            for (size_t k = 0; k < matches.size(); ++k) {
+                CAPTURE(k);
+                CHECK(matches[k].column == expected[k].column);
+                CHECK(matches[k].index == expected[k].index);
+                CHECK(matches[k].score == expected[k].score);
+                CHECK(matches[k].len == expected[k].len);
+                
+                // and the same trace for the syllable leading up to it
+                const size_t index = expected[k].index;
+                for (unsigned long c = expected[k].column - 1; c <= expected[k].column; ++c) {
+                    CAPTURE(c);
+                    CHECK(g_scores[c][index] == expected_scores[c][index]);
+                    CHECK(g_lengths[c][index] == expected_lengths[c][index]);
+                }
+            }
+        }
+    }
+    
+    SECTION("Shares Prefixes") {
+        // a syllable and its repeats, as composites sharing its rows
+        std::vector<std::vector<float>> composites(1, templates[0]);
+        for (size_t k = 1; k < 3; ++k) {
+            composites.push_back(composites.back());
+            composites.back().insert(composites.back().end(), templates[0].begin(), templates[0].end());
+        }
+        composites.push_back(templates[1]);
+        
+        // repeated without gaps, alone and once more after the other syllable
+        std::vector<float> signal = make_background(700, features, 3);
+        const size_t starts[] = {100, 140, 180, 300, 420, 464};
+        const size_t which[] = {0, 0, 0, 0, 1, 0};
+        for (size_t k = 0; k < 6; ++k) {
+            std::copy(templates[which[k]].begin(), templates[which[k]].end(), signal.begin() + starts[k] * features);
+        }
+        
+        std::vector<struct match> expected = run_matching(composites, signal, 1, 0.1f, false);
+        std::vector<std::vector<float>> expected_scores = g_scores;
+        REQUIRE(std::count_if(expected.begin(), expected.end(), [](const struct match &m) { return m.index == 2; }) == 1);
+        
+        // same matches and scores
+        std::vector<struct match> matches = run_matching(composites, signal, 1);
+        REQUIRE(matches.size() == expected.size());
+        for (size_t k = 0; k < matches.size(); ++k) {
+            CAPTURE(k);
+            CHECK(matches[k].column == expected[k].column);
+            CHECK(matches[k].index == expected[k].index);
+            CHECK(matches[k].score == expected[k].score);
+            CHECK(matches[k].len == expected[k].len);
+        }
+        CHECK(g_scores == expected_scores);
+    }
+    
+    SECTION("Switches On Near A Match") {
+        // followed by quiet columns, so the last (partial) group of columns still looks like the
+        // end of the template to the coarse matcher
+        for (size_t start : {101, 102, 103}) {
+            std::vector<float> signal = make_background(300, features, 2);
+            std::copy(templates[0].begin(), templates[0].end(), signal.begin() + start * features);
+            for (size_t i = (start + 40) * features; i < (start + 50) * features; ++i) {
+                signal[i] *= 0.01f;
+            }
+            
+            std::vector<struct match> expected = run_matching(templates, signal, 1);
+            std::vector<std::vector<float>> expected_scores = g_scores;
+            REQUIRE(expected.size() == 1);
+            
+            // the coarse score only reaches the threshold on the last group of columns
+            std::vector<struct match> matches = run_matching(templates, signal, 4, start == 102 ? 0.f : -0.2f);
+            CAPTURE(start);
+            if (start == 102) {
+                // only after the match ended (during the replay), so it is dropped rather than
+                // reported late
+                CHECK(matches.empty());
+                continue;
+            }
+            
+            // just before the match ended, so it is reported the same
+            REQUIRE(matches.size() == 1);
+            CHECK(matches[0].column == expected[0].column);
+            CHECK(matches[0].score == expected[0].score);
+            CHECK(matches[0].len == expected[0].len);
+            
+            // the full resolution matcher was still off a few columns before
+            CHECK(expected_scores[expected[0].column - 5][0] > 0.f);
+            CHECK(g_scores[expected[0].column - 5][0] == 0.f);
+        }
+    }
+}
@@ -0,0 +1,48 @@
+//
+//  TestMirroredMemory.cpp
+//  BelaWarpDetect
+//
+
+#include <stdio.h>
+#include <stdexcept>
+
+#include "catch.hpp"
+
+#include "MirroredMemory.hpp"
+
+#if defined(__linux__)
+TEST_CASE("Testing Mirrored Memory") {
+    SECTION("Rounds To Pages") {
+        MirroredMemory<float> mem(1000);
+        
+        REQUIRE(mem.size() >= 1000);
+        CHECK((mem.size() * sizeof(float)) % sysconf(_SC_PAGESIZE) == 0);
+        
+        for (size_t i = 0; i < mem.size(); ++i) {
+            CHECK(mem.ptr()[i] == 0.0);
+        }
+    }
+    
+    SECTION("Mirrored") {
+        MirroredMemory<float> mem(4096);
+        size_t size = mem.size();
+        
+        // write to first copy, read from second
+        for (size_t i = 0; i < size; ++i) {
+            mem.ptr()[i] = static_cast<float>(i);
+        }
+        for (size_t i = 0; i < size; ++i) {
+            CHECK(mem.ptr()[size + i] == static_cast<float>(i));
+        }
+        
+        // write across the end
+        for (size_t i = 0; i < 10; ++i) {
+            mem.ptr()[size - 5 + i] = -1.0;
+        }
+        for (size_t i = 0; i < 5; ++i) {
+            CHECK(mem.ptr()[i] == -1.0);
+            CHECK(mem.ptr()[size - 5 + i] == -1.0);
+        }
+    }
+}
+#endif
@@ -0,0 +1,111 @@
+//
+//  TestMultiChannelShortTimeFourierTransform.cpp
+//  TestBelaWarpDetect
+//
+
+#include <stdio.h>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "MultiChannelShortTimeFourierTransform.hpp"
+
+#define COMPARE_FLOAT_THRESH(a, b, threshold) (std::abs((a) - (b)) < threshold)
+
+TEST_CASE("Testing Multi-Channel STFT") {
+    const unsigned int channels = 3;
+    const unsigned int buffer_size = 4096;
+    const unsigned int window_length = 256;
+    const unsigned int stride = 100;
+    const unsigned int idx_lo = 10, idx_hi = 100, band = idx_hi - idx_lo;
+    
+    MultiChannelShortTermFourierTransform stft(channels, window_length, stride, buffer_size);
+    stft.SetWindowHanning();
+    
+    REQUIRE(stft.GetChannels() == channels);
+    REQUIRE(stft.GetLengthPower() == 129);
+    
+    // different signal on each channel
+    const unsigned int frames = window_length + 12 * stride;
+    std::vector<std::vector<float>> signals(channels, std::vector<float>(frames));
+    std::vector<float> interleaved(frames * channels), planar(frames * channels);
+    for (unsigned int c = 0; c < channels; ++c) {
+        for (unsigned int i = 0; i < frames; ++i) {
+            float v = sin((0.2 + 0.15 * c) * i) + 0.1 * c * cos(1.3 * i);
+            signals[c][i] = v;
+            interleaved[i * channels + c] = v;
+            planar[c * frames + i] = v;
+        }
+    }
+    
+    // reference: one single channel STFT per channel
+    std::vector<std::vector<float>> expected(channels);
+    for (unsigned int c = 0; c < channels; ++c) {
+        CircularShortTermFourierTransform single(window_length, stride, buffer_size);
+        single.SetWindowHanning();
+        REQUIRE(single.WriteValues(signals[c]));
+        
+        std::vector<float> column;
+        while (single.ReadPower(column, idx_lo, idx_hi)) {
+            expected[c].insert(expected[c].end(), column.begin(), column.end());
+        }
+    }
+    const unsigned int columns = static_cast<unsigned int>(expected[0].size() / band);
+    REQUIRE(columns == 13);
+    
+    SECTION("Invalid Arguments") {
+        CHECK_THROWS_AS(MultiChannelShortTermFourierTransform(0, window_length, stride), std::invalid_argument);
+    }
+    
+    SECTION("Interleaved Matches Single Channel") {
+        REQUIRE(stft.WriteValues(&interleaved[0], frames, channels, 1));
+        REQUIRE(stft.GetLengthColumns() == columns);
+        
+        // partial batches, so transforms mix columns and channels
+        std::vector<float> power(5 * channels * band);
+        unsigned int read = 0, n;
+        while ((n = stft.ReadPowerBatch(&power[0], 5, idx_lo, idx_hi)) > 0) {
+            for (unsigned int k = 0; k < n; ++k) {
+                for (unsigned int c = 0; c < channels; ++c) {
+                    for (unsigned int i = 0; i < band; ++i) {
+                        CHECK(COMPARE_FLOAT_THRESH(power[(k * channels + c) * band + i], expected[c][(read + k) * band + i], 1e-4));
+                    }
+                }
+            }
+            read += n;
+        }
+        CHECK(read == columns);
+        CHECK(stft.GetOverruns() == 0);
+    }
+    
+    SECTION("Planar Matches Single Channel") {
+        REQUIRE(stft.WriteValues(&planar[0], frames, 1, frames));
+        
+        std::vector<float> power(channels * band);
+        for (unsigned int k = 0; k < columns; ++k) {
+            REQUIRE(stft.ReadPower(&power[0], idx_lo, idx_hi));
+            for (unsigned int c = 0; c < channels; ++c) {
+                for (unsigned int i = 0; i < band; ++i) {
+                    CHECK(COMPARE_FLOAT_THRESH(power[c * band + i], expected[c][k * band + i], 1e-4));
+                }
+            }
+        }
+        CHECK_FALSE(stft.ReadPower(&power[0], idx_lo, idx_hi));
+    }
+    
+    SECTION("Channels Stay Aligned") {
+        // a write that does not fit is rejected for every channel
+        std::vector<float> big(buffer_size * channels);
+        CHECK_FALSE(stft.WriteValues(&big[0], buffer_size, channels));
+        CHECK(stft.GetOverruns() == 1);
+        CHECK(stft.GetLengthColumns() == 0);
+        
+        REQUIRE(stft.WriteValues(&interleaved[0], frames, channels));
+        CHECK(stft.GetLengthColumns() == columns);
+        
+        stft.Clear();
+        CHECK(stft.GetLengthColumns() == 0);
+    }
+}
@@ -0,0 +1,90 @@
+//
+//  TestMultiStreamDynamicTimeMatcher.cpp
+//  TestBelaWarpDetect
+//
+
+#include <stdio.h>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "DynamicTimeMatcher.hpp"
+#include "MultiStreamDynamicTimeMatcher.hpp"
+
+#define COMPARE_FLOAT_THRESH(a, b, threshold) (std::abs((a) - (b)) < threshold)
+
+TEST_CASE("Testing Multi-Stream Dynamic Time Matcher") {
+    // stream count that does not fill whole vectors
+    const size_t features = 24, length = 20, streams = 5;
+    
+    // template with a silent row (nan costs for most signal columns)
+    std::vector<float> templ(length * features);
+    for (size_t i = 0; i < length; ++i) {
+        for (size_t j = 0; j < features; ++j) {
+            templ[i * features + j] = (i == 7) ? 0.f : static_cast<float>(sin(0.4 * i + 0.9 * j) + 1.2);
+        }
+    }
+    
+    // varying alpha, as used by MatchSyllables
+    std::vector<float> alpha(length);
+    for (size_t i = 0; i < length; ++i) {
+        alpha[i] = 2.f + pow(0.9f, static_cast<float>(std::min(i, length - 1 - i)));
+    }
+    
+    SECTION("Invalid Arguments") {
+        CHECK_THROWS_AS(MultiStreamDynamicTimeMatcher(&templ[0], length, features, 0), std::invalid_argument);
+        CHECK_THROWS_AS(MultiStreamDynamicTimeMatcher(std::vector<std::vector<float>>(), streams), std::invalid_argument);
+    }
+    
+    SECTION("Matches Single Stream") {
+        MultiStreamDynamicTimeMatcher multi(&templ[0], length, features, streams);
+        REQUIRE(multi.GetStreams() == streams);
+        REQUIRE(multi.GetStride() >= streams);
+        REQUIRE(multi.SetAlpha(alpha));
+        
+        std::vector<DynamicTimeMatcher *> singles;
+        for (size_t s = 0; s < streams; ++s) {
+            singles.push_back(new DynamicTimeMatcher(&templ[0], length, features));
+            REQUIRE(singles[s]->SetAlpha(alpha));
+        }
+        
+        // different signal per stream (with silent and quiet columns), resetting streams independently
+        const size_t feature_stride = features + 3;
+        std::vector<float> signal(streams * feature_stride);
+        std::vector<struct dtm_out> out(streams);
+        for (size_t c = 0; c < 150; ++c) {
+            for (size_t s = 0; s < streams; ++s) {
+                float gain = ((c + s) % 11 == 4) ? 0.f : (((c + s) % 13 == 6) ? 0.05f : 1.f);
+                for (size_t j = 0; j < features; ++j) {
+                    signal[s * feature_stride + j] = gain * static_cast<float>(sin(0.4 * (c % (length + s)) + 0.9 * j + 0.1 * s) + 1.2);
+                }
+            }
+            if (c == 60) {
+                multi.Reset();
+                for (size_t s = 0; s < streams; ++s) {
+                    singles[s]->Reset();
+                }
+            }
+            if (c % 17 == 9) {
+                multi.Reset(c % streams);
+                singles[c % streams]->Reset();
+            }
+            
+            multi.IngestFeatureVectors(&signal[0], feature_stride, &out[0]);
+            for (size_t s = 0; s < streams; ++s) {
+                struct dtm_out expected = singles[s]->IngestFeatureVector(&signal[s * feature_stride]);
+                CAPTURE(c);
+                CAPTURE(s);
+                CHECK(COMPARE_FLOAT_THRESH(out[s].score, expected.score, 1e-5 * (1.f + expected.score)));
+                CHECK(out[s].normalized_score == Approx(expected.normalized_score).margin(1e-5));
+                CHECK(out[s].len_diff == expected.len_diff);
+            }
+        }
+        
+        for (size_t s = 0; s < streams; ++s) {
+            delete singles[s];
+        }
+    }
+}
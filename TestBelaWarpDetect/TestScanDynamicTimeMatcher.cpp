@@ -0,0 +1,102 @@
+//
+//  TestScanDynamicTimeMatcher.cpp
+//  TestBelaWarpDetect
+//
+
+#include <stdio.h>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "DynamicTimeMatcher.hpp"
+#include "ScanDynamicTimeMatcher.hpp"
+
+#define COMPARE_FLOAT_THRESH(a, b, threshold) (std::abs((a) - (b)) < threshold)
+
+TEST_CASE("Testing Scan Dynamic Time Matcher") {
+    const size_t features = 16;
+    
+    SECTION("Invalid Arguments") {
+        CHECK_THROWS_AS(ScanDynamicTimeMatcher(std::vector<std::vector<float>>()), std::invalid_argument);
+        
+        std::vector<std::vector<float>> ragged(3, std::vector<float>(features, 1.f));
+        ragged[1].resize(features - 1);
+        CHECK_THROWS_AS(ScanDynamicTimeMatcher(ragged), std::invalid_argument);
+    }
+    
+    SECTION("Matches Sequential Costs") {
+        // lengths shorter than, around and much longer than the vector width
+        for (size_t length : {1, 3, 8, 37, 100, 401}) {
+            CAPTURE(length);
+            
+            std::vector<float> templ(length * features, 1.f);
+            std::vector<float> alpha(length);
+            for (size_t i = 0; i < length; ++i) {
+                alpha[i] = 2.f + pow(0.9f, static_cast<float>(std::min(i, length - 1 - i)));
+            }
+            
+            DynamicTimeMatcher dtm(&templ[0], length, features);
+            ScanDynamicTimeMatcher scan(&templ[0], length, features);
+            REQUIRE(dtm.SetAlpha(alpha));
+            REQUIRE(scan.SetAlpha(alpha));
+            REQUIRE(scan.GetLength() == length);
+            
+            // random costs, runs of zero cost (exact ties) and nan costs
+            std::vector<float> costs(length);
+            unsigned int seed = 7;
+            for (size_t c = 0; c < 300; ++c) {
+                for (size_t i = 0; i < length; ++i) {
+                    seed = seed * 1103515245u + 12345u;
+                    float r = static_cast<float>((seed >> 16) & 0x7fff) / 32768.f;
+                    if ((c / 20) % 3 == 1) {
+                        costs[i] = 0.f;
+                    }
+                    else if (r < 0.03f) {
+                        costs[i] = std::numeric_limits<float>::quiet_NaN();
+                    }
+                    else {
+                        costs[i] = 2.f * r;
+                    }
+                }
+                if (c == 150) {
+                    dtm.Reset();
+                    scan.Reset();
+                }
+                
+                struct dtm_out expected = dtm.IngestCostVector(&costs[0]);
+                struct dtm_out out = scan.IngestCostVector(&costs[0]);
+                CAPTURE(c);
+                CHECK(COMPARE_FLOAT_THRESH(out.score, expected.score, 1e-5 * (1.f + expected.score)));
+                CHECK(out.len_diff == expected.len_diff);
+            }
+        }
+    }
+    
+    SECTION("Matches Sequential Features") {
+        const size_t length = 45;
+        std::vector<float> templ(length * features);
+        for (size_t i = 0; i < templ.size(); ++i) {
+            templ[i] = static_cast<float>(sin(0.37 * i) + 1.1);
+        }
+        
+        DynamicTimeMatcher dtm(&templ[0], length, features);
+        ScanDynamicTimeMatcher scan(&templ[0], length, features);
+        
+        std::vector<float> signal(features);
+        for (size_t c = 0; c < 200; ++c) {
+            for (size_t j = 0; j < features; ++j) {
+                signal[j] = (c % 9 == 4) ? 0.f : static_cast<float>(sin(0.37 * ((c % 60) * features + j)) + 1.1);
+            }
+            
+            struct dtm_out expected = dtm.IngestFeatureVector(signal);
+            struct dtm_out out = scan.IngestFeatureVector(signal);
+            CAPTURE(c);
+            CHECK(COMPARE_FLOAT_THRESH(out.score, expected.score, 1e-4 * (1.f + expected.score)));
+            CHECK(out.normalized_score == Approx(expected.normalized_score).margin(1e-4));
+            CHECK(out.len_diff == expected.len_diff);
+        }
+    }
+}
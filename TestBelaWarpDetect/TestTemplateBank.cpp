@@ -0,0 +1,379 @@
+//
+//  TestTemplateBank.cpp
+//  TestBelaWarpDetect
+//
+
+#include <stdio.h>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "TemplateBank.hpp"
+
+#define COMPARE_FLOAT_THRESH(a, b, threshold) (std::abs((a) - (b)) < threshold)
+
+// cosine distance computed directly
+static float reference_cost(const float *t, const float *s, size_t features) {
+    double dot = 0, norm_t = 0, norm_s = 0;
+    for (size_t j = 0; j < features; ++j) {
+        dot += t[j] * s[j];
+        norm_t += t[j] * t[j];
+        norm_s += s[j] * s[j];
+    }
+    if (norm_t < 0.5 && norm_s < 0.5) {
+        return 0.f;
+    }
+    return static_cast<float>(1.0 - dot / (sqrt(norm_t) * sqrt(norm_s)));
+}
+
+// weighted cosine distance computed directly (bins weighted below the cutoff are left out)
+static float reference_weighted_cost(const float *t, const float *w, const float *s, size_t features, float cutoff) {
+    double dot = 0, norm_t = 0, norm_s = 0;
+    for (size_t j = 0; j < features; ++j) {
+        if (w[j] > 0.f && w[j] >= cutoff) {
+            dot += w[j] * t[j] * s[j];
+            norm_t += w[j] * t[j] * t[j];
+            norm_s += w[j] * s[j] * s[j];
+        }
+    }
+    if (norm_t < 0.5 && norm_s < 0.5) {
+        return 0.f;
+    }
+    return static_cast<float>(1.0 - dot / (sqrt(norm_t) * sqrt(norm_s)));
+}
+
+TEST_CASE("Testing Template Bank") {
+    // odd number of features, so rows need padding
+    const size_t features = 37;
+    
+    // rows with varied power (including all zero and quiet rows)
+    std::vector<float> rows(23 * features);
+    for (size_t i = 0; i < 23; ++i) {
+        float gain = (i == 5) ? 0.f : ((i % 4 == 2) ? 0.05f : 1.f);
+        for (size_t j = 0; j < features; ++j) {
+            rows[i * features + j] = gain * static_cast<float>(sin(0.3 * i * j + i) + 1.1);
+        }
+    }
+    
+    SECTION("Invalid Arguments") {
+        CHECK_THROWS_AS(TemplateBank(0), std::invalid_argument);
+        
+        TemplateBank bank(features), other(features + 1), half(features, kTemplateFloat16);
+        CHECK_THROWS_AS(bank.AddTemplate(other), std::invalid_argument);
+        CHECK_THROWS_AS(bank.AddTemplate(half), std::invalid_argument);
+    }
+    
+    SECTION("Matches Reference") {
+        // three templates, one appended from another bank
+        TemplateBank bank(features), single(features);
+        CHECK(bank.AddTemplate(&rows[0], 10) == 0);
+        CHECK(bank.AddTemplate(&rows[10 * features], 6) == 10);
+        CHECK(single.AddTemplate(&rows[16 * features], 7) == 0);
+        CHECK(bank.AddTemplate(single) == 16);
+        REQUIRE(bank.GetLength() == 23);
+        REQUIRE(bank.GetFeatures() == features);
+        
+        // loud, quiet and silent signal columns
+        std::vector<float> signal(features), costs(bank.GetLength());
+        for (float gain : {1.f, 0.05f, 0.f}) {
+            for (size_t j = 0; j < features; ++j) {
+                signal[j] = gain * static_cast<float>(cos(0.7 * j) + 1.2);
+            }
+            
+            bank.CalculateCosts(&signal[0], &costs[0]);
+            for (size_t i = 0; i < bank.GetLength(); ++i) {
+                CAPTURE(gain);
+                CAPTURE(i);
+                float expected = reference_cost(&rows[i * features], &signal[0], features);
+                if (std::isnan(expected)) {
+                    CHECK(std::isnan(costs[i]));
+                }
+                else {
+                    CHECK(COMPARE_FLOAT_THRESH(costs[i], expected, 1e-5));
+                }
+            }
+        }
+    }
+    
+    SECTION("Specialized Feature Counts") {
+        // deployed feature counts (44.1 and 48 kHz) have their own kernels, neighbors use the generic one
+        for (size_t n : {95, 86, 94, 87}) {
+            std::vector<float> wide(9 * n), signal(n), costs(9);
+            for (size_t i = 0; i < wide.size(); ++i) {
+                wide[i] = static_cast<float>(sin(0.37 * i) + 1.1);
+            }
+            for (size_t j = 0; j < n; ++j) {
+                signal[j] = static_cast<float>(cos(0.11 * j) + 1.2);
+            }
+            
+            TemplateBank bank(n);
+            bank.AddTemplate(&wide[0], 9);
+            bank.CalculateCosts(&signal[0], &costs[0]);
+            for (size_t i = 0; i < 9; ++i) {
+                CAPTURE(n);
+                CAPTURE(i);
+                CHECK(COMPARE_FLOAT_THRESH(costs[i], reference_cost(&wide[i * n], &signal[0], n), 1e-5));
+            }
+        }
+    }
+    
+    SECTION("Quantized Storage") {
+        // log power features are signed, so include negative values
+        std::vector<float> signed_rows(rows);
+        for (size_t j = 0; j < features; ++j) {
+            signed_rows[3 * features + j] = static_cast<float>(log(rows[3 * features + j]));
+        }
+        
+        // largest cost error against the float path, over many signal columns (bounds keep scores
+        // within a few hundredths of a percent over a template of hundreds of columns)
+        const TemplateStorage storages[] = {kTemplateFloat16, kTemplateInt8};
+        const float max_error[] = {1e-3f, 1e-2f};
+        for (size_t k = 0; k < 2; ++k) {
+            TemplateBank exact(features), quantized(features, storages[k]), single(features, storages[k]);
+            exact.AddTemplate(&signed_rows[0], 23);
+            quantized.AddTemplate(&signed_rows[0], 16);
+            single.AddTemplate(&signed_rows[16 * features], 7);
+            CHECK(quantized.AddTemplate(single) == 16);
+            REQUIRE(quantized.GetLength() == 23);
+            REQUIRE(quantized.GetStorage() == storages[k]);
+            CHECK(quantized.GetBytes() * (k == 0 ? 2 : 4) == exact.GetBytes());
+            
+            std::vector<float> signal(features), costs_exact(23), costs_quantized(23);
+            float err = 0.f;
+            for (size_t c = 0; c < 200; ++c) {
+                float gain = (c % 9 == 4) ? 0.f : ((c % 7 == 3) ? 0.05f : 1.f);
+                for (size_t j = 0; j < features; ++j) {
+                    signal[j] = gain * static_cast<float>(sin(0.11 * c * j + 0.3 * c) + 1.1);
+                }
+                
+                exact.CalculateCosts(&signal[0], &costs_exact[0]);
+                quantized.CalculateCosts(&signal[0], &costs_quantized[0]);
+                for (size_t i = 0; i < 23; ++i) {
+                    if (std::isnan(costs_exact[i])) {
+                        CHECK(std::isnan(costs_quantized[i]));
+                    }
+                    else {
+                        err = std::max(err, std::abs(costs_quantized[i] - costs_exact[i]));
+                    }
+                }
+            }
+            
+            CAPTURE(k);
+            CHECK(err < max_error[k]);
+            
+            // a row still matches itself
+            quantized.CalculateCosts(&signed_rows[features], &costs_quantized[0]);
+            CHECK(COMPARE_FLOAT_THRESH(costs_quantized[1], 0.f, 1e-2 * max_error[k]));
+        }
+    }
+    
+    SECTION("Several Columns") {
+        // enough rows for several tiles
+        std::vector<float> many(600 * features);
+        for (size_t i = 0; i < many.size(); ++i) {
+            many[i] = static_cast<float>(sin(0.37 * i) + 1.1);
+        }
+        
+        const size_t columns = 9;
+        std::vector<float> signal(columns * features);
+        for (size_t c = 0; c < columns; ++c) {
+            float gain = (c == 4) ? 0.f : ((c == 6) ? 0.05f : 1.f);
+            for (size_t j = 0; j < features; ++j) {
+                signal[c * features + j] = gain * static_cast<float>(cos(0.7 * j + c) + 1.2);
+            }
+        }
+        
+        for (TemplateStorage storage : {kTemplateFloat32, kTemplateFloat16, kTemplateInt8}) {
+            TemplateBank bank(features, storage);
+            bank.AddTemplate(&many[0], 600);
+            bank.AddTemplate(&rows[0], 23);
+            
+            std::vector<float> costs(columns * bank.GetLength()), expected(bank.GetLength());
+            bank.CalculateCosts(&signal[0], columns, &costs[0]);
+            for (size_t c = 0; c < columns; ++c) {
+                bank.CalculateCosts(&signal[c * features], &expected[0]);
+                for (size_t i = 0; i < bank.GetLength(); ++i) {
+                    CAPTURE(storage);
+                    CAPTURE(c);
+                    CAPTURE(i);
+                    if (std::isnan(expected[i])) {
+                        CHECK(std::isnan(costs[c * bank.GetLength() + i]));
+                    }
+                    else {
+                        CHECK(costs[c * bank.GetLength() + i] == expected[i]);
+                    }
+                }
+            }
+        }
+    }
+    
+    SECTION("Row Ranges") {
+        // dense, weighted and dense rows again
+        std::vector<float> weights(23 * features, 0.5f);
+        TemplateBank bank(features), part(features);
+        bank.AddTemplate(&rows[0], 8);
+        bank.AddTemplate(&rows[8 * features], &weights[0], 7);
+        bank.AddTemplate(&rows[15 * features], 8);
+        CHECK_THROWS_AS(part.AddTemplate(bank, 20, 4), std::invalid_argument);
+        CHECK(part.AddTemplate(bank, 5, 14) == 0);
+        REQUIRE(part.GetLength() == 14);
+        
+        std::vector<float> signal(features), costs(23), part_costs(14);
+        for (size_t j = 0; j < features; ++j) {
+            signal[j] = static_cast<float>(cos(0.7 * j) + 1.2);
+        }
+        bank.CalculateCosts(&signal[0], &costs[0]);
+        part.CalculateCosts(&signal[0], &part_costs[0]);
+        for (size_t i = 0; i < 14; ++i) {
+            CAPTURE(i);
+            CHECK((std::isnan(costs[5 + i]) ? std::isnan(part_costs[i]) : part_costs[i] == costs[5 + i]));
+            CHECK(part.SameRow(i, bank, 5 + i));
+            CHECK_FALSE(part.SameRow(i, bank, 4 + i));
+        }
+    }
+    
+    SECTION("Low Rank") {
+        std::vector<float> signal(features), exact(23), costs(23), energy, error;
+        for (size_t j = 0; j < features; ++j) {
+            signal[j] = static_cast<float>(cos(0.7 * j) + 1.2);
+        }
+        
+        // rows in a 3 dimensional subspace are matched almost exactly at rank 3
+        std::vector<float> low(23 * features);
+        for (size_t i = 0; i < 23; ++i) {
+            for (size_t j = 0; j < features; ++j) {
+                low[i * features + j] = static_cast<float>((i % 3 + 1) * sin(0.2 * j) + (i % 5) * cos(0.5 * j) + 0.1 * i);
+            }
+        }
+        TemplateBank subspace(features);
+        subspace.AddTemplate(&low[0], 23);
+        subspace.CalculateCosts(&signal[0], &exact[0]);
+        subspace.GetRankTradeoff(energy, error);
+        REQUIRE(energy.size() == features);
+        CHECK(energy[2] > 0.9999f);
+        CHECK(error[2] < 1e-3f);
+        REQUIRE(subspace.SetRank(3));
+        CHECK(subspace.GetRank() == 3);
+        subspace.CalculateCosts(&signal[0], &costs[0]);
+        for (size_t i = 0; i < 23; ++i) {
+            CAPTURE(i);
+            CHECK(COMPARE_FLOAT_THRESH(costs[i], exact[i], 1e-4));
+        }
+        
+        // any rows: the cost error is bounded by the reported error, and falls with the rank
+        std::vector<float> weights(5 * features, 1.f);
+        TemplateBank bank(features);
+        bank.AddTemplate(&rows[0], 18);
+        bank.AddTemplate(&rows[18 * features], &weights[0], 5); // matched exactly at any rank
+        bank.CalculateCosts(&signal[0], &exact[0]);
+        bank.GetRankTradeoff(energy, error);
+        CHECK_FALSE(bank.SetRank(features + 1));
+        
+        for (size_t r = 1; r < features; ++r) {
+            CHECK(energy[r] >= energy[r - 1]);
+            CHECK(error[r] <= error[r - 1] + 1e-6f);
+        }
+        CHECK(error[17] < 1e-3f); // 18 dense rows
+        
+        for (size_t rank : {1, 4, 10, 18}) {
+            REQUIRE(bank.SetRank(rank));
+            bank.CalculateCosts(&signal[0], &costs[0]);
+            for (size_t i = 0; i < 23; ++i) {
+                CAPTURE(rank);
+                CAPTURE(i);
+                if (std::isnan(exact[i])) {
+                    CHECK(std::isnan(costs[i]));
+                }
+                else if (i >= 18) {
+                    CHECK(costs[i] == exact[i]);
+                }
+                else {
+                    CHECK(std::abs(costs[i] - exact[i]) <= error[rank - 1] + 1e-4f);
+                }
+            }
+        }
+        
+        // the basis and coordinates are smaller than the rows
+        REQUIRE(bank.SetRank(0));
+        size_t bytes = bank.GetBytes();
+        REQUIRE(bank.SetRank(4));
+        CHECK(bank.GetBytes() < bytes);
+        
+        // adding rows goes back to exact matching
+        bank.AddTemplate(&rows[0], 1);
+        CHECK(bank.GetRank() == 0);
+    }
+    
+    SECTION("Weighted Rows") {
+        // weights between 0.5 and 1, like 1 / (1 + std)
+        std::vector<float> weights(23 * features);
+        for (size_t i = 0; i < weights.size(); ++i) {
+            weights[i] = 0.75f + 0.25f * static_cast<float>(sin(1.3 * i));
+        }
+        
+        // plain, weighted (with and without a cutoff) and appended rows
+        const float cutoff = 0.8f;
+        TemplateBank bank(features), weighted(features);
+        CHECK(bank.AddTemplate(&rows[0], 5) == 0);
+        CHECK(bank.AddTemplate(&rows[5 * features], &weights[5 * features], 6) == 5);
+        CHECK(bank.AddTemplate(&rows[11 * features], &weights[11 * features], 5, cutoff) == 11);
+        CHECK(weighted.AddTemplate(&rows[16 * features], &weights[16 * features], 4, cutoff) == 0);
+        CHECK(weighted.AddTemplate(&rows[20 * features], 3) == 4);
+        CHECK(bank.AddTemplate(weighted) == 16);
+        REQUIRE(bank.GetLength() == 23);
+        
+        const size_t columns = 3;
+        std::vector<float> signal(columns * features), costs(columns * 23), single(23);
+        for (size_t c = 0; c < columns; ++c) {
+            float gain = (c == 1) ? 0.05f : ((c == 2) ? 0.f : 1.f);
+            for (size_t j = 0; j < features; ++j) {
+                signal[c * features + j] = gain * static_cast<float>(cos(0.7 * j) + 1.2);
+            }
+        }
+        bank.CalculateCosts(&signal[0], columns, &costs[0]);
+        
+        for (size_t c = 0; c < columns; ++c) {
+            bank.CalculateCosts(&signal[c * features], &single[0]);
+            for (size_t i = 0; i < 23; ++i) {
+                float expected;
+                if (i < 5 || i >= 20) {
+                    expected = reference_cost(&rows[i * features], &signal[c * features], features);
+                }
+                else {
+                    expected = reference_weighted_cost(&rows[i * features], &weights[i * features], &signal[c * features], features, i < 11 ? 0.f : cutoff);
+                }
+                
+                CAPTURE(c);
+                CAPTURE(i);
+                if (std::isnan(expected)) {
+                    CHECK(std::isnan(costs[c * 23 + i]));
+                    CHECK(std::isnan(single[i]));
+                }
+                else {
+                    CHECK(COMPARE_FLOAT_THRESH(costs[c * 23 + i], expected, 1e-5));
+                    CHECK(single[i] == costs[c * 23 + i]);
+                }
+            }
+        }
+        
+        // less storage once the cutoff drops whole vectors of bins (e.g., between harmonics)
+        std::vector<float> harmonic(23 * features);
+        for (size_t i = 0; i < harmonic.size(); ++i) {
+            harmonic[i] = (i % features) < features / 2 ? 1.f : 0.5f;
+        }
+        TemplateBank all(features), sparse(features);
+        all.AddTemplate(&rows[0], &harmonic[0], 23);
+        sparse.AddTemplate(&rows[0], &harmonic[0], 23, cutoff);
+        CHECK(sparse.GetBytes() < all.GetBytes());
+        
+        // a row without any bin at the cutoff is rejected, leaving the bank unchanged
+        std::vector<float> inactive(weights.begin(), weights.begin() + 2 * features);
+        std::fill(inactive.begin() + features, inactive.end(), 0.5f);
+        CHECK_THROWS_AS(sparse.AddTemplate(&rows[0], &inactive[0], 2, cutoff), std::invalid_argument);
+        CHECK(sparse.GetLength() == 23);
+        CHECK(sparse.AddTemplate(&rows[0], &inactive[0], 2) == 23);
+    }
+}